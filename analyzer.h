@@ -0,0 +1,8889 @@
+// Directory Analyzer library: parallel directory traversal with pluggable backends,
+// per-type statistics, incremental indexes and snapshots. Header-only, in namespace da; the
+// da command-line tool (da.cpp) is one client.
+#pragma once
+
+#include <iostream>
+#include <filesystem>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <limits>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
+#include <string_view>
+#include <functional>
+#include <iterator>
+#include <tuple>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <system_error>
+#include <cstdlib>
+#include <cctype>
+#include <charconv>
+#include <new>
+#include <cmath>
+#include <random>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pwd.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+namespace da
+{
+
+namespace fs = std::filesystem;
+
+// Default memory budget of a scan (100MB), see MemoryBudget
+const size_t MAX_MEMORY_LIMIT = 100 * 1024 * 1024;
+
+// Type key that stands for every file type first seen after the memory budget was spent
+const std::string OTHER_TYPES = "[other types]";
+
+// Structure to store file size threshold
+struct SizeThreshold
+{
+    size_t minSize = 0;
+    size_t maxSize = std::numeric_limits<size_t>::max();
+
+    bool isValid() const
+    {
+        return minSize <= maxSize;
+    }
+};
+
+// Format file size with proper unit handling
+inline std::string formatSize(size_t bytes)
+{
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    int unit = 0;
+    double size = static_cast<double>(bytes);
+
+    while (size >= 1024 && unit < 4)
+    {
+        size /= 1024;
+        unit++;
+    }
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2) << size << " " << units[unit];
+    return oss.str();
+}
+
+// 64-bit FNV-1a hash of a byte string (paths in on-disk indexes, type keys, option fingerprints)
+inline uint64_t hashBytes(std::string_view bytes)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char ch : bytes)
+    {
+        hash ^= ch;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Streaming XXH64 (xxHash, 64-bit variant) for file contents: processes 32-byte stripes in
+// four independent lanes, several GB/s per core, with the reference output for any split of
+// the input into update() calls
+class Xxh64
+{
+private:
+    static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+    static constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+    uint64_t lanes[4];
+    unsigned char pending[32];
+    size_t pendingSize = 0;
+    uint64_t totalSize = 0;
+    uint64_t seed;
+
+    static uint64_t rotl(uint64_t value, unsigned bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    static uint64_t read64(const unsigned char *data)
+    {
+        uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    static uint32_t read32(const unsigned char *data)
+    {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    static uint64_t round(uint64_t acc, uint64_t input)
+    {
+        acc += input * PRIME2;
+        return rotl(acc, 31) * PRIME1;
+    }
+
+    static uint64_t mergeRound(uint64_t acc, uint64_t lane)
+    {
+        acc ^= round(0, lane);
+        return acc * PRIME1 + PRIME4;
+    }
+
+    void stripe(const unsigned char *data)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            lanes[i] = round(lanes[i], read64(data + 8 * i));
+        }
+    }
+
+public:
+    explicit Xxh64(uint64_t seed = 0) : seed(seed)
+    {
+        lanes[0] = seed + PRIME1 + PRIME2;
+        lanes[1] = seed + PRIME2;
+        lanes[2] = seed;
+        lanes[3] = seed - PRIME1;
+    }
+
+    void update(const void *input, size_t size)
+    {
+        const unsigned char *data = static_cast<const unsigned char *>(input);
+        totalSize += size;
+        if (pendingSize + size < sizeof(pending))
+        {
+            std::memcpy(pending + pendingSize, data, size);
+            pendingSize += size;
+            return;
+        }
+        if (pendingSize != 0)
+        {
+            const size_t fill = sizeof(pending) - pendingSize;
+            std::memcpy(pending + pendingSize, data, fill);
+            stripe(pending);
+            data += fill;
+            size -= fill;
+            pendingSize = 0;
+        }
+        for (; size >= 32; data += 32, size -= 32)
+        {
+            stripe(data);
+        }
+        std::memcpy(pending, data, size);
+        pendingSize = size;
+    }
+
+    uint64_t digest() const
+    {
+        uint64_t hash;
+        if (totalSize >= 32)
+        {
+            hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+            for (const uint64_t lane : lanes)
+            {
+                hash = mergeRound(hash, lane);
+            }
+        }
+        else
+        {
+            hash = seed + PRIME5;
+        }
+        hash += totalSize;
+
+        const unsigned char *data = pending;
+        size_t size = pendingSize;
+        for (; size >= 8; data += 8, size -= 8)
+        {
+            hash ^= round(0, read64(data));
+            hash = rotl(hash, 27) * PRIME1 + PRIME4;
+        }
+        if (size >= 4)
+        {
+            hash ^= static_cast<uint64_t>(read32(data)) * PRIME1;
+            hash = rotl(hash, 23) * PRIME2 + PRIME3;
+            data += 4;
+            size -= 4;
+        }
+        for (; size > 0; data++, size--)
+        {
+            hash ^= *data * PRIME5;
+            hash = rotl(hash, 11) * PRIME1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME2;
+        hash ^= hash >> 29;
+        hash *= PRIME3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+};
+
+// Scratch space for a lowercased type key; extensions longer than the inline buffer
+// (rare) spill into the string
+struct TypeKeyBuffer
+{
+    char inlineBytes[64];
+    std::string overflow;
+};
+
+// Lowercase the extension of filename starting at dot into buffer and return it
+inline std::string_view foldTypeKey(std::string_view filename, size_t dot, TypeKeyBuffer &buffer)
+{
+    const std::string_view ext = filename.substr(dot);
+    char *out = buffer.inlineBytes;
+    if (ext.size() > sizeof(buffer.inlineBytes))
+    {
+        buffer.overflow.resize(ext.size());
+        out = buffer.overflow.data();
+    }
+    for (size_t i = 0; i < ext.size(); i++)
+    {
+        const char ch = ext[i];
+        out[i] = (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+    }
+    return std::string_view(out, ext.size());
+}
+
+// Compute the type key of a file name (lowercase extension, "[dotfile]" or "[no extension]")
+// without allocating; the result points into buffer or at a static label
+inline std::string_view fileTypeKeyScalar(std::string_view filename, TypeKeyBuffer &buffer)
+{
+    if (filename.empty())
+    {
+        return "[invalid]";
+    }
+
+    const size_t dot = filename.find_last_of('.');
+    if (dot == std::string_view::npos)
+    {
+        return "[no extension]";
+    }
+    if (dot == 0)
+    {
+        return "[dotfile]"; // leading dot only, e.g. .bashrc
+    }
+    return foldTypeKey(filename, dot, buffer);
+}
+
+// Vector kernels for fileTypeKey(). They load the block of the name that ends at its last
+// byte, find the last dot in it with one compare, and lowercase the whole block with a
+// second one, so for any extension that fits in the block the name is read once. Names
+// shorter than a block are loaded from their start when the load stays inside the page
+// (it cannot fault, and the bytes past the name are masked off), otherwise copied first.
+// Longer extensions are searched for block by block backwards and folded by the scalar loop
+#if defined(__GNUC__) || defined(__clang__)
+#define DA_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define DA_NO_SANITIZE_ADDRESS
+#endif
+
+// Whether width bytes can be read from data without crossing into the next page
+inline bool withinPage(const char *data, size_t width)
+{
+    return (reinterpret_cast<uintptr_t>(data) & 4095) <= 4096 - width;
+}
+
+#if defined(__SSE2__)
+DA_NO_SANITIZE_ADDRESS inline std::string_view fileTypeKeySse2(std::string_view filename, TypeKeyBuffer &buffer)
+{
+    const size_t size = filename.size();
+    if (size == 0)
+    {
+        return "[invalid]";
+    }
+    const char *data = filename.data();
+    char padded[16];
+    const char *block = data;
+    size_t start = 0; // offset of the block in the name
+    uint32_t valid = 0xffff;
+    if (size >= 16)
+    {
+        start = size - 16;
+        block = data + start;
+    }
+    else
+    {
+        valid = (1u << size) - 1;
+        if (!withinPage(data, 16))
+        {
+            std::memset(padded, 0, sizeof(padded));
+            std::memcpy(padded, data, size);
+            block = padded;
+        }
+    }
+    const __m128i dotChar = _mm_set1_epi8('.');
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+    uint32_t dots = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, dotChar))) & valid;
+    if (dots != 0)
+    {
+        const size_t dot = start + 31 - static_cast<size_t>(__builtin_clz(dots));
+        if (dot == 0)
+        {
+            return "[dotfile]";
+        }
+        const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                                            _mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buffer.inlineBytes),
+                         _mm_add_epi8(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+        return std::string_view(buffer.inlineBytes + (dot - start), size - dot);
+    }
+    // The name is at least a block long here, so every block read below is inside it
+    for (size_t end = start; end > 0;)
+    {
+        const size_t from = end >= 16 ? end - 16 : 0;
+        const uint32_t inBlock = end - from == 16 ? 0xffff : (1u << (end - from)) - 1;
+        dots = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(
+                   _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + from)), dotChar))) &
+               inBlock;
+        if (dots != 0)
+        {
+            const size_t dot = from + 31 - static_cast<size_t>(__builtin_clz(dots));
+            return dot == 0 ? std::string_view("[dotfile]") : foldTypeKey(filename, dot, buffer);
+        }
+        end = from;
+    }
+    return "[no extension]";
+}
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("avx2"))) DA_NO_SANITIZE_ADDRESS inline std::string_view fileTypeKeyAvx2(std::string_view filename, TypeKeyBuffer &buffer)
+{
+    const size_t size = filename.size();
+    if (size == 0)
+    {
+        return "[invalid]";
+    }
+    const char *data = filename.data();
+    char padded[32];
+    const char *block = data;
+    size_t start = 0;
+    uint32_t valid = 0xffffffff;
+    if (size >= 32)
+    {
+        start = size - 32;
+        block = data + start;
+    }
+    else
+    {
+        valid = (1u << size) - 1;
+        if (!withinPage(data, 32))
+        {
+            std::memset(padded, 0, sizeof(padded));
+            std::memcpy(padded, data, size);
+            block = padded;
+        }
+    }
+    const __m256i dotChar = _mm256_set1_epi8('.');
+    const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+    uint32_t dots = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, dotChar))) & valid;
+    if (dots != 0)
+    {
+        const size_t dot = start + 31 - static_cast<size_t>(__builtin_clz(dots));
+        if (dot == 0)
+        {
+            return "[dotfile]";
+        }
+        const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('A' - 1)),
+                                               _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), bytes));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(buffer.inlineBytes),
+                            _mm256_add_epi8(bytes, _mm256_and_si256(upper, _mm256_set1_epi8(0x20))));
+        return std::string_view(buffer.inlineBytes + (dot - start), size - dot);
+    }
+    for (size_t end = start; end > 0;)
+    {
+        const size_t from = end >= 32 ? end - 32 : 0;
+        const uint32_t inBlock = end - from == 32 ? 0xffffffff : (1u << (end - from)) - 1;
+        dots = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                   _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + from)), dotChar))) &
+               inBlock;
+        if (dots != 0)
+        {
+            const size_t dot = from + 31 - static_cast<size_t>(__builtin_clz(dots));
+            return dot == 0 ? std::string_view("[dotfile]") : foldTypeKey(filename, dot, buffer);
+        }
+        end = from;
+    }
+    return "[no extension]";
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+// NEON has no movemask; narrowing the compare result by 4 bits gives 4 mask bits per byte
+inline uint64_t neonMask(uint8x16_t matches)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+}
+
+DA_NO_SANITIZE_ADDRESS inline std::string_view fileTypeKeyNeon(std::string_view filename, TypeKeyBuffer &buffer)
+{
+    const size_t size = filename.size();
+    if (size == 0)
+    {
+        return "[invalid]";
+    }
+    const char *data = filename.data();
+    char padded[16];
+    const char *block = data;
+    size_t start = 0;
+    uint64_t valid = ~uint64_t(0);
+    if (size >= 16)
+    {
+        start = size - 16;
+        block = data + start;
+    }
+    else
+    {
+        valid = (uint64_t(1) << (4 * size)) - 1;
+        if (!withinPage(data, 16))
+        {
+            std::memset(padded, 0, sizeof(padded));
+            std::memcpy(padded, data, size);
+            block = padded;
+        }
+    }
+    const uint8x16_t dotChar = vdupq_n_u8('.');
+    const uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t *>(block));
+    uint64_t dots = neonMask(vceqq_u8(bytes, dotChar)) & valid;
+    if (dots != 0)
+    {
+        const size_t dot = start + (63 - static_cast<size_t>(__builtin_clzll(dots))) / 4;
+        if (dot == 0)
+        {
+            return "[dotfile]";
+        }
+        const uint8x16_t upper = vcleq_u8(vsubq_u8(bytes, vdupq_n_u8('A')), vdupq_n_u8('Z' - 'A'));
+        vst1q_u8(reinterpret_cast<uint8_t *>(buffer.inlineBytes), vaddq_u8(bytes, vandq_u8(upper, vdupq_n_u8(0x20))));
+        return std::string_view(buffer.inlineBytes + (dot - start), size - dot);
+    }
+    for (size_t end = start; end > 0;)
+    {
+        const size_t from = end >= 16 ? end - 16 : 0;
+        const uint64_t inBlock = end - from == 16 ? ~uint64_t(0) : (uint64_t(1) << (4 * (end - from))) - 1;
+        dots = neonMask(vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(data + from)), dotChar)) & inBlock;
+        if (dots != 0)
+        {
+            const size_t dot = from + (63 - static_cast<size_t>(__builtin_clzll(dots))) / 4;
+            return dot == 0 ? std::string_view("[dotfile]") : foldTypeKey(filename, dot, buffer);
+        }
+        end = from;
+    }
+    return "[no extension]";
+}
+#endif
+
+using TypeKeyFunction = std::string_view (*)(std::string_view, TypeKeyBuffer &);
+
+struct TypeKeyKernel
+{
+    const char *name;
+    TypeKeyFunction function;
+};
+
+// Type key kernels this CPU can run, scalar first
+inline std::vector<TypeKeyKernel> typeKeyKernels()
+{
+    std::vector<TypeKeyKernel> kernels = {{"scalar", fileTypeKeyScalar}};
+#if defined(__SSE2__)
+    kernels.push_back({"sse2", fileTypeKeySse2});
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.push_back({"avx2", fileTypeKeyAvx2});
+    }
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    kernels.push_back({"neon", fileTypeKeyNeon});
+#endif
+    return kernels;
+}
+
+// The kernel that is fastest on this CPU for a sample of typical names. Wider vectors do not
+// always win: most names fit in 16 bytes, and some CPUs run 32-byte loads more slowly.
+// The scalar loop is three to four times slower than any vector kernel, so it is only
+// timed when it is the only one; this keeps the choice to about 10 us of a short run
+inline TypeKeyKernel fastestTypeKeyKernel()
+{
+    static const char *const sample[] = {
+        "main.cpp", "README", "app-2024-01-03.log", "IMG_2041.JPG", ".bashrc", "libz.so.1.2.13",
+        "index.html", "backup.tar.gz", "generated_protocol_messages_v2.pb.cc", "Makefile", "notes.TXT",
+        "access.log.17", "__init__.py", "photo 2019-08-12 at 10.42.11.jpeg", "x", "config.yaml"};
+    std::vector<TypeKeyKernel> kernels = typeKeyKernels();
+    if (kernels.size() > 1)
+    {
+        kernels.erase(kernels.begin());
+    }
+    if (kernels.size() == 1)
+    {
+        return kernels.front();
+    }
+    TypeKeyKernel best = kernels.front();
+    int64_t bestNs = std::numeric_limits<int64_t>::max();
+    TypeKeyBuffer buffer;
+    for (const auto &kernel : kernels)
+    {
+        for (int round = 0; round < 5; round++)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            for (int repeat = 0; repeat < 16; repeat++)
+            {
+                for (const char *name : sample)
+                {
+                    kernel.function(name, buffer);
+                }
+            }
+            const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            if (ns < bestNs)
+            {
+                bestNs = ns;
+                best = kernel;
+            }
+        }
+    }
+    return best;
+}
+
+// Kernel used by fileTypeKey(), timed and chosen once, on first use
+inline const TypeKeyKernel &typeKeyKernel()
+{
+    static const TypeKeyKernel best = fastestTypeKeyKernel();
+    return best;
+}
+
+// Compute the type key of a file name (lowercase extension, "[dotfile]" or "[no extension]")
+// without allocating; the result points into buffer or at a static label
+inline std::string_view fileTypeKey(std::string_view filename, TypeKeyBuffer &buffer)
+{
+    return typeKeyKernel().function(filename, buffer);
+}
+
+// Convert human-readable size to bytes with validation
+inline size_t parseSize(const std::string &sizeStr)
+{
+    std::istringstream iss(sizeStr);
+    double value;
+    std::string unit;
+
+    if (!(iss >> value) || value < 0)
+    {
+        throw std::runtime_error("Invalid size value: " + sizeStr);
+    }
+    iss >> unit;
+
+    std::transform(unit.begin(), unit.end(), unit.begin(), ::toupper);
+
+    if (unit == "B" || unit.empty())
+        return static_cast<size_t>(value);
+    if (unit == "KB" || unit == "K")
+        return static_cast<size_t>(value * 1024);
+    if (unit == "MB" || unit == "M")
+        return static_cast<size_t>(value * 1024 * 1024);
+    if (unit == "GB" || unit == "G")
+        return static_cast<size_t>(value * 1024 * 1024 * 1024);
+    if (unit == "TB" || unit == "T")
+        return static_cast<size_t>(value * 1024 * 1024 * 1024 * 1024);
+
+    throw std::runtime_error("Invalid size unit: " + unit);
+}
+
+// Parse a positive integer option value such as a worker count
+inline size_t parseCount(const std::string &countStr)
+{
+    size_t consumed = 0;
+    unsigned long long value = 0;
+    try
+    {
+        value = std::stoull(countStr, &consumed);
+    }
+    catch (const std::exception &)
+    {
+        throw std::runtime_error("Invalid count: " + countStr);
+    }
+    if (consumed != countStr.size() || value == 0 || countStr[0] == '-')
+    {
+        throw std::runtime_error("Invalid count: " + countStr);
+    }
+    return static_cast<size_t>(value);
+}
+
+// Log-linear histogram of file sizes for approximate quantiles: exact below 8 bytes, then 8
+// sub-buckets per power of two, so a bucket is at most 1/8 as wide as its lower bound. The
+// bucket count is fixed, recording is one count increment and sketches merge by adding counts
+struct SizeSketch
+{
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::vector<uint64_t> counts; // empty unless distributions are tracked
+
+    static unsigned log2Floor(uint64_t value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#else
+        unsigned result = 0;
+        while (value >>= 1)
+        {
+            result++;
+        }
+        return result;
+#endif
+    }
+
+    static size_t bucketOf(uint64_t size)
+    {
+        if (size < SUB_BUCKETS)
+        {
+            return static_cast<size_t>(size);
+        }
+        const unsigned exponent = log2Floor(size);
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + ((size >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t lowerBound(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+        {
+            return bucket;
+        }
+        const unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS) - 1;
+        return (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    }
+
+    static uint64_t width(size_t bucket)
+    {
+        return bucket < SUB_BUCKETS ? 1 : uint64_t(1) << (bucket / SUB_BUCKETS - 1);
+    }
+
+    bool enabled() const
+    {
+        return !counts.empty();
+    }
+
+    void enable()
+    {
+        counts.assign(BUCKETS, 0);
+    }
+
+    void record(uint64_t size)
+    {
+        if (!counts.empty())
+        {
+            counts[bucketOf(size)]++;
+        }
+    }
+
+    void merge(const SizeSketch &other)
+    {
+        if (other.counts.empty())
+        {
+            return;
+        }
+        if (counts.empty())
+        {
+            counts = other.counts;
+            return;
+        }
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            counts[i] += other.counts[i];
+        }
+    }
+
+    // Approximate q-quantile (0 to 1): find the bucket holding that rank and interpolate
+    // linearly inside it
+    uint64_t quantile(double q) const
+    {
+        uint64_t total = 0;
+        for (const uint64_t count : counts)
+        {
+            total += count;
+        }
+        if (total == 0)
+        {
+            return 0;
+        }
+        const double rank = q * static_cast<double>(total - 1);
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < counts.size(); bucket++)
+        {
+            if (counts[bucket] == 0)
+            {
+                continue;
+            }
+            if (rank < static_cast<double>(seen + counts[bucket]))
+            {
+                const double within = (rank - static_cast<double>(seen) + 0.5) / static_cast<double>(counts[bucket]);
+                return lowerBound(bucket) + static_cast<uint64_t>(within * static_cast<double>(width(bucket)));
+            }
+            seen += counts[bucket];
+        }
+        return lowerBound(counts.size() - 1);
+    }
+
+    // Counts per power of two: slot 0 holds empty files, slot k sizes in [2^(k-1), 2^k)
+    std::vector<uint64_t> powersOfTwo() const
+    {
+        std::vector<uint64_t> slots(65, 0);
+        for (size_t bucket = 0; bucket < counts.size(); bucket++)
+        {
+            const uint64_t low = lowerBound(bucket);
+            slots[low == 0 ? 0 : log2Floor(low) + 1] += counts[bucket];
+        }
+        return slots;
+    }
+};
+
+// Structure to store statistics for each file type with safe arithmetic
+struct FileTypeStats
+{
+    size_t count = 0;
+    size_t totalSize = 0;
+    size_t minSize = std::numeric_limits<size_t>::max();
+    size_t maxSize = 0;
+    size_t allocatedSize = 0; // bytes of allocated blocks (--disk-usage)
+    SizeSketch sketch;
+
+    void update(const size_t size)
+    {
+        if (count == std::numeric_limits<size_t>::max())
+        {
+            throw std::overflow_error("File count overflow");
+        }
+        count++;
+
+        if (totalSize > std::numeric_limits<size_t>::max() - size)
+        {
+            throw std::overflow_error("Total size overflow");
+        }
+        totalSize += size;
+        minSize = std::min(minSize, size);
+        maxSize = std::max(maxSize, size);
+        sketch.record(size);
+    }
+
+    // Count an entry whose size is not known yet (an opaque directory)
+    void addEntry()
+    {
+        if (count == std::numeric_limits<size_t>::max())
+        {
+            throw std::overflow_error("File count overflow");
+        }
+        count++;
+    }
+
+    // Add bytes without counting another file (contents of an opaque directory)
+    void addSize(const size_t size)
+    {
+        if (totalSize > std::numeric_limits<size_t>::max() - size)
+        {
+            throw std::overflow_error("Total size overflow");
+        }
+        totalSize += size;
+    }
+
+    // Whether any individual size was recorded (so min and max are meaningful)
+    bool hasSizes() const
+    {
+        return minSize <= maxSize;
+    }
+
+    size_t averageSize() const
+    {
+        return count == 0 ? 0 : totalSize / count;
+    }
+
+    // Approximate quantile, clamped to the exact min and max
+    size_t quantile(double q) const
+    {
+        return std::clamp<size_t>(sketch.quantile(q), minSize, maxSize);
+    }
+
+    void merge(const FileTypeStats &other)
+    {
+        if (count > std::numeric_limits<size_t>::max() - other.count)
+        {
+            throw std::overflow_error("File count overflow");
+        }
+        count += other.count;
+
+        if (totalSize > std::numeric_limits<size_t>::max() - other.totalSize)
+        {
+            throw std::overflow_error("Total size overflow");
+        }
+        totalSize += other.totalSize;
+        minSize = std::min(minSize, other.minSize);
+        maxSize = std::max(maxSize, other.maxSize);
+        allocatedSize += other.allocatedSize;
+        sketch.merge(other.sketch);
+    }
+};
+
+// Interning table giving each distinct type key a dense integer ID. Open addressing with
+// linear probing over string_view keys, so lookups of known types never allocate.
+class TypeTable
+{
+private:
+    std::vector<std::string> names;
+    std::vector<uint64_t> hashes;
+    std::vector<uint32_t> slots; // ID + 1, 0 marks an empty slot
+    size_t mask = 0;
+
+    void rehash(size_t capacity)
+    {
+        slots.assign(capacity, 0);
+        mask = capacity - 1;
+        for (uint32_t id = 0; id < names.size(); id++)
+        {
+            size_t slot = hashes[id] & mask;
+            while (slots[slot] != 0)
+            {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = id + 1;
+        }
+    }
+
+public:
+    // ID of a key, inserting it on first sight
+    uint32_t intern(std::string_view key)
+    {
+        if (slots.empty())
+        {
+            rehash(64);
+        }
+        const uint64_t hash = hashBytes(key);
+        size_t slot = hash & mask;
+        while (slots[slot] != 0)
+        {
+            const uint32_t id = slots[slot] - 1;
+            if (hashes[id] == hash && names[id] == key)
+            {
+                return id;
+            }
+            slot = (slot + 1) & mask;
+        }
+
+        const uint32_t id = static_cast<uint32_t>(names.size());
+        names.emplace_back(key);
+        hashes.push_back(hash);
+        slots[slot] = id + 1;
+        if (names.size() * 2 > slots.size())
+        {
+            rehash(slots.size() * 2);
+        }
+        return id;
+    }
+
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    // ID of a key, or NONE if it was never interned
+    uint32_t find(std::string_view key) const
+    {
+        if (slots.empty())
+        {
+            return NONE;
+        }
+        const uint64_t hash = hashBytes(key);
+        for (size_t slot = hash & mask; slots[slot] != 0; slot = (slot + 1) & mask)
+        {
+            const uint32_t id = slots[slot] - 1;
+            if (hashes[id] == hash && names[id] == key)
+            {
+                return id;
+            }
+        }
+        return NONE;
+    }
+
+    const std::string &name(uint32_t id) const
+    {
+        return names[id];
+    }
+
+    size_t size() const
+    {
+        return names.size();
+    }
+};
+
+// Space-Saving summary of the most frequent keys of a stream in fixed memory: CAPACITY
+// counters, and a key that has no counter takes over the smallest one, inheriting its count
+// as the error bound. Every key seen more often than total/CAPACITY is guaranteed a counter
+class HeavyHitters
+{
+public:
+    static constexpr size_t CAPACITY = 256;
+
+    struct Counter
+    {
+        std::string key;
+        uint64_t count = 0;
+        uint64_t size = 0;
+        uint64_t error = 0; // count and size may be overestimated by up to this many files
+    };
+
+private:
+    std::vector<Counter> counters;
+    std::vector<uint64_t> hashes;
+
+    size_t find(std::string_view key, uint64_t hash) const
+    {
+        for (size_t i = 0; i < hashes.size(); i++)
+        {
+            if (hashes[i] == hash && counters[i].key == key)
+            {
+                return i;
+            }
+        }
+        return counters.size();
+    }
+
+public:
+    bool empty() const
+    {
+        return counters.empty();
+    }
+
+    void offer(std::string_view key, uint64_t size, uint64_t count = 1, uint64_t error = 0)
+    {
+        const uint64_t hash = hashBytes(key);
+        size_t slot = find(key, hash);
+        if (slot == counters.size())
+        {
+            if (counters.size() < CAPACITY)
+            {
+                counters.push_back({std::string(key)});
+                hashes.push_back(hash);
+            }
+            else
+            {
+                slot = static_cast<size_t>(std::min_element(counters.begin(), counters.end(),
+                                                            [](const Counter &a, const Counter &b)
+                                                            { return a.count < b.count; }) -
+                                           counters.begin());
+                Counter &evicted = counters[slot];
+                evicted.key.assign(key.data(), key.size());
+                evicted.error = evicted.count;
+                hashes[slot] = hash;
+            }
+        }
+        Counter &counter = counters[slot];
+        counter.count += count;
+        counter.size += size;
+        counter.error += error;
+    }
+
+    void merge(const HeavyHitters &other)
+    {
+        for (const auto &counter : other.counters)
+        {
+            offer(counter.key, counter.size, counter.count, counter.error);
+        }
+    }
+
+    // Counters by estimated count, largest first
+    std::vector<Counter> sorted() const
+    {
+        std::vector<Counter> result = counters;
+        std::sort(result.begin(), result.end(), [](const Counter &a, const Counter &b)
+                  { return a.count != b.count ? a.count > b.count : a.key < b.key; });
+        return result;
+    }
+};
+
+// Aggregated results of a scan; each worker fills its own copy and they are merged at the end.
+// Per-type stats live in a flat vector indexed by the type's ID in the worker's TypeTable.
+struct ScanTotals
+{
+    TypeTable types;
+    std::vector<FileTypeStats> stats;
+    size_t totalFiles = 0;
+    size_t totalSize = 0;
+    size_t hiddenFiles = 0;
+    size_t hiddenSize = 0;
+    size_t entries = 0;         // directory entries examined
+    size_t allocatedSize = 0;   // allocated bytes of every counted file, hidden included
+    size_t linkedFiles = 0;     // further links to an inode already counted (--disk-usage)
+    size_t linkedSize = 0;
+    bool distributions = false; // give new types a size sketch
+    HeavyHitters untracked;     // most frequent of the types counted as OTHER_TYPES
+
+    FileTypeStats &statsFor(std::string_view fileType)
+    {
+        const uint32_t id = types.intern(fileType);
+        if (id >= stats.size())
+        {
+            stats.resize(id + 1);
+            if (distributions)
+            {
+                stats[id].sketch.enable();
+            }
+        }
+        return stats[id];
+    }
+
+    // Stats of a type that is already tracked, or nullptr
+    FileTypeStats *find(std::string_view fileType)
+    {
+        const uint32_t id = types.find(fileType);
+        return id == TypeTable::NONE || id >= stats.size() ? nullptr : &stats[id];
+    }
+
+    // Approximate bytes one more tracked type takes: its name, hash, table slots and stats
+    size_t typeCost(std::string_view fileType) const
+    {
+        return sizeof(std::string) + (fileType.size() > 15 ? fileType.size() + 1 : 0) + sizeof(uint64_t) +
+               4 * sizeof(uint32_t) + sizeof(FileTypeStats) + (distributions ? SizeSketch::BUCKETS * sizeof(uint64_t) : 0);
+    }
+
+    // Visit every type that has stats as (name, stats)
+    template <typename Visitor>
+    void forEachType(Visitor visitor) const
+    {
+        for (uint32_t id = 0; id < stats.size(); id++)
+        {
+            visitor(types.name(id), stats[id]);
+        }
+    }
+
+    void merge(const ScanTotals &other)
+    {
+        merge(other, [](std::string_view)
+              { return true; });
+    }
+
+    // Merge, folding the types of other that admit(type) refuses into OTHER_TYPES
+    template <typename Admit>
+    void merge(const ScanTotals &other, Admit admit)
+    {
+        other.forEachType([&](const std::string &fileType, const FileTypeStats &stat)
+                          {
+                              if (admit(fileType))
+                              {
+                                  statsFor(fileType).merge(stat);
+                              }
+                              else
+                              {
+                                  untracked.offer(fileType, stat.totalSize, stat.count);
+                                  statsFor(OTHER_TYPES).merge(stat);
+                              } });
+        totalFiles += other.totalFiles;
+        totalSize += other.totalSize;
+        hiddenFiles += other.hiddenFiles;
+        hiddenSize += other.hiddenSize;
+        entries += other.entries;
+        allocatedSize += other.allocatedSize;
+        linkedFiles += other.linkedFiles;
+        linkedSize += other.linkedSize;
+        untracked.merge(other.untracked);
+    }
+};
+
+// Totals of a whole tree estimated from random root-to-leaf probes (Knuth's estimator). A
+// probe starts at the root with weight 1, adds the totals of every directory it reads times
+// its weight, and descends into one subdirectory picked uniformly at random, multiplying the
+// weight by the number of subdirectories it picked from. Each probe is an unbiased estimate
+// of the tree's totals, so the mean over probes converges and their spread gives a
+// confidence interval. A type that a probe did not meet counts as 0 in it
+class TreeEstimate
+{
+public:
+    // Sum and sum of squares of one quantity over the probes
+    struct Moments
+    {
+        double sum = 0;
+        double squares = 0;
+
+        void add(double value)
+        {
+            sum += value;
+            squares += value * value;
+        }
+
+        void merge(const Moments &other)
+        {
+            sum += other.sum;
+            squares += other.squares;
+        }
+    };
+
+    struct TypeEstimate
+    {
+        Moments count;
+        Moments size;
+        size_t minSize = std::numeric_limits<size_t>::max(); // of the files the probes saw
+        size_t maxSize = 0;
+    };
+
+    // Weighted totals of the probe being walked
+    class Probe
+    {
+    private:
+        friend class TreeEstimate;
+
+        struct TypeSums
+        {
+            double count = 0;
+            double size = 0;
+            size_t minSize = std::numeric_limits<size_t>::max();
+            size_t maxSize = 0;
+        };
+
+        TypeTable types;
+        std::vector<TypeSums> stats;
+        double files = 0;
+        double size = 0;
+        double hiddenFiles = 0;
+        double hiddenSize = 0;
+        double directories = 0;
+
+    public:
+        void addDirectory(const ScanTotals &totals, double weight)
+        {
+            totals.forEachType([&](const std::string &fileType, const FileTypeStats &stat)
+                               {
+                                   const uint32_t id = types.intern(fileType);
+                                   if (id >= stats.size())
+                                   {
+                                       stats.resize(id + 1);
+                                   }
+                                   TypeSums &sums = stats[id];
+                                   sums.count += weight * static_cast<double>(stat.count);
+                                   sums.size += weight * static_cast<double>(stat.totalSize);
+                                   sums.minSize = std::min(sums.minSize, stat.minSize);
+                                   sums.maxSize = std::max(sums.maxSize, stat.maxSize); });
+            files += weight * static_cast<double>(totals.totalFiles);
+            size += weight * static_cast<double>(totals.totalSize);
+            hiddenFiles += weight * static_cast<double>(totals.hiddenFiles);
+            hiddenSize += weight * static_cast<double>(totals.hiddenSize);
+            directories += weight;
+        }
+    };
+
+private:
+    TypeTable types;
+    std::vector<TypeEstimate> stats;
+
+    TypeEstimate &statsFor(std::string_view fileType)
+    {
+        const uint32_t id = types.intern(fileType);
+        if (id >= stats.size())
+        {
+            stats.resize(id + 1);
+        }
+        return stats[id];
+    }
+
+public:
+    size_t probes = 0;
+    size_t directoriesRead = 0; // listings read from disk; the rest came from the probe caches
+    Moments files;
+    Moments size;
+    Moments hiddenFiles;
+    Moments hiddenSize;
+    Moments directories;
+
+    void add(const Probe &probe)
+    {
+        for (uint32_t id = 0; id < probe.stats.size(); id++)
+        {
+            const Probe::TypeSums &sums = probe.stats[id];
+            TypeEstimate &stat = statsFor(probe.types.name(id));
+            stat.count.add(sums.count);
+            stat.size.add(sums.size);
+            stat.minSize = std::min(stat.minSize, sums.minSize);
+            stat.maxSize = std::max(stat.maxSize, sums.maxSize);
+        }
+        files.add(probe.files);
+        size.add(probe.size);
+        hiddenFiles.add(probe.hiddenFiles);
+        hiddenSize.add(probe.hiddenSize);
+        directories.add(probe.directories);
+        probes++;
+    }
+
+    void merge(const TreeEstimate &other)
+    {
+        other.forEachType([this](const std::string &fileType, const TypeEstimate &stat)
+                          {
+                              TypeEstimate &own = statsFor(fileType);
+                              own.count.merge(stat.count);
+                              own.size.merge(stat.size);
+                              own.minSize = std::min(own.minSize, stat.minSize);
+                              own.maxSize = std::max(own.maxSize, stat.maxSize); });
+        files.merge(other.files);
+        size.merge(other.size);
+        hiddenFiles.merge(other.hiddenFiles);
+        hiddenSize.merge(other.hiddenSize);
+        directories.merge(other.directories);
+        probes += other.probes;
+        directoriesRead += other.directoriesRead;
+    }
+
+    template <typename Visitor>
+    void forEachType(Visitor visitor) const
+    {
+        for (uint32_t id = 0; id < stats.size(); id++)
+        {
+            visitor(types.name(id), stats[id]);
+        }
+    }
+
+    // Estimate of a type some probe met, or nullptr
+    const TypeEstimate *find(std::string_view fileType) const
+    {
+        const uint32_t id = types.find(fileType);
+        return id == TypeTable::NONE || id >= stats.size() ? nullptr : &stats[id];
+    }
+
+    // Estimated value of a quantity: its mean over the probes
+    double mean(const Moments &moments) const
+    {
+        return probes == 0 ? 0 : moments.sum / static_cast<double>(probes);
+    }
+
+    // Half-width of the confidence interval around mean() for the normal quantile z;
+    // infinite until there are two probes to compare
+    double margin(const Moments &moments, double z) const
+    {
+        if (probes < 2)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        const double n = static_cast<double>(probes);
+        const double variance = std::max(0.0, (moments.squares - moments.sum * moments.sum / n) / (n - 1));
+        return z * std::sqrt(variance / n);
+    }
+};
+
+// z such that a normal variable lies within z standard deviations of its mean with the given
+// probability, for two-sided confidence intervals
+inline double normalQuantile(double confidence)
+{
+    if (!(confidence > 0 && confidence < 1))
+    {
+        throw std::runtime_error("Invalid confidence: " + std::to_string(confidence) + " (expected a value between 0 and 1)");
+    }
+    double low = 0;
+    double high = 40;
+    for (int i = 0; i < 100; i++)
+    {
+        const double middle = (low + high) / 2;
+        (std::erf(middle / std::sqrt(2.0)) < confidence ? low : high) = middle;
+    }
+    return (low + high) / 2;
+}
+
+// Receives the warnings raised while scanning (unreadable files and directories, ignored
+// indexes, backend fallbacks). Calls are serialized, even when several workers warn at once
+using WarningHandler = std::function<void(const std::string &)>;
+
+inline WarningHandler &warningHandler()
+{
+    static WarningHandler handler;
+    return handler;
+}
+
+// Send warnings to handler instead of stderr; an empty handler restores the default
+inline void setWarningHandler(WarningHandler handler)
+{
+    warningHandler() = std::move(handler);
+}
+
+// Serialize warnings from concurrent scan workers so lines don't interleave on stderr
+inline void printWarning(const std::string &message)
+{
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (warningHandler())
+    {
+        warningHandler()(message);
+        return;
+    }
+    std::cerr << message << std::endl;
+}
+
+// Approximate memory budget shared by the scan workers. Workers charge what their growing
+// structures take (type tables, index records, snapshot records) through a private Account
+// that settles with the shared total every 64 KiB, so charging is not a contended atomic.
+// Once the total reaches the limit, new file types are lumped together and index records
+// are spilled to disk; a limit of 0 disables both
+class MemoryBudget
+{
+private:
+    static constexpr int64_t SETTLE_BYTES = 64 * 1024;
+
+    std::atomic<int64_t> used{0};
+    std::atomic<int64_t> peak{0};
+    std::atomic<bool> warned{false};
+    size_t limit = MAX_MEMORY_LIMIT;
+
+    void settle(int64_t bytes)
+    {
+        const int64_t now = used.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        int64_t seen = peak.load(std::memory_order_relaxed);
+        while (now > seen && !peak.compare_exchange_weak(seen, now, std::memory_order_relaxed))
+        {
+        }
+    }
+
+public:
+    // A worker's view of the budget
+    class Account
+    {
+    private:
+        MemoryBudget *budget = nullptr;
+        int64_t pending = 0;
+
+    public:
+        explicit Account(MemoryBudget *owner = nullptr) : budget(owner) {}
+
+        void charge(size_t bytes)
+        {
+            pending += static_cast<int64_t>(bytes);
+            if (pending >= SETTLE_BYTES && budget)
+            {
+                flush();
+            }
+        }
+
+        void release(size_t bytes)
+        {
+            pending -= static_cast<int64_t>(bytes);
+            if (pending <= -SETTLE_BYTES && budget)
+            {
+                flush();
+            }
+        }
+
+        void flush()
+        {
+            budget->settle(pending);
+            pending = 0;
+        }
+
+        // Whether the shared budget is spent; the first worker to notice warns once
+        bool exhausted() const
+        {
+            return budget && budget->exhausted();
+        }
+    };
+
+    void setLimit(size_t bytes)
+    {
+        limit = bytes;
+    }
+
+    size_t budgetBytes() const
+    {
+        return limit;
+    }
+
+    void reset()
+    {
+        used = 0;
+        peak = 0;
+        warned = false;
+    }
+
+    bool exhausted()
+    {
+        if (limit == 0 || used.load(std::memory_order_relaxed) < static_cast<int64_t>(limit))
+        {
+            return false;
+        }
+        if (!warned.exchange(true, std::memory_order_relaxed))
+        {
+            printWarning("Warning: Memory budget of " + formatSize(limit) +
+                         " reached; new file types are counted as [other types] and index records are spilled to disk");
+        }
+        return true;
+    }
+
+    // Highest total charged so far, in bytes
+    size_t peakBytes() const
+    {
+        return static_cast<size_t>(std::max<int64_t>(0, peak.load(std::memory_order_relaxed)));
+    }
+};
+
+// Nanoseconds on the monotonic clock, for durations
+inline int64_t monotonicNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Work-stealing task pool: each worker pops from the back of its own deque (depth-first,
+// cache friendly, or the front with setBreadthFirst) and idle workers steal from the front
+// of other deques (large subtrees).
+// Tasks can be split into lanes (Task::lane), each with its own limit on how many of its
+// tasks run at once; a worker skips lanes at their limit, so a lane of slow tasks cannot
+// occupy every worker while other lanes have work. Every worker keeps one deque per lane.
+// setActiveWorkers parks all but the first workers while the pool runs
+template <typename Task>
+class WorkStealingPool
+{
+private:
+    struct alignas(64) WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    size_t workers;
+    size_t lanes;
+    std::vector<std::unique_ptr<WorkQueue>> queues; // queues[worker * lanes + lane]
+    std::vector<size_t> laneLimits;
+    std::unique_ptr<std::atomic<size_t>[]> laneRunning;
+    bool fifo = false; // workers take their oldest task first
+    std::atomic<size_t> active;  // workers 0..active-1 take tasks, the rest stay parked
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> aborted{false};
+    std::mutex idleMutex;
+    std::condition_variable idleCv;
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+
+    WorkQueue &queue(size_t worker, size_t lane)
+    {
+        return *queues[worker * lanes + lane];
+    }
+
+    bool popLocal(size_t worker, size_t lane, Task &task)
+    {
+        WorkQueue &own = queue(worker, lane);
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.tasks.empty())
+        {
+            return false;
+        }
+        if (fifo)
+        {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+        }
+        else
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+        return true;
+    }
+
+    bool steal(size_t worker, size_t lane, Task &task)
+    {
+        for (size_t i = 1; i < workers; i++)
+        {
+            WorkQueue &victim = queue((worker + i) % workers, lane);
+            std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+            if (!lock.owns_lock() || victim.tasks.empty())
+            {
+                continue;
+            }
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    // Claim a running slot of a lane; a single lane is never limited
+    bool enterLane(size_t lane)
+    {
+        if (lanes == 1)
+        {
+            return true;
+        }
+        if (laneRunning[lane].fetch_add(1, std::memory_order_acq_rel) >= laneLimits[lane])
+        {
+            laneRunning[lane].fetch_sub(1, std::memory_order_acq_rel);
+            return false;
+        }
+        return true;
+    }
+
+    void leaveLane(size_t lane)
+    {
+        if (lanes > 1)
+        {
+            laneRunning[lane].fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+
+    template <typename Handler>
+    void execute(size_t worker, Task &task, Handler &handler)
+    {
+        try
+        {
+            handler(worker, task);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(failureMutex);
+            if (!failure)
+            {
+                failure = std::current_exception();
+            }
+            aborted = true;
+        }
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            idleCv.notify_all();
+        }
+    }
+
+    template <typename Handler>
+    void workerLoop(size_t worker, Handler &handler)
+    {
+        Task task;
+        size_t home = 0; // lane of the last task, tried first
+        while (pending.load(std::memory_order_acquire) != 0 && !aborted.load(std::memory_order_relaxed))
+        {
+            // A parked worker's queued tasks are left for the active ones to steal
+            if (worker >= active.load(std::memory_order_relaxed))
+            {
+                std::unique_lock<std::mutex> lock(idleMutex);
+                idleCv.wait_for(lock, std::chrono::milliseconds(10));
+                continue;
+            }
+            bool ran = false;
+            for (size_t i = 0; i < lanes && !ran; i++)
+            {
+                const size_t lane = (home + i) % lanes;
+                if (!enterLane(lane))
+                {
+                    continue;
+                }
+                if (popLocal(worker, lane, task) || steal(worker, lane, task))
+                {
+                    execute(worker, task, handler);
+                    home = lane;
+                    ran = true;
+                }
+                leaveLane(lane);
+            }
+            if (ran)
+            {
+                continue;
+            }
+
+            // Nothing to do right now; sleep briefly until a task is pushed or the scan ends
+            std::unique_lock<std::mutex> lock(idleMutex);
+            idleCv.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+
+public:
+    // limits holds the concurrency limit of each lane; empty means one unlimited lane
+    explicit WorkStealingPool(size_t workerCount, std::vector<size_t> limits = {})
+        : workers(std::max<size_t>(workerCount, 1)), lanes(std::max<size_t>(limits.size(), 1)),
+          laneLimits(std::move(limits)), laneRunning(new std::atomic<size_t>[lanes]), active(workers)
+    {
+        for (size_t i = 0; i < workers * lanes; i++)
+        {
+            queues.push_back(std::make_unique<WorkQueue>());
+        }
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+            laneRunning[lane] = 0;
+        }
+    }
+
+    size_t size() const
+    {
+        return workers;
+    }
+
+    // Have workers take their oldest task instead of their newest: breadth-first instead
+    // of depth-first, at the cost of queueing a whole level of the tree at once
+    void setBreadthFirst(bool enabled)
+    {
+        fifo = enabled;
+    }
+
+    // Let only the first count workers (at least one) take tasks, from any thread; the
+    // others park until they are let back in or the scan ends
+    void setActiveWorkers(size_t count)
+    {
+        active.store(std::clamp<size_t>(count, 1, workers), std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idleCv.notify_all();
+    }
+
+    size_t activeWorkers() const
+    {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    // Tasks queued or running; a snapshot for progress reporting
+    size_t pendingTasks() const
+    {
+        return pending.load(std::memory_order_relaxed);
+    }
+
+    // Queue a task on the given worker's deque; safe to call from inside a handler
+    void push(size_t worker, Task task)
+    {
+        pending.fetch_add(1, std::memory_order_acq_rel);
+        {
+            WorkQueue &target = queue(worker, lanes == 1 ? 0 : task.lane);
+            std::lock_guard<std::mutex> lock(target.mutex);
+            target.tasks.push_back(std::move(task));
+        }
+        if (workers > 1)
+        {
+            idleCv.notify_one();
+        }
+    }
+
+    // Process the root task and everything it spawns; the calling thread acts as worker 0.
+    // It runs the root alone, so the other workers are only started once there is more to
+    // do: a flat directory then costs no thread starts
+    template <typename Handler>
+    void run(Task root, Handler handler)
+    {
+        pending.fetch_add(1, std::memory_order_acq_rel);
+        execute(0, root, handler);
+
+        std::vector<std::thread> threads;
+        for (size_t worker = 1; worker < workers && pending.load(std::memory_order_acquire) != 0; worker++)
+        {
+            threads.emplace_back([this, worker, &handler]
+                                 { workerLoop(worker, handler); });
+        }
+        workerLoop(0, handler);
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+    }
+};
+
+// AIMD controller of how much metadata I/O a scan keeps in flight (--adaptive), after TCP
+// congestion control. The window counts operations in flight: first one per active worker,
+// then, once every worker is active and the backend overlaps lookups (io_uring), lookups per
+// worker. Each interval it is fed the operations completed and their summed latency, and
+// estimates like TCP Vegas how many of the window's operations were waiting rather than
+// being served: window * (1 - lowest latency seen / latency). The window doubles until that
+// estimate first passes an eighth of it (slow start); after that it grows by a sixteenth
+// while under an eighth, holds up to a quarter and is cut by an eighth beyond, so it settles
+// just above the point where the device saturates. It is halved whenever the mean latency
+// passes the ceiling
+class ConcurrencyController
+{
+public:
+    struct Decision
+    {
+        size_t workers = 1;
+        unsigned depth = 1;       // lookups in flight per worker
+        double latencyNs = 0;     // mean operation latency over the last interval
+        double waiting = 0;       // estimated operations of the window waiting to be served
+        double operationsPerSecond = 0;
+        const char *action = "start";
+        const char *reason = "slow start";
+    };
+
+    // How often the window is adjusted; fewer operations than MIN_OPERATIONS in an interval
+    // say too little about latency to act on, so they are added to the next one
+    static constexpr std::chrono::milliseconds INTERVAL{250};
+    static constexpr uint64_t MIN_OPERATIONS = 16;
+
+private:
+    size_t maxWorkers;
+    unsigned maxDepth;
+    double ceilingNs;
+    size_t window;
+    bool slowStart = true;
+    double baseLatencyNs = 0;
+    Decision current;
+
+    void apply(size_t target, const char *action, const char *reason)
+    {
+        window = std::clamp<size_t>(target, 1, maxWorkers * maxDepth);
+        current.workers = std::min(window, maxWorkers);
+        current.depth = static_cast<unsigned>(std::clamp<size_t>(window / current.workers, 1, maxDepth));
+        current.action = action;
+        current.reason = reason;
+    }
+
+public:
+    ConcurrencyController(size_t workers, unsigned depth, int64_t latencyCeilingNs)
+        : maxWorkers(std::max<size_t>(workers, 1)), maxDepth(std::max(depth, 1u)),
+          ceilingNs(static_cast<double>(latencyCeilingNs)), window(4)
+    {
+        apply(window, "start", "slow start");
+    }
+
+    const Decision &decision() const
+    {
+        return current;
+    }
+
+    // Adjust the window to an interval of elapsedNs in which operations completed with a
+    // summed latency of latencyNs. starved means fewer tasks were queued than workers
+    // active, so adding workers could not raise throughput
+    const Decision &update(uint64_t operations, int64_t latencyNs, int64_t elapsedNs, bool starved)
+    {
+        const double mean = static_cast<double>(latencyNs) / static_cast<double>(std::max<uint64_t>(operations, 1));
+        current.latencyNs = mean;
+        current.operationsPerSecond = operations / std::max(1e-9, elapsedNs / 1e9);
+        if (baseLatencyNs == 0 || mean < baseLatencyNs)
+        {
+            baseLatencyNs = mean;
+        }
+        const double inFlight = static_cast<double>(current.workers) * current.depth;
+        current.waiting = mean > 0 ? inFlight * (1 - baseLatencyNs / mean) : 0;
+
+        const bool increasable = window < maxWorkers * maxDepth && !(starved && window < maxWorkers);
+        if (mean > ceilingNs)
+        {
+            slowStart = false;
+            apply(window / 2, window > 1 ? "halve" : "hold", "latency over ceiling");
+        }
+        else if (current.waiting > std::max(2.0, inFlight / 4))
+        {
+            slowStart = false;
+            apply(window - std::max<size_t>(1, window / 8), "back off", "operations queueing");
+        }
+        else if (current.waiting > std::max(1.0, inFlight / 8))
+        {
+            slowStart = false;
+            apply(window, "hold", "near saturation");
+        }
+        else if (!increasable)
+        {
+            apply(window, "hold", starved ? "waiting for queued directories" : "at maximum");
+        }
+        else
+        {
+            apply(slowStart ? window * 2 : window + std::max<size_t>(1, window / 16), "grow",
+                  slowStart ? "slow start" : "latency near lowest");
+        }
+        return current;
+    }
+};
+
+// Bump allocator for the directory paths queued as scan tasks. Paths are carved out of large
+// chunks owned by one worker; each chunk counts the paths still alive in it and is recycled
+// by its owner once every one of them has been scanned (possibly by another worker), so a
+// traversal builds child paths without a heap allocation per directory and memory stays
+// proportional to the paths still queued.
+class PathArena
+{
+public:
+    struct Chunk
+    {
+        std::atomic<size_t> live{0};
+        size_t used = 0;
+        size_t capacity = 0;
+        std::unique_ptr<char[]> data;
+    };
+
+    // Reference to a NUL-terminated path stored in an arena chunk
+    struct Path
+    {
+        const char *data = nullptr;
+        size_t length = 0;
+        Chunk *chunk = nullptr;
+
+        std::string_view view() const
+        {
+            return std::string_view(data, length);
+        }
+    };
+
+private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    std::vector<Chunk *> retired; // full chunks whose paths are still queued
+    Chunk *current = nullptr;
+
+    Chunk *freshChunk(size_t minimum)
+    {
+        // Reuse a retired chunk whose paths have all been released
+        for (size_t i = 0; i < retired.size(); i++)
+        {
+            Chunk *chunk = retired[i];
+            if (chunk->capacity >= minimum && chunk->live.load(std::memory_order_acquire) == 0)
+            {
+                retired[i] = retired.back();
+                retired.pop_back();
+                chunk->used = 0;
+                return chunk;
+            }
+        }
+        auto chunk = std::make_unique<Chunk>();
+        chunk->capacity = std::max(CHUNK_SIZE, minimum);
+        chunk->data.reset(new char[chunk->capacity]);
+        chunks.push_back(std::move(chunk));
+        return chunks.back().get();
+    }
+
+public:
+    // Store parent + '/' + name (the separator is skipped if parent already ends with one)
+    Path allocate(std::string_view parent, std::string_view name)
+    {
+        const bool separator = !parent.empty() && parent.back() != '/' && !name.empty();
+        const size_t length = parent.size() + separator + name.size();
+        if (current == nullptr || current->capacity - current->used < length + 1)
+        {
+            if (current != nullptr)
+            {
+                retired.push_back(current);
+            }
+            current = freshChunk(length + 1);
+        }
+
+        char *out = current->data.get() + current->used;
+        std::memcpy(out, parent.data(), parent.size());
+        if (separator)
+        {
+            out[parent.size()] = '/';
+        }
+        std::memcpy(out + parent.size() + separator, name.data(), name.size());
+        out[length] = '\0';
+        current->used += length + 1;
+        current->live.fetch_add(1, std::memory_order_relaxed);
+        return Path{out, length, current};
+    }
+
+    // Mark a path as no longer needed; callable from any worker
+    static void release(const Path &path)
+    {
+        if (path.chunk != nullptr)
+        {
+            path.chunk->live.fetch_sub(1, std::memory_order_release);
+        }
+    }
+};
+
+// Build parent + '/' + name into a reusable buffer; used for transient full paths
+// (warnings, exclusion checks) so they reuse the same capacity for every sibling
+inline const std::string &buildChildPath(std::string &buffer, std::string_view parent, std::string_view name)
+{
+    buffer.assign(parent.data(), parent.size());
+    if (!buffer.empty() && buffer.back() != '/')
+    {
+        buffer.push_back('/');
+    }
+    buffer.append(name.data(), name.size());
+    return buffer;
+}
+
+// Kind of a directory entry; Unknown means the reader could not tell without a stat
+enum class EntryType : uint8_t
+{
+    Unknown,
+    Regular,
+    Directory,
+    Symlink,
+    Other
+};
+
+// One entry of a directory listing; the name lives in the listing's name pool
+struct DirEntry
+{
+    uint32_t nameOffset = 0;
+    uint32_t nameLength = 0;
+    uint64_t inode = 0;
+    uint64_t device = 0; // only filled in by stat()
+    uint64_t size = 0;
+    uint64_t links = 1;  // hard link count, filled in by stat() where available
+    uint64_t blocks = 0; // allocated 512-byte blocks, filled in by stat() where available
+    int64_t mtimeNs = 0; // modification and access time and owner, filled in by stat() where available
+    int64_t atimeNs = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    EntryType type = EntryType::Unknown;
+    bool symlink = false; // the entry itself is a symlink (type describes its target after stat)
+    bool needsStat = false;
+    int error = 0;
+};
+
+// All entries of one directory, read in a single pass before any of them is processed
+struct DirListing
+{
+    std::vector<char> names; // NUL-terminated names stored back to back
+    std::vector<DirEntry> entries;
+
+    void clear()
+    {
+        names.clear();
+        entries.clear();
+    }
+
+    void add(const char *name, size_t length, EntryType type, uint64_t inode)
+    {
+        DirEntry entry;
+        entry.nameOffset = static_cast<uint32_t>(names.size());
+        entry.nameLength = static_cast<uint32_t>(length);
+        entry.inode = inode;
+        entry.type = type;
+        entry.symlink = type == EntryType::Symlink;
+        names.insert(names.end(), name, name + length);
+        names.push_back('\0');
+        entries.push_back(entry);
+    }
+
+    const char *cname(const DirEntry &entry) const
+    {
+        return names.data() + entry.nameOffset;
+    }
+
+    std::string_view name(const DirEntry &entry) const
+    {
+        return std::string_view(names.data() + entry.nameOffset, entry.nameLength);
+    }
+};
+
+// Directory scanning backend. A scan reads a whole directory with list(), marks the entries
+// whose metadata it needs, resolves them with stat() and finally releases the directory.
+class DirectoryReader
+{
+public:
+    virtual ~DirectoryReader() = default;
+
+    // Read all entries of path; returns false and sets ec if the directory cannot be read
+    virtual bool list(const char *path, DirListing &listing, std::error_code &ec) = 0;
+
+    // Fill in type, size and (device, inode) for every entry with needsStat set, following
+    // symlinks like std::filesystem does; failures are reported through DirEntry::error
+    virtual void stat(DirListing &listing) = 0;
+
+    // Release the directory opened by the last list() call
+    virtual void close() {}
+
+    // Most lookups a stat() call keeps in flight at once; 1 for backends that make them
+    // one after another
+    virtual unsigned maxInFlight() const
+    {
+        return 1;
+    }
+
+    // Cap the lookups in flight at the value of limit (read on every stat() call) and time
+    // each lookup; a null limit restores the backend's own depth
+    virtual void limitInFlight(const std::atomic<unsigned> *) {}
+
+    // Lookups of the last stat() call and their summed latency, when they overlapped;
+    // false if they ran one at a time, so that the call's duration is their latency
+    virtual bool overlappedLookups(size_t &, int64_t &) const
+    {
+        return false;
+    }
+};
+
+// Portable backend built on std::filesystem::directory_iterator
+class StdDirectoryReader : public DirectoryReader
+{
+private:
+    fs::path current;
+
+public:
+    bool list(const char *path, DirListing &listing, std::error_code &ec) override
+    {
+        current = path;
+        fs::directory_iterator it(current, fs::directory_options::skip_permission_denied, ec);
+        if (ec)
+        {
+            return false;
+        }
+        for (; it != fs::directory_iterator(); it.increment(ec))
+        {
+            if (ec)
+            {
+                return false;
+            }
+            const fs::directory_entry &entry = *it;
+            std::error_code typeEc;
+            EntryType type = EntryType::Other;
+            if (entry.is_directory(typeEc))
+            {
+                type = EntryType::Directory;
+            }
+            else if (entry.is_regular_file(typeEc))
+            {
+                type = EntryType::Regular;
+            }
+            const std::string &native = entry.path().native();
+            const size_t slash = native.find_last_of('/');
+            const size_t start = slash == std::string::npos ? 0 : slash + 1;
+            listing.add(native.data() + start, native.size() - start, type, 0);
+            listing.entries.back().symlink = entry.is_symlink(typeEc);
+        }
+        return !ec;
+    }
+
+    void stat(DirListing &listing) override
+    {
+        for (auto &entry : listing.entries)
+        {
+            if (!entry.needsStat)
+            {
+                continue;
+            }
+            if (entry.type == EntryType::Directory)
+            {
+#ifdef __linux__
+                struct stat st;
+                const fs::path child = current / listing.cname(entry);
+                if (::stat(child.c_str(), &st) == 0)
+                {
+                    entry.device = st.st_dev;
+                    entry.inode = st.st_ino;
+                }
+#endif
+                continue;
+            }
+#ifdef __linux__
+            // One stat gives the link count and allocation along with the size
+            struct stat st;
+            const fs::path child = current / listing.cname(entry);
+            if (::stat(child.c_str(), &st) != 0)
+            {
+                entry.error = errno;
+                continue;
+            }
+            entry.size = static_cast<uint64_t>(st.st_size);
+            entry.device = st.st_dev;
+            entry.inode = st.st_ino;
+            entry.links = st.st_nlink;
+            entry.blocks = static_cast<uint64_t>(st.st_blocks);
+            entry.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+            entry.atimeNs = static_cast<int64_t>(st.st_atim.tv_sec) * 1000000000 + st.st_atim.tv_nsec;
+            entry.uid = st.st_uid;
+            entry.gid = st.st_gid;
+            entry.error = 0;
+#else
+            std::error_code ec;
+            entry.size = fs::file_size(current / listing.cname(entry), ec);
+            entry.error = ec.value();
+#endif
+        }
+    }
+};
+
+#ifdef __linux__
+// Layout of the records returned by getdents64(2)
+struct LinuxDirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Linux backend: reads directories with large getdents64 batches, takes entry types from
+// d_type and resolves metadata with fstatat relative to the open directory descriptor
+class GetdentsDirectoryReader : public DirectoryReader
+{
+private:
+    static constexpr size_t BUFFER_SIZE = 256 * 1024;
+
+    std::unique_ptr<char[]> buffer{new char[BUFFER_SIZE]};
+
+protected:
+    int dirFd = -1;
+
+    static EntryType fromDirentType(unsigned char type)
+    {
+        switch (type)
+        {
+        case DT_REG:
+            return EntryType::Regular;
+        case DT_DIR:
+            return EntryType::Directory;
+        case DT_LNK:
+            return EntryType::Symlink;
+        case DT_UNKNOWN:
+            return EntryType::Unknown;
+        default:
+            return EntryType::Other;
+        }
+    }
+
+    static EntryType fromMode(mode_t mode)
+    {
+        if (S_ISREG(mode))
+        {
+            return EntryType::Regular;
+        }
+        if (S_ISDIR(mode))
+        {
+            return EntryType::Directory;
+        }
+        return EntryType::Other;
+    }
+
+public:
+    ~GetdentsDirectoryReader() override
+    {
+        close();
+    }
+
+    bool list(const char *path, DirListing &listing, std::error_code &ec) override
+    {
+        close();
+        dirFd = ::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0)
+        {
+            ec.assign(errno, std::generic_category());
+            return false;
+        }
+
+        while (true)
+        {
+            long bytes = ::syscall(SYS_getdents64, dirFd, buffer.get(), BUFFER_SIZE);
+            if (bytes < 0)
+            {
+                ec.assign(errno, std::generic_category());
+                return false;
+            }
+            if (bytes == 0)
+            {
+                return true;
+            }
+            for (long offset = 0; offset < bytes;)
+            {
+                const auto *dirent = reinterpret_cast<const LinuxDirent64 *>(buffer.get() + offset);
+                offset += dirent->d_reclen;
+
+                const char *name = dirent->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                {
+                    continue;
+                }
+                listing.add(name, std::strlen(name), fromDirentType(dirent->d_type), dirent->d_ino);
+            }
+        }
+    }
+
+    void stat(DirListing &listing) override
+    {
+        for (auto &entry : listing.entries)
+        {
+            if (!entry.needsStat)
+            {
+                continue;
+            }
+            struct stat st;
+            if (::fstatat(dirFd, listing.cname(entry), &st, 0) != 0)
+            {
+                entry.error = errno;
+                continue;
+            }
+            entry.type = fromMode(st.st_mode);
+            entry.size = static_cast<uint64_t>(st.st_size);
+            entry.device = st.st_dev;
+            entry.inode = st.st_ino;
+            entry.links = st.st_nlink;
+            entry.blocks = static_cast<uint64_t>(st.st_blocks);
+            entry.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+            entry.atimeNs = static_cast<int64_t>(st.st_atim.tv_sec) * 1000000000 + st.st_atim.tv_nsec;
+            entry.uid = st.st_uid;
+            entry.gid = st.st_gid;
+            entry.error = 0;
+        }
+    }
+
+    void close() override
+    {
+        if (dirFd >= 0)
+        {
+            ::close(dirFd);
+            dirFd = -1;
+        }
+    }
+};
+// Minimal io_uring submission/completion ring driven through the raw syscalls
+class IoUring
+{
+private:
+    int ringFd = -1;
+    unsigned entries = 0;
+    void *sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void *cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+    unsigned queued = 0;
+
+    void release()
+    {
+        if (sqes != MAP_FAILED)
+        {
+            ::munmap(sqes, sqesSize);
+            sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+        {
+            ::munmap(cqRing, cqRingSize);
+        }
+        cqRing = MAP_FAILED;
+        if (sqRing != MAP_FAILED)
+        {
+            ::munmap(sqRing, sqRingSize);
+            sqRing = MAP_FAILED;
+        }
+        if (ringFd >= 0)
+        {
+            ::close(ringFd);
+            ringFd = -1;
+        }
+    }
+
+public:
+    IoUring() = default;
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    ~IoUring()
+    {
+        release();
+    }
+
+    // Create the ring; returns an errno value (ENOSYS, EPERM under seccomp, ...) on failure
+    int init(unsigned depth)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &params));
+        if (ringFd < 0)
+        {
+            return errno;
+        }
+        entries = params.sq_entries;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap)
+        {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+
+        sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+        {
+            int error = errno;
+            release();
+            return error;
+        }
+        cqRing = singleMmap ? sqRing
+                            : ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(
+            ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+        if (cqRing == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            int error = errno;
+            release();
+            return error;
+        }
+
+        char *sq = static_cast<char *>(sqRing);
+        char *cq = static_cast<char *>(cqRing);
+        sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return 0;
+    }
+
+    unsigned capacity() const
+    {
+        return entries;
+    }
+
+    // Next free submission slot, or nullptr if the submission queue is full
+    io_uring_sqe *nextSqe()
+    {
+        const unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= entries)
+        {
+            return nullptr;
+        }
+        const unsigned index = tail & sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+        return sqe;
+    }
+
+    // Submit queued requests and wait until at least minComplete completions are ready
+    int submitAndWait(unsigned minComplete)
+    {
+        while (true)
+        {
+            long submitted = ::syscall(__NR_io_uring_enter, ringFd, queued, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted >= 0)
+            {
+                queued -= static_cast<unsigned>(std::min<long>(submitted, queued));
+                return 0;
+            }
+            if (errno != EINTR)
+            {
+                return errno;
+            }
+        }
+    }
+
+    // Requests placed with nextSqe() that no submitAndWait() has handed to the kernel yet
+    unsigned unsubmitted() const
+    {
+        return queued;
+    }
+
+    // Wait for at least minComplete completions without submitting anything
+    int wait(unsigned minComplete)
+    {
+        while (true)
+        {
+            if (::syscall(__NR_io_uring_enter, ringFd, 0, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0)
+            {
+                return 0;
+            }
+            if (errno != EINTR)
+            {
+                return errno;
+            }
+        }
+    }
+
+    // Hand every available completion to handler(user_data, res); returns how many were seen
+    template <typename Handler>
+    unsigned reap(Handler handler)
+    {
+        unsigned head = *cqHead;
+        const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        unsigned seen = 0;
+        for (; head != tail; head++, seen++)
+        {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            handler(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return seen;
+    }
+};
+
+// Linux backend for high-latency filesystems: lists directories like the getdents backend,
+// then sends the metadata lookups for the whole listing as batches of io_uring statx
+// requests so hundreds of round-trips are in flight at once instead of one
+class UringDirectoryReader : public GetdentsDirectoryReader
+{
+private:
+    static constexpr unsigned QUEUE_DEPTH = 256;
+    // Below this many lookups a plain fstatat loop is cheaper than a ring round-trip
+    static constexpr size_t MIN_BATCH = 4;
+
+    IoUring ring;
+    bool ringReady = false;
+    unsigned statxMask;
+    std::vector<struct statx> results;
+    std::vector<size_t> slotEntry;
+    std::vector<unsigned> freeSlots;
+    const std::atomic<unsigned> *depthLimit = nullptr; // set by an adaptive scan
+    std::vector<int64_t> submittedNs;                   // per slot, while timing lookups
+    size_t timedLookups = 0;
+    int64_t lookupNs = 0;
+
+public:
+    explicit UringDirectoryReader(unsigned mask = STATX_TYPE | STATX_SIZE | STATX_INO | STATX_NLINK | STATX_BLOCKS | STATX_MTIME | STATX_ATIME | STATX_UID | STATX_GID) : statxMask(mask)
+    {
+        int error = ring.init(QUEUE_DEPTH);
+        ringReady = error == 0;
+        if (!ringReady)
+        {
+            static std::once_flag warned;
+            std::call_once(warned, [error]
+                           { printWarning("Warning: io_uring unavailable (" + std::generic_category().message(error) +
+                                          "), falling back to fstatat"); });
+            return;
+        }
+        results.resize(ring.capacity());
+        slotEntry.resize(ring.capacity());
+    }
+
+    unsigned maxInFlight() const override
+    {
+        return ringReady ? ring.capacity() : 1;
+    }
+
+    void limitInFlight(const std::atomic<unsigned> *limit) override
+    {
+        depthLimit = limit;
+        submittedNs.assign(limit ? results.size() : 0, 0);
+    }
+
+    bool overlappedLookups(size_t &count, int64_t &latencyNs) const override
+    {
+        if (timedLookups == 0)
+        {
+            return false;
+        }
+        count = timedLookups;
+        latencyNs = lookupNs;
+        return true;
+    }
+
+    void stat(DirListing &listing) override
+    {
+        size_t wanted = 0;
+        for (const auto &entry : listing.entries)
+        {
+            wanted += entry.needsStat;
+        }
+        timedLookups = 0;
+        lookupNs = 0;
+        if (!ringReady || wanted < MIN_BATCH)
+        {
+            GetdentsDirectoryReader::stat(listing);
+            return;
+        }
+        const size_t depth = depthLimit ? std::max(1u, depthLimit->load(std::memory_order_relaxed)) : ring.capacity();
+        int64_t reapedNs = 0;
+
+        freeSlots.clear();
+        for (unsigned slot = ring.capacity(); slot > 0; slot--)
+        {
+            freeSlots.push_back(slot - 1);
+        }
+
+        size_t next = 0;
+        size_t inFlight = 0;
+        auto complete = [&](uint64_t slot, int res)
+        {
+            DirEntry &entry = listing.entries[slotEntry[slot]];
+            if (res < 0)
+            {
+                entry.error = -res;
+            }
+            else
+            {
+                const struct statx &result = results[slot];
+                entry.type = fromMode(result.stx_mode);
+                entry.size = result.stx_size;
+                entry.device = makedev(result.stx_dev_major, result.stx_dev_minor);
+                entry.inode = result.stx_ino;
+                entry.links = result.stx_nlink;
+                entry.blocks = result.stx_blocks;
+                entry.mtimeNs = static_cast<int64_t>(result.stx_mtime.tv_sec) * 1000000000 + result.stx_mtime.tv_nsec;
+                entry.atimeNs = static_cast<int64_t>(result.stx_atime.tv_sec) * 1000000000 + result.stx_atime.tv_nsec;
+                entry.uid = result.stx_uid;
+                entry.gid = result.stx_gid;
+                entry.error = 0;
+            }
+            if (depthLimit)
+            {
+                lookupNs += reapedNs - submittedNs[slot];
+                timedLookups++;
+            }
+            freeSlots.push_back(static_cast<unsigned>(slot));
+            inFlight--;
+        };
+
+        while (next < listing.entries.size() || inFlight > 0)
+        {
+            // Fill the submission queue with as many lookups as there are free slots
+            const int64_t submitNs = depthLimit ? monotonicNs() : 0;
+            for (; next < listing.entries.size() && !freeSlots.empty() && inFlight < depth; next++)
+            {
+                DirEntry &entry = listing.entries[next];
+                if (!entry.needsStat)
+                {
+                    continue;
+                }
+                io_uring_sqe *sqe = ring.nextSqe();
+                if (sqe == nullptr)
+                {
+                    break;
+                }
+                const unsigned slot = freeSlots.back();
+                freeSlots.pop_back();
+                slotEntry[slot] = next;
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = dirFd;
+                sqe->addr = reinterpret_cast<uint64_t>(listing.cname(entry));
+                sqe->len = statxMask;
+                sqe->off = reinterpret_cast<uint64_t>(&results[slot]);
+                sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+                sqe->user_data = slot;
+                if (depthLimit)
+                {
+                    submittedNs[slot] = submitNs;
+                }
+                inFlight++;
+            }
+
+            int error = ring.submitAndWait(inFlight > 0 ? 1 : 0);
+            reapedNs = depthLimit ? monotonicNs() : 0;
+            if (error != 0)
+            {
+                // Ring broke mid-batch. Lookups the kernel already has still write into
+                // results[] and read the listing's names, so every one of them is waited for
+                // before either is reused; then the rest is redone synchronously. Completions
+                // are posted even if waiting fails, once this thread enters the kernel again
+                ring.reap(complete);
+                while (inFlight > ring.unsubmitted())
+                {
+                    if (ring.wait(1) != 0)
+                    {
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    }
+                    ring.reap(complete);
+                }
+                ringReady = false;
+                timedLookups = 0;
+                lookupNs = 0;
+                GetdentsDirectoryReader::stat(listing);
+                return;
+            }
+            ring.reap(complete);
+        }
+    }
+};
+#endif
+
+// Scanning backends selectable with --backend
+enum class ScanBackend
+{
+    Std,
+    Getdents,
+    Uring
+};
+
+inline ScanBackend defaultBackend()
+{
+#ifdef __linux__
+    return ScanBackend::Getdents;
+#else
+    return ScanBackend::Std;
+#endif
+}
+
+inline const char *backendName(ScanBackend backend)
+{
+    switch (backend)
+    {
+    case ScanBackend::Getdents:
+        return "getdents";
+    case ScanBackend::Uring:
+        return "uring";
+    default:
+        return "std";
+    }
+}
+
+inline ScanBackend parseBackend(const std::string &name)
+{
+    if (name == "std")
+    {
+        return ScanBackend::Std;
+    }
+    if (name == "getdents")
+    {
+#ifdef __linux__
+        return ScanBackend::Getdents;
+#else
+        printWarning("Warning: getdents backend is only available on Linux, using std");
+        return ScanBackend::Std;
+#endif
+    }
+    if (name == "uring")
+    {
+#ifdef __linux__
+        return ScanBackend::Uring;
+#else
+        printWarning("Warning: uring backend is only available on Linux, using std");
+        return ScanBackend::Std;
+#endif
+    }
+    throw std::runtime_error("Invalid backend: " + name + " (expected std, getdents or uring)");
+}
+
+inline std::unique_ptr<DirectoryReader> makeDirectoryReader(ScanBackend backend)
+{
+#ifdef __linux__
+    if (backend == ScanBackend::Getdents)
+    {
+        return std::make_unique<GetdentsDirectoryReader>();
+    }
+    if (backend == ScanBackend::Uring)
+    {
+        return std::make_unique<UringDirectoryReader>();
+    }
+#endif
+    (void)backend;
+    return std::make_unique<StdDirectoryReader>();
+}
+
+// Append the raw bytes of a trivially copyable value to a binary buffer
+template <typename T>
+void appendBinary(std::string &out, const T &value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// Bounds-checked reader over a binary buffer
+class BinaryCursor
+{
+private:
+    const char *pos;
+    const char *end;
+
+public:
+    BinaryCursor(const char *begin, const char *finish) : pos(begin), end(finish) {}
+
+    template <typename T>
+    T read()
+    {
+        if (static_cast<size_t>(end - pos) < sizeof(T))
+        {
+            throw std::runtime_error("Corrupt index: truncated record");
+        }
+        T value;
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    std::string_view readString()
+    {
+        const uint16_t length = read<uint16_t>();
+        if (static_cast<size_t>(end - pos) < length)
+        {
+            throw std::runtime_error("Corrupt index: truncated string");
+        }
+        std::string_view value(pos, length);
+        pos += length;
+        return value;
+    }
+};
+
+// Identity and modification state of a directory; a directory whose stamp is unchanged
+// since the last run still has the same set of entries
+struct DirectoryStamp
+{
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    int64_t mtimeNs = 0;
+    int64_t ctimeNs = 0;
+
+    bool operator==(const DirectoryStamp &other) const
+    {
+        return device == other.device && inode == other.inode &&
+               mtimeNs == other.mtimeNs && ctimeNs == other.ctimeNs;
+    }
+};
+
+#ifdef __linux__
+inline bool readDirectoryStamp(const char *path, DirectoryStamp &stamp)
+{
+    struct stat st;
+    if (::stat(path, &st) != 0)
+    {
+        return false;
+    }
+    stamp.device = st.st_dev;
+    stamp.inode = st.st_ino;
+    stamp.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    stamp.ctimeNs = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+    return true;
+}
+#else
+inline bool readDirectoryStamp(const char *, DirectoryStamp &)
+{
+    return false;
+}
+#endif
+
+// A mounted filesystem, as listed in /proc/self/mountinfo
+struct MountInfo
+{
+    std::string mountPoint;
+    std::string type;
+    uint64_t device = 0;
+};
+
+// Results and scan concurrency of one mount reached by a scan
+struct MountUsage
+{
+    std::string mountPoint;
+    std::string type;
+    size_t jobs = 1; // workers allowed on it at once
+    uint64_t files = 0;
+    uint64_t size = 0;
+};
+
+#ifdef __linux__
+// Undo the octal escapes (\040 for a space) of mountinfo paths
+inline std::string unescapeMountPath(const std::string &field)
+{
+    std::string path;
+    for (size_t i = 0; i < field.size(); i++)
+    {
+        if (field[i] == '\\' && i + 3 < field.size())
+        {
+            path.push_back(static_cast<char>(std::stoi(field.substr(i + 1, 3), nullptr, 8)));
+            i += 3;
+            continue;
+        }
+        path.push_back(field[i]);
+    }
+    return path;
+}
+
+// Mounted filesystems in mount order; empty if /proc is not available. Every scan reads
+// the table, so it is read in one go and split in place rather than through a stream
+inline std::vector<MountInfo> readMounts()
+{
+    std::vector<MountInfo> mounts;
+    const int fd = ::open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return mounts;
+    }
+    std::string text;
+    char chunk[16384];
+    ssize_t got;
+    while ((got = ::read(fd, chunk, sizeof(chunk))) > 0)
+    {
+        text.append(chunk, static_cast<size_t>(got));
+    }
+    ::close(fd);
+
+    std::vector<std::string_view> fields;
+    std::string_view rest = text;
+    while (!rest.empty())
+    {
+        const size_t end = std::min(rest.find('\n'), rest.size());
+        std::string_view line = rest.substr(0, end);
+        rest.remove_prefix(std::min(end + 1, rest.size()));
+
+        // id parent major:minor root mount-point options [optional...] - type source super-options
+        fields.clear();
+        while (!line.empty())
+        {
+            const size_t space = std::min(line.find(' '), line.size());
+            if (space > 0)
+            {
+                fields.push_back(line.substr(0, space));
+            }
+            line.remove_prefix(std::min(space + 1, line.size()));
+        }
+        const auto dash = std::find(fields.begin() + std::min<size_t>(fields.size(), 5), fields.end(), "-");
+        const std::string_view device = fields.size() > 2 ? fields[2] : std::string_view();
+        const size_t colon = device.find(':');
+        unsigned deviceMajor = 0;
+        unsigned deviceMinor = 0;
+        if (fields.size() < 5 || colon == std::string_view::npos ||
+            std::from_chars(device.data(), device.data() + colon, deviceMajor).ec != std::errc() ||
+            std::from_chars(device.data() + colon + 1, device.data() + device.size(), deviceMinor).ec != std::errc())
+        {
+            continue;
+        }
+        MountInfo mount;
+        if (dash != fields.end() && dash + 1 != fields.end())
+        {
+            mount.type = std::string(dash[1]);
+        }
+        mount.device = makedev(deviceMajor, deviceMinor);
+        mount.mountPoint = unescapeMountPath(std::string(fields[4]));
+        mounts.push_back(std::move(mount));
+    }
+    return mounts;
+}
+
+// Whether a block device is a spinning disk, per /sys/dev/block (partitions check their disk)
+inline bool isRotational(uint64_t device)
+{
+    const std::string base = "/sys/dev/block/" + std::to_string(major(device)) + ":" + std::to_string(minor(device));
+    for (const char *queue : {"/queue/rotational", "/../queue/rotational"})
+    {
+        std::ifstream file(base + queue);
+        int rotational = 0;
+        if (file >> rotational)
+        {
+            return rotational != 0;
+        }
+    }
+    return false;
+}
+#endif
+
+// Default workers per mount: one for kernel pseudo filesystems, three quarters of the pool
+// for network filesystems (so a slow server cannot hold every worker), two for spinning
+// disks (more only adds seeks) and the whole pool for SSDs, NVMe and memory filesystems
+inline size_t defaultMountJobs(const MountInfo &mount, size_t jobs)
+{
+    static const std::set<std::string, std::less<>> pseudo = {
+        "proc", "sysfs", "devtmpfs", "devpts", "cgroup", "cgroup2", "debugfs", "tracefs",
+        "securityfs", "pstore", "bpf", "configfs", "fusectl", "mqueue", "hugetlbfs", "binfmt_misc"};
+    static const std::set<std::string, std::less<>> network = {
+        "nfs", "nfs4", "cifs", "smb3", "smbfs", "ceph", "fuse.sshfs", "9p", "afs", "glusterfs",
+        "fuse.glusterfs", "lustre", "fuse.s3fs", "fuse.rclone"};
+    if (pseudo.count(mount.type))
+    {
+        return 1;
+    }
+    if (network.count(mount.type))
+    {
+        return std::max<size_t>(1, jobs * 3 / 4);
+    }
+#ifdef __linux__
+    if (major(mount.device) != 0 && isRotational(mount.device))
+    {
+        return std::min<size_t>(jobs, 2);
+    }
+#endif
+    return jobs;
+}
+
+// Byte buffer that can move its contents to an anonymous temporary file when memory runs
+// short; writeTo() emits the spilled bytes followed by those still in memory
+class SpillBuffer
+{
+private:
+    std::string data;
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> file{nullptr, std::fclose};
+
+public:
+    // Smallest buffer worth a write to disk
+    static constexpr size_t MIN_SPILL = 1 << 20;
+
+    std::string &buffer()
+    {
+        return data;
+    }
+
+    void spill()
+    {
+        if (data.empty())
+        {
+            return;
+        }
+        if (!file)
+        {
+            file.reset(std::tmpfile());
+            if (!file)
+            {
+                throw std::runtime_error("Cannot create a temporary file to spill to");
+            }
+        }
+        if (std::fwrite(data.data(), 1, data.size(), file.get()) != data.size())
+        {
+            throw std::runtime_error("Cannot spill to a temporary file: " + std::generic_category().message(errno));
+        }
+        data = std::string();
+    }
+
+    void writeTo(std::ostream &out) const
+    {
+        if (file)
+        {
+            std::fflush(file.get());
+            std::rewind(file.get());
+            char chunk[1 << 16];
+            size_t got;
+            while ((got = std::fread(chunk, 1, sizeof(chunk), file.get())) > 0)
+            {
+                out.write(chunk, static_cast<std::streamsize>(got));
+            }
+            std::fseek(file.get(), 0, SEEK_END);
+        }
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+};
+
+// Persistent snapshot of per-directory results used for incremental rescans. Each record
+// holds a directory's stamp, the aggregates of the files directly inside it and the names
+// of its subdirectories, so an unchanged directory is replayed without being read and only
+// its subdirectories need a stat to be validated in turn.
+class ScanIndex
+{
+private:
+    static constexpr char MAGIC[8] = {'D', 'A', 'I', 'N', 'D', 'E', 'X', '3'};
+
+    std::string data;
+    std::unordered_map<uint64_t, std::pair<size_t, size_t>> records; // path hash -> (offset, length)
+
+public:
+    // Directory data recovered from a record
+    struct CachedDirectory
+    {
+        ScanTotals own;
+        std::vector<std::string> subdirs;
+    };
+
+    // Load a previous index; returns false (leaving the index empty) if the file is missing,
+    // corrupt or was written with different scan options
+    bool load(const std::string &filename, uint64_t configHash)
+    {
+        data.clear();
+        records.clear();
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        try
+        {
+            BinaryCursor header(data.data(), data.data() + data.size());
+            char magic[sizeof(MAGIC)];
+            for (char &ch : magic)
+            {
+                ch = header.read<char>();
+            }
+            if (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || header.read<uint64_t>() != configHash)
+            {
+                data.clear();
+                return false;
+            }
+            const uint64_t count = header.read<uint64_t>();
+
+            size_t offset = sizeof(MAGIC) + 2 * sizeof(uint64_t);
+            for (uint64_t i = 0; i < count; i++)
+            {
+                BinaryCursor cursor(data.data() + offset, data.data() + data.size());
+                const uint32_t length = cursor.read<uint32_t>();
+                if (length < sizeof(uint32_t) + sizeof(uint64_t) || length > data.size() - offset)
+                {
+                    throw std::runtime_error("Corrupt index: bad record length");
+                }
+                records[cursor.read<uint64_t>()] = {offset, length};
+                offset += length;
+            }
+        }
+        catch (const std::runtime_error &)
+        {
+            data.clear();
+            records.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // Find the record for a directory and check it against the directory's current stamp
+    bool lookup(uint64_t pathHash, const DirectoryStamp &stamp, CachedDirectory &out, std::string_view &raw) const
+    {
+        auto it = records.find(pathHash);
+        if (it == records.end())
+        {
+            return false;
+        }
+        const auto [offset, length] = it->second;
+        BinaryCursor cursor(data.data() + offset, data.data() + offset + length);
+        cursor.read<uint32_t>();
+        cursor.read<uint64_t>();
+
+        DirectoryStamp stored;
+        stored.device = cursor.read<uint64_t>();
+        stored.inode = cursor.read<uint64_t>();
+        stored.mtimeNs = cursor.read<int64_t>();
+        stored.ctimeNs = cursor.read<int64_t>();
+        if (!(stored == stamp))
+        {
+            return false;
+        }
+
+        out.own = ScanTotals();
+        out.own.totalFiles = cursor.read<uint64_t>();
+        out.own.totalSize = cursor.read<uint64_t>();
+        out.own.hiddenFiles = cursor.read<uint64_t>();
+        out.own.hiddenSize = cursor.read<uint64_t>();
+        const uint32_t typeCount = cursor.read<uint32_t>();
+        const uint32_t subdirCount = cursor.read<uint32_t>();
+        for (uint32_t i = 0; i < typeCount; i++)
+        {
+            FileTypeStats &stat = out.own.statsFor(cursor.readString());
+            stat.count = cursor.read<uint64_t>();
+            stat.totalSize = cursor.read<uint64_t>();
+            stat.minSize = cursor.read<uint64_t>();
+            stat.maxSize = cursor.read<uint64_t>();
+            const uint16_t buckets = cursor.read<uint16_t>();
+            if (buckets != 0)
+            {
+                stat.sketch.enable();
+            }
+            for (uint16_t b = 0; b < buckets; b++)
+            {
+                const uint16_t bucket = cursor.read<uint16_t>();
+                if (bucket >= SizeSketch::BUCKETS)
+                {
+                    throw std::runtime_error("Corrupt index: bad size bucket");
+                }
+                stat.sketch.counts[bucket] = cursor.read<uint64_t>();
+            }
+        }
+        out.subdirs.clear();
+        for (uint32_t i = 0; i < subdirCount; i++)
+        {
+            out.subdirs.emplace_back(cursor.readString());
+        }
+        raw = std::string_view(data.data() + offset, length);
+        return true;
+    }
+
+    // Serialize one directory record onto a worker's output buffer
+    static void appendRecord(std::string &out, uint64_t pathHash, const DirectoryStamp &stamp, const ScanTotals &own,
+                             const std::vector<std::string> &subdirs)
+    {
+        const size_t start = out.size();
+        appendBinary(out, uint32_t(0));
+        appendBinary(out, pathHash);
+        appendBinary(out, stamp.device);
+        appendBinary(out, stamp.inode);
+        appendBinary(out, stamp.mtimeNs);
+        appendBinary(out, stamp.ctimeNs);
+        appendBinary(out, uint64_t(own.totalFiles));
+        appendBinary(out, uint64_t(own.totalSize));
+        appendBinary(out, uint64_t(own.hiddenFiles));
+        appendBinary(out, uint64_t(own.hiddenSize));
+        appendBinary(out, uint32_t(own.stats.size()));
+        appendBinary(out, uint32_t(subdirs.size()));
+
+        auto appendString = [&out](std::string_view value)
+        {
+            appendBinary(out, uint16_t(value.size()));
+            out.append(value.data(), value.size());
+        };
+        own.forEachType([&](const std::string &fileType, const FileTypeStats &stat)
+                        {
+                            appendString(fileType);
+                            appendBinary(out, uint64_t(stat.count));
+                            appendBinary(out, uint64_t(stat.totalSize));
+                            appendBinary(out, uint64_t(stat.minSize));
+                            appendBinary(out, uint64_t(stat.maxSize));
+                            // Size sketches are stored sparsely as (bucket, count) pairs
+                            const auto &counts = stat.sketch.counts;
+                            appendBinary(out, uint16_t(counts.size() - std::count(counts.begin(), counts.end(), 0)));
+                            for (size_t bucket = 0; bucket < counts.size(); bucket++)
+                            {
+                                if (counts[bucket] != 0)
+                                {
+                                    appendBinary(out, uint16_t(bucket));
+                                    appendBinary(out, uint64_t(counts[bucket]));
+                                }
+                            } });
+        for (const auto &name : subdirs)
+        {
+            appendString(name);
+        }
+
+        const uint32_t length = static_cast<uint32_t>(out.size() - start);
+        std::memcpy(&out[start], &length, sizeof(length));
+    }
+
+    // Write the records collected by all workers; goes through a temporary file so an
+    // interrupted run never leaves a truncated index behind
+    static void write(const std::string &filename, uint64_t configHash,
+                      const std::vector<SpillBuffer> &buffers, const std::vector<size_t> &counts)
+    {
+        const std::string tempName = filename + ".tmp";
+        {
+            std::ofstream file(tempName, std::ios::binary | std::ios::trunc);
+            if (!file)
+            {
+                throw std::runtime_error("Cannot create index file: " + tempName);
+            }
+            uint64_t total = 0;
+            for (size_t count : counts)
+            {
+                total += count;
+            }
+            file.write(MAGIC, sizeof(MAGIC));
+            file.write(reinterpret_cast<const char *>(&configHash), sizeof(configHash));
+            file.write(reinterpret_cast<const char *>(&total), sizeof(total));
+            for (const auto &buffer : buffers)
+            {
+                buffer.writeTo(file);
+            }
+            if (!file)
+            {
+                throw std::runtime_error("Cannot write index file: " + tempName);
+            }
+        }
+        std::error_code ec;
+        fs::rename(tempName, filename, ec);
+        if (ec)
+        {
+            throw std::runtime_error("Cannot replace index file " + filename + ": " + ec.message());
+        }
+    }
+};
+
+// Versioned binary snapshot of a scan (--save/--load). The file is a header followed by flat,
+// 8-byte aligned arrays that readers use in place through mmap without any parsing:
+//   SnapshotHeader | SnapshotType[typeCount] | SnapshotDirectory[dirCount] | string pool
+// Directory records are sorted by path hash so two snapshots can be joined in one pass.
+constexpr char SNAPSHOT_MAGIC[8] = {'D', 'A', 'S', 'N', 'A', 'P', '\0', '\0'};
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+constexpr uint32_t SNAPSHOT_NO_PARENT = std::numeric_limits<uint32_t>::max();
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags; // bit 0: hidden files were included
+    uint64_t totalFiles;
+    uint64_t totalSize;
+    uint64_t hiddenFiles;
+    uint64_t hiddenSize;
+    uint64_t rootOffset;
+    uint64_t rootLength;
+    uint64_t typeCount;
+    uint64_t typeOffset;
+    uint64_t dirCount;
+    uint64_t dirOffset;
+    uint64_t poolSize;
+    uint64_t poolOffset;
+};
+
+struct SnapshotType
+{
+    uint64_t nameOffset;
+    uint64_t nameLength;
+    uint64_t count;
+    uint64_t totalSize;
+    uint64_t minSize; // greater than maxSize if no individual size was recorded
+    uint64_t maxSize;
+};
+
+struct SnapshotDirectory
+{
+    uint64_t pathHash;
+    uint64_t pathOffset;
+    uint32_t pathLength;
+    uint32_t parent; // index into the directory array, SNAPSHOT_NO_PARENT for the root
+    uint64_t files;  // files counted directly in this directory (hidden included)
+    uint64_t size;
+    uint64_t subtreeFiles;
+    uint64_t subtreeSize;
+};
+
+static_assert(sizeof(SnapshotHeader) % 8 == 0 && sizeof(SnapshotType) % 8 == 0 && sizeof(SnapshotDirectory) % 8 == 0,
+              "snapshot records must keep 8-byte alignment");
+
+// Per-directory totals collected during a scan for the snapshot
+struct DirectoryRecord
+{
+    std::string path;
+    uint64_t files = 0;
+    uint64_t size = 0;
+};
+
+// Read-only view of a snapshot file, memory-mapped where the platform allows it
+class MappedSnapshot
+{
+private:
+    const char *base = nullptr;
+    size_t length = 0;
+    std::vector<char> fallback;
+#ifdef __linux__
+    void *mapping = MAP_FAILED;
+#endif
+
+    template <typename T>
+    const T *array(uint64_t offset, uint64_t count) const
+    {
+        if (offset % alignof(T) != 0 || offset > length || count > (length - offset) / sizeof(T))
+        {
+            throw std::runtime_error("Corrupt snapshot: array out of bounds");
+        }
+        return reinterpret_cast<const T *>(base + offset);
+    }
+
+public:
+    explicit MappedSnapshot(const std::string &filename)
+    {
+#ifdef __linux__
+        int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot open snapshot: " + filename);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            length = static_cast<size_t>(st.st_size);
+            mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map snapshot: " + filename);
+        }
+        base = static_cast<const char *>(mapping);
+#else
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot open snapshot: " + filename);
+        }
+        fallback.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        base = fallback.data();
+        length = fallback.size();
+#endif
+        if (length < sizeof(SnapshotHeader) || std::memcmp(header().magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+        {
+            throw std::runtime_error("Not a snapshot file: " + filename);
+        }
+        if (header().version != SNAPSHOT_VERSION)
+        {
+            throw std::runtime_error("Unsupported snapshot version " + std::to_string(header().version) + ": " + filename);
+        }
+        // Validate every array once so accessors can index without checks
+        types();
+        directories();
+        array<char>(header().poolOffset, header().poolSize);
+        string(header().rootOffset, header().rootLength);
+    }
+
+    MappedSnapshot(const MappedSnapshot &) = delete;
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+    ~MappedSnapshot()
+    {
+#ifdef __linux__
+        if (mapping != MAP_FAILED)
+        {
+            ::munmap(mapping, length);
+        }
+#endif
+    }
+
+    const SnapshotHeader &header() const
+    {
+        return *reinterpret_cast<const SnapshotHeader *>(base);
+    }
+
+    const SnapshotType *types() const
+    {
+        return array<SnapshotType>(header().typeOffset, header().typeCount);
+    }
+
+    const SnapshotDirectory *directories() const
+    {
+        return array<SnapshotDirectory>(header().dirOffset, header().dirCount);
+    }
+
+    std::string_view string(uint64_t offset, uint64_t size) const
+    {
+        if (offset > header().poolSize || size > header().poolSize - offset)
+        {
+            throw std::runtime_error("Corrupt snapshot: string out of bounds");
+        }
+        return std::string_view(base + header().poolOffset + offset, size);
+    }
+
+    std::string_view root() const
+    {
+        return string(header().rootOffset, header().rootLength);
+    }
+};
+
+// Write a snapshot of the given totals and directory records
+inline void writeSnapshot(const std::string &filename, const std::string &root, const ScanTotals &totals, bool showHidden,
+                   std::vector<DirectoryRecord> dirs)
+{
+    std::string pool;
+    auto intern = [&pool](std::string_view value)
+    {
+        const uint64_t offset = pool.size();
+        pool.append(value.data(), value.size());
+        return offset;
+    };
+
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.flags = showHidden ? 1 : 0;
+    header.totalFiles = totals.totalFiles;
+    header.totalSize = totals.totalSize;
+    header.hiddenFiles = totals.hiddenFiles;
+    header.hiddenSize = totals.hiddenSize;
+    header.rootOffset = intern(root);
+    header.rootLength = root.size();
+
+    std::vector<SnapshotType> types;
+    totals.forEachType([&](const std::string &fileType, const FileTypeStats &stat)
+                       { types.push_back({intern(fileType), fileType.size(), stat.count, stat.totalSize, stat.minSize, stat.maxSize}); });
+
+    // Order directories by path hash, then link each one to its parent and roll the
+    // per-directory totals up the tree, deepest directories first
+    std::vector<uint64_t> hashes(dirs.size());
+    std::vector<size_t> order(dirs.size());
+    for (size_t i = 0; i < dirs.size(); i++)
+    {
+        hashes[i] = hashBytes(dirs[i].path);
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+              { return hashes[a] != hashes[b] ? hashes[a] < hashes[b] : dirs[a].path < dirs[b].path; });
+
+    std::vector<SnapshotDirectory> records(dirs.size());
+    std::unordered_map<std::string_view, uint32_t> indexByPath;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const DirectoryRecord &dir = dirs[order[i]];
+        SnapshotDirectory &record = records[i];
+        record.pathHash = hashes[order[i]];
+        record.pathOffset = intern(dir.path);
+        record.pathLength = static_cast<uint32_t>(dir.path.size());
+        record.parent = SNAPSHOT_NO_PARENT;
+        record.files = record.subtreeFiles = dir.files;
+        record.size = record.subtreeSize = dir.size;
+        indexByPath.emplace(dir.path, static_cast<uint32_t>(i));
+    }
+
+    std::vector<std::pair<size_t, uint32_t>> byDepth;
+    for (uint32_t i = 0; i < records.size(); i++)
+    {
+        std::string_view path = dirs[order[i]].path;
+        byDepth.emplace_back(std::count(path.begin(), path.end(), '/'), i);
+        if (path == root)
+        {
+            continue;
+        }
+        const size_t slash = path.find_last_of('/');
+        if (slash == std::string_view::npos)
+        {
+            continue;
+        }
+        std::string_view parentPath = path.substr(0, slash == 0 ? 1 : slash);
+        auto it = indexByPath.find(parentPath);
+        if (it == indexByPath.end())
+        {
+            it = indexByPath.find(path.substr(0, slash + 1)); // root given with a trailing slash
+        }
+        if (it != indexByPath.end() && it->second != i)
+        {
+            records[i].parent = it->second;
+        }
+    }
+    std::sort(byDepth.begin(), byDepth.end(), std::greater<>());
+    for (const auto &[depth, i] : byDepth)
+    {
+        (void)depth;
+        if (records[i].parent != SNAPSHOT_NO_PARENT)
+        {
+            records[records[i].parent].subtreeFiles += records[i].subtreeFiles;
+            records[records[i].parent].subtreeSize += records[i].subtreeSize;
+        }
+    }
+
+    header.typeCount = types.size();
+    header.typeOffset = sizeof(SnapshotHeader);
+    header.dirCount = records.size();
+    header.dirOffset = header.typeOffset + types.size() * sizeof(SnapshotType);
+    header.poolSize = pool.size();
+    header.poolOffset = header.dirOffset + records.size() * sizeof(SnapshotDirectory);
+
+    const std::string tempName = filename + ".tmp";
+    {
+        std::ofstream file(tempName, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot create snapshot file: " + tempName);
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(types.data()), static_cast<std::streamsize>(types.size() * sizeof(SnapshotType)));
+        file.write(reinterpret_cast<const char *>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(SnapshotDirectory)));
+        file.write(pool.data(), static_cast<std::streamsize>(pool.size()));
+        if (!file)
+        {
+            throw std::runtime_error("Cannot write snapshot file: " + tempName);
+        }
+    }
+    std::error_code ec;
+    fs::rename(tempName, filename, ec);
+    if (ec)
+    {
+        throw std::runtime_error("Cannot replace snapshot file " + filename + ": " + ec.message());
+    }
+}
+
+// What changed between two snapshots: the totals, every type whose count or size moved, and
+// the directories whose subtree grew or shrank the most
+struct SnapshotDiff
+{
+    struct TypeChange
+    {
+        std::string type;
+        uint64_t oldCount = 0;
+        uint64_t newCount = 0;
+        uint64_t oldSize = 0;
+        uint64_t newSize = 0;
+    };
+
+    struct DirectoryChange
+    {
+        std::string path;
+        uint64_t oldSize = 0; // subtree sizes
+        uint64_t newSize = 0;
+        bool added = false;
+        bool removed = false;
+
+        uint64_t change() const
+        {
+            return newSize > oldSize ? newSize - oldSize : oldSize - newSize;
+        }
+    };
+
+    std::string oldRoot;
+    std::string newRoot;
+    uint64_t oldFiles = 0;
+    uint64_t newFiles = 0;
+    uint64_t oldSize = 0;
+    uint64_t newSize = 0;
+    std::vector<TypeChange> types;        // largest size change first
+    std::vector<DirectoryChange> grew;   // largest growth first
+    std::vector<DirectoryChange> shrank; // largest shrinkage first
+    uint64_t directoriesAdded = 0;
+    uint64_t directoriesRemoved = 0;
+    uint64_t directoriesChanged = 0; // in both snapshots with a different subtree
+    uint64_t directoriesCompared = 0; // in both snapshots
+    uint64_t addedSize = 0;           // bytes directly in the added directories
+    uint64_t removedSize = 0;
+};
+
+// Compare two snapshots with a merge join over their directory records, which writeSnapshot()
+// stores sorted by (path hash, path): one sequential pass over both memory-mapped arrays, so
+// the time is linear and the memory is the two top lists of limit entries, however many
+// directories the snapshots hold
+inline SnapshotDiff diffSnapshots(const std::string &oldFile, const std::string &newFile, size_t limit)
+{
+    const MappedSnapshot before(oldFile);
+    const MappedSnapshot after(newFile);
+    SnapshotDiff diff;
+    diff.oldRoot = std::string(before.root());
+    diff.newRoot = std::string(after.root());
+    diff.oldFiles = before.header().totalFiles;
+    diff.newFiles = after.header().totalFiles;
+    diff.oldSize = before.header().totalSize;
+    diff.newSize = after.header().totalSize;
+
+    // Types: a few thousand at most, joined by name
+    std::unordered_map<std::string_view, SnapshotDiff::TypeChange> types;
+    for (uint64_t i = 0; i < before.header().typeCount; i++)
+    {
+        const SnapshotType &type = before.types()[i];
+        SnapshotDiff::TypeChange &change = types[before.string(type.nameOffset, type.nameLength)];
+        change.oldCount = type.count;
+        change.oldSize = type.totalSize;
+    }
+    for (uint64_t i = 0; i < after.header().typeCount; i++)
+    {
+        const SnapshotType &type = after.types()[i];
+        SnapshotDiff::TypeChange &change = types[after.string(type.nameOffset, type.nameLength)];
+        change.newCount = type.count;
+        change.newSize = type.totalSize;
+    }
+    for (auto &[name, change] : types)
+    {
+        if (change.oldCount != change.newCount || change.oldSize != change.newSize)
+        {
+            change.type = std::string(name);
+            diff.types.push_back(std::move(change));
+        }
+    }
+    const auto sizeChange = [](const SnapshotDiff::TypeChange &change)
+    {
+        return change.newSize > change.oldSize ? change.newSize - change.oldSize : change.oldSize - change.newSize;
+    };
+    std::sort(diff.types.begin(), diff.types.end(), [&](const auto &a, const auto &b)
+              { return sizeChange(a) != sizeChange(b) ? sizeChange(a) > sizeChange(b) : a.type < b.type; });
+
+    // Bounded heaps ordered worst-first, as in TopList
+    const auto ranksBefore = [](const SnapshotDiff::DirectoryChange &a, const SnapshotDiff::DirectoryChange &b)
+    {
+        return a.change() != b.change() ? a.change() > b.change() : a.path < b.path;
+    };
+    const auto offer = [&](std::vector<SnapshotDiff::DirectoryChange> &heap, std::string_view path, uint64_t oldSize,
+                           uint64_t newSize, bool added, bool removed)
+    {
+        SnapshotDiff::DirectoryChange candidate{std::string(), oldSize, newSize, added, removed};
+        if (limit == 0 || oldSize == newSize || (heap.size() == limit && candidate.change() < heap.front().change()))
+        {
+            return;
+        }
+        candidate.path = std::string(path);
+        if (heap.size() < limit)
+        {
+            heap.push_back(std::move(candidate));
+            std::push_heap(heap.begin(), heap.end(), ranksBefore);
+        }
+        else if (ranksBefore(candidate, heap.front()))
+        {
+            std::pop_heap(heap.begin(), heap.end(), ranksBefore);
+            heap.back() = std::move(candidate);
+            std::push_heap(heap.begin(), heap.end(), ranksBefore);
+        }
+    };
+    const auto changed = [&](std::string_view path, uint64_t oldSize, uint64_t newSize, bool added, bool removed)
+    {
+        offer(newSize > oldSize ? diff.grew : diff.shrank, path, oldSize, newSize, added, removed);
+    };
+
+    const SnapshotDirectory *oldDirs = before.directories();
+    const SnapshotDirectory *newDirs = after.directories();
+    const uint64_t oldCount = before.header().dirCount;
+    const uint64_t newCount = after.header().dirCount;
+    const auto path = [](const MappedSnapshot &snapshot, const SnapshotDirectory &dir)
+    {
+        return snapshot.string(dir.pathOffset, dir.pathLength);
+    };
+    // <0, 0 or >0 as a sorts before, with or after b
+    const auto compare = [&](const SnapshotDirectory &a, const SnapshotDirectory &b)
+    {
+        if (a.pathHash != b.pathHash)
+        {
+            return a.pathHash < b.pathHash ? -1 : 1;
+        }
+        return path(before, a).compare(path(after, b));
+    };
+    const auto checkOrder = [](const MappedSnapshot &snapshot, const SnapshotDirectory *dirs, uint64_t i, const std::string &file)
+    {
+        if (i > 0 && (dirs[i - 1].pathHash > dirs[i].pathHash ||
+                      (dirs[i - 1].pathHash == dirs[i].pathHash &&
+                       snapshot.string(dirs[i - 1].pathOffset, dirs[i - 1].pathLength) >= snapshot.string(dirs[i].pathOffset, dirs[i].pathLength))))
+        {
+            throw std::runtime_error("Corrupt snapshot: directories are not sorted by path hash: " + file);
+        }
+    };
+    uint64_t i = 0;
+    uint64_t j = 0;
+    while (i < oldCount || j < newCount)
+    {
+        const int order = i == oldCount ? 1 : j == newCount ? -1
+                                                            : compare(oldDirs[i], newDirs[j]);
+        if (order < 0)
+        {
+            checkOrder(before, oldDirs, i, oldFile);
+            const SnapshotDirectory &dir = oldDirs[i++];
+            diff.directoriesRemoved++;
+            diff.removedSize += dir.size;
+            changed(path(before, dir), dir.subtreeSize, 0, false, true);
+        }
+        else if (order > 0)
+        {
+            checkOrder(after, newDirs, j, newFile);
+            const SnapshotDirectory &dir = newDirs[j++];
+            diff.directoriesAdded++;
+            diff.addedSize += dir.size;
+            changed(path(after, dir), 0, dir.subtreeSize, true, false);
+        }
+        else
+        {
+            checkOrder(before, oldDirs, i, oldFile);
+            checkOrder(after, newDirs, j, newFile);
+            const SnapshotDirectory &oldDir = oldDirs[i++];
+            const SnapshotDirectory &newDir = newDirs[j++];
+            diff.directoriesCompared++;
+            if (oldDir.subtreeSize != newDir.subtreeSize || oldDir.subtreeFiles != newDir.subtreeFiles)
+            {
+                diff.directoriesChanged++;
+                changed(path(after, newDir), oldDir.subtreeSize, newDir.subtreeSize, false, false);
+            }
+        }
+    }
+    for (auto *heap : {&diff.grew, &diff.shrank})
+    {
+        std::sort_heap(heap->begin(), heap->end(), ranksBefore);
+    }
+    return diff;
+}
+
+// Shell-style glob match supporting '*', '?' and '[...]' character classes ('!' or '^'
+// negates a class); '*' also matches '/', like find -path
+inline bool globMatch(std::string_view pattern, std::string_view text)
+{
+    size_t p = 0;
+    size_t t = 0;
+    size_t starPattern = std::string_view::npos;
+    size_t starText = 0;
+
+    while (t < text.size())
+    {
+        if (p < pattern.size() && pattern[p] == '*')
+        {
+            starPattern = p++;
+            starText = t;
+            continue;
+        }
+        if (p < pattern.size() && pattern[p] == '[')
+        {
+            size_t q = p + 1;
+            const bool negate = q < pattern.size() && (pattern[q] == '!' || pattern[q] == '^');
+            q += negate;
+            bool matched = false;
+            bool closed = false;
+            for (bool first = true; q < pattern.size(); first = false)
+            {
+                if (pattern[q] == ']' && !first)
+                {
+                    closed = true;
+                    break;
+                }
+                if (q + 2 < pattern.size() && pattern[q + 1] == '-' && pattern[q + 2] != ']')
+                {
+                    matched |= text[t] >= pattern[q] && text[t] <= pattern[q + 2];
+                    q += 3;
+                }
+                else
+                {
+                    matched |= text[t] == pattern[q];
+                    q++;
+                }
+            }
+            if (closed && matched != negate)
+            {
+                p = q + 1;
+                t++;
+                continue;
+            }
+            if (!closed && text[t] == '[')
+            {
+                p++;
+                t++;
+                continue;
+            }
+        }
+        else if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t]))
+        {
+            p++;
+            t++;
+            continue;
+        }
+        if (starPattern == std::string_view::npos)
+        {
+            return false;
+        }
+        p = starPattern + 1;
+        t = ++starText;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+    {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+// Directory exclusion rules (-e) resolved once before a scan. Existing paths become
+// (device, inode) pairs so any spelling or symlinked route to them matches; specs with glob
+// characters match directory names (or full paths if they contain '/'); specs that do not
+// exist fall back to literal path comparison. Only directories are checked, when the scan is
+// about to descend into them, so excluded subtrees are pruned and files need no check.
+class ExclusionMatcher
+{
+private:
+    std::vector<std::string> specs;
+    std::vector<std::pair<uint64_t, uint64_t>> identities; // sorted (device, inode)
+    std::vector<std::string> canonicalPaths;
+    std::vector<std::string> literalPaths;
+    std::vector<std::string> namePatterns;
+    std::vector<std::string> pathPatterns;
+
+    static std::string trimSeparators(std::string path)
+    {
+        while (path.size() > 1 && path.back() == '/')
+        {
+            path.pop_back();
+        }
+        return path;
+    }
+
+    static bool isWithin(std::string_view path, std::string_view dir)
+    {
+        return path.size() >= dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+               (path.size() == dir.size() || path[dir.size()] == '/' || dir == "/");
+    }
+
+public:
+    void add(const std::string &spec)
+    {
+        specs.push_back(spec);
+    }
+
+    bool empty() const
+    {
+        return specs.empty();
+    }
+
+    const std::vector<std::string> &rules() const
+    {
+        return specs;
+    }
+
+    // Resolve every rule; called once before scanning
+    void compile()
+    {
+        identities.clear();
+        canonicalPaths.clear();
+        literalPaths.clear();
+        namePatterns.clear();
+        pathPatterns.clear();
+        for (const auto &spec : specs)
+        {
+            if (spec.find_first_of("*?[") != std::string::npos)
+            {
+                (spec.find('/') == std::string::npos ? namePatterns : pathPatterns).push_back(trimSeparators(spec));
+                continue;
+            }
+
+            std::error_code ec;
+            const fs::path canonical = fs::canonical(spec, ec);
+#ifdef __linux__
+            struct stat st;
+            if (!ec && ::stat(canonical.c_str(), &st) == 0)
+            {
+                identities.emplace_back(st.st_dev, st.st_ino);
+                canonicalPaths.push_back(canonical.string());
+                continue;
+            }
+#else
+            if (!ec)
+            {
+                canonicalPaths.push_back(canonical.string());
+                continue;
+            }
+#endif
+            literalPaths.push_back(trimSeparators(spec));
+        }
+        std::sort(identities.begin(), identities.end());
+    }
+
+    // Whether directory entries need their (device, inode) resolved before matching
+    bool needsIdentity() const
+    {
+        return !identities.empty();
+    }
+
+    // The scan root is excluded if it is, or lies inside, an excluded directory
+    bool excludesRoot(const std::string &root) const
+    {
+        std::error_code ec;
+        const std::string canonical = fs::weakly_canonical(root, ec).string();
+        for (const auto &dir : canonicalPaths)
+        {
+            if (!ec && isWithin(canonical, dir))
+            {
+                return true;
+            }
+        }
+        const std::string trimmed = trimSeparators(root);
+        for (const auto &dir : literalPaths)
+        {
+            if (isWithin(trimmed, dir))
+            {
+                return true;
+            }
+        }
+        for (const auto &pattern : pathPatterns)
+        {
+            if (globMatch(pattern, trimmed))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Check a subdirectory about to be descended into; buildPath produces its full path
+    // and is only called for rules that need it
+    template <typename PathBuilder>
+    bool excludes(std::string_view name, uint64_t device, uint64_t inode, PathBuilder buildPath) const
+    {
+        for (const auto &pattern : namePatterns)
+        {
+            if (globMatch(pattern, name))
+            {
+                return true;
+            }
+        }
+        if (!identities.empty() && std::binary_search(identities.begin(), identities.end(), std::make_pair(device, inode)))
+        {
+            return true;
+        }
+#ifndef __linux__
+        // Without stat identities, fall back to comparing canonical paths
+        for (const auto &dir : canonicalPaths)
+        {
+            std::error_code ec;
+            if (fs::equivalent(fs::path(buildPath()), dir, ec))
+            {
+                return true;
+            }
+        }
+#endif
+        if (literalPaths.empty() && pathPatterns.empty())
+        {
+            return false;
+        }
+        const std::string_view path = buildPath();
+        for (const auto &dir : literalPaths)
+        {
+            if (path == dir)
+            {
+                return true;
+            }
+        }
+        for (const auto &pattern : pathPatterns)
+        {
+            if (globMatch(pattern, path))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// How opaque directories (--opaque) are accounted
+enum class OpaqueMode
+{
+    Walk,   // walk them in the main traversal and report each as one entry
+    Approx, // count only the files directly inside them
+    Skip    // leave them out of the results entirely
+};
+
+inline OpaqueMode parseOpaqueMode(const std::string &name)
+{
+    if (name == "walk")
+    {
+        return OpaqueMode::Walk;
+    }
+    if (name == "approx")
+    {
+        return OpaqueMode::Approx;
+    }
+    if (name == "skip")
+    {
+        return OpaqueMode::Skip;
+    }
+    throw std::runtime_error("Invalid opaque mode: " + name + " (expected walk, approx or skip)");
+}
+
+// Order in which a scan visits metadata (--order)
+enum class ScanOrder
+{
+    Readdir, // stat entries as readdir returns them, descend depth-first
+    Inode,   // stat entries and descend into subdirectories in inode order
+    Bfs      // visit directories breadth-first, each worker taking its oldest task
+};
+
+inline ScanOrder parseScanOrder(const std::string &name)
+{
+    if (name == "readdir")
+    {
+        return ScanOrder::Readdir;
+    }
+    if (name == "inode")
+    {
+        return ScanOrder::Inode;
+    }
+    if (name == "bfs")
+    {
+        return ScanOrder::Bfs;
+    }
+    throw std::runtime_error("Invalid order: " + name + " (expected readdir, inode or bfs)");
+}
+
+inline const char *scanOrderName(ScanOrder order)
+{
+    switch (order)
+    {
+    case ScanOrder::Inode:
+        return "inode";
+    case ScanOrder::Bfs:
+        return "bfs";
+    default:
+        return "readdir";
+    }
+}
+
+// What a filter test reads about one file. The name, type and path come from the directory
+// listing; size, modification time and owner are only valid once the file has been stat'ed
+struct FilterInput
+{
+    std::string_view directory;
+    std::string_view name;
+    std::string_view type;
+    std::string *scratch = nullptr; // buffer for the full path, built only if a test needs it
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+    uint32_t uid = 0;
+};
+
+// File filter for expressions like `size>1M && ext in {.log,.gz} && mtime<30d`. Tests are
+// size, mtime (age, with s/m/h/d/w units), owner (user name or uid), ext (alias type), name
+// and path (globs); they combine with &&, ||, ! and parentheses. Every expression added, and
+// the -t/-s/-S options, are ANDed together and compiled once into a flat program of tests
+// that each jump to the next test, or accept or reject. Within every && and || the cheapest
+// tests run first: type and name before path, and all of them before the tests that need a
+// stat, so a file can often be rejected from its name and d_type alone and never be stat'ed.
+class FileFilter
+{
+public:
+    static constexpr int32_t ACCEPT = -1;
+    static constexpr int32_t REJECT = -2;
+
+private:
+    // Ordered by cost; everything from Size on needs stat
+    enum class Field : uint8_t
+    {
+        Type,
+        Name,
+        Path,
+        Size,
+        Mtime,
+        Owner
+    };
+
+    enum class Op : uint8_t
+    {
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal, // for sets and globs: is a member, matches one of the patterns
+        NotEqual
+    };
+
+    struct Instruction
+    {
+        Field field;
+        Op op;
+        uint32_t operand = 0; // index into typeSets, patterns or owners
+        int64_t value = 0;    // bytes, or the mtime cutoff in nanoseconds
+        int32_t onTrue = ACCEPT;
+        int32_t onFalse = REJECT;
+    };
+
+    struct Node
+    {
+        enum Kind
+        {
+            And,
+            Or,
+            Not,
+            Test
+        } kind;
+        std::vector<size_t> children;
+        Instruction test{};  // Test nodes; mtime tests hold the age until compile()
+        uint64_t cost = 0;
+    };
+
+    struct Parser
+    {
+        const std::string &text;
+        size_t pos = 0;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<size_t> clauses; // ANDed roots
+    std::vector<std::string> sources;
+    std::vector<std::vector<std::string>> typeSets; // sorted
+    std::vector<std::vector<std::string>> patterns;
+    std::vector<std::vector<uint32_t>> owners; // sorted
+    std::vector<Instruction> program;
+    int32_t start = ACCEPT;
+    bool timed = false;
+
+    static uint64_t fieldCost(Field field)
+    {
+        switch (field)
+        {
+        case Field::Type:
+            return 1;
+        case Field::Name:
+            return 2;
+        case Field::Path:
+            return 4;
+        default:
+            return 16;
+        }
+    }
+
+    [[noreturn]] static void fail(const Parser &parser, const std::string &message)
+    {
+        throw std::runtime_error("Invalid filter \"" + parser.text + "\": " + message + " at position " +
+                                 std::to_string(parser.pos + 1));
+    }
+
+    static void skipSpace(Parser &parser)
+    {
+        while (parser.pos < parser.text.size() && std::isspace(static_cast<unsigned char>(parser.text[parser.pos])))
+        {
+            parser.pos++;
+        }
+    }
+
+    // Consume token if it comes next
+    static bool accept(Parser &parser, std::string_view token)
+    {
+        skipSpace(parser);
+        if (parser.text.compare(parser.pos, token.size(), token) != 0)
+        {
+            return false;
+        }
+        parser.pos += token.size();
+        return true;
+    }
+
+    // A bare word up to whitespace or punctuation, or a quoted string
+    static std::string word(Parser &parser)
+    {
+        skipSpace(parser);
+        const std::string &text = parser.text;
+        if (parser.pos < text.size() && (text[parser.pos] == '"' || text[parser.pos] == '\''))
+        {
+            const char quote = text[parser.pos];
+            const size_t close = text.find(quote, parser.pos + 1);
+            if (close == std::string::npos)
+            {
+                fail(parser, "unterminated string");
+            }
+            std::string value = text.substr(parser.pos + 1, close - parser.pos - 1);
+            parser.pos = close + 1;
+            return value;
+        }
+        const size_t begin = parser.pos;
+        while (parser.pos < text.size() && !std::isspace(static_cast<unsigned char>(text[parser.pos])) &&
+               std::strchr("(){},&|!<>=", text[parser.pos]) == nullptr)
+        {
+            parser.pos++;
+        }
+        if (parser.pos == begin)
+        {
+            fail(parser, "expected a value");
+        }
+        return text.substr(begin, parser.pos - begin);
+    }
+
+    // One value, or a {a,b,c} list
+    static std::vector<std::string> values(Parser &parser)
+    {
+        std::vector<std::string> list;
+        if (!accept(parser, "{"))
+        {
+            list.push_back(word(parser));
+            return list;
+        }
+        do
+        {
+            list.push_back(word(parser));
+        } while (accept(parser, ","));
+        if (!accept(parser, "}"))
+        {
+            fail(parser, "expected '}'");
+        }
+        return list;
+    }
+
+    static int64_t parseAge(const Parser &parser, const std::string &value)
+    {
+        size_t consumed = 0;
+        double amount = 0;
+        try
+        {
+            amount = std::stod(value, &consumed);
+        }
+        catch (const std::exception &)
+        {
+            fail(parser, "invalid age " + value);
+        }
+        const std::string unit = value.substr(consumed);
+        double seconds = 1;
+        if (unit == "m")
+            seconds = 60;
+        else if (unit == "h")
+            seconds = 3600;
+        else if (unit == "d")
+            seconds = 86400;
+        else if (unit == "w")
+            seconds = 7 * 86400;
+        else if (!unit.empty() && unit != "s")
+            fail(parser, "invalid age unit " + unit + " (expected s, m, h, d or w)");
+        if (amount < 0)
+        {
+            fail(parser, "invalid age " + value);
+        }
+        return static_cast<int64_t>(amount * seconds * 1e9);
+    }
+
+    static uint32_t parseOwner(const Parser &parser, const std::string &value)
+    {
+        if (!value.empty() && std::all_of(value.begin(), value.end(), [](char ch)
+                                          { return ch >= '0' && ch <= '9'; }))
+        {
+            return static_cast<uint32_t>(std::stoul(value));
+        }
+#ifdef __linux__
+        if (const struct passwd *user = getpwnam(value.c_str()))
+        {
+            return user->pw_uid;
+        }
+#endif
+        fail(parser, "unknown user " + value);
+    }
+
+    static std::string normalizeType(std::string type)
+    {
+        if (type.empty())
+        {
+            return "[no extension]";
+        }
+        if (type[0] == '[')
+        {
+            return type;
+        }
+        std::transform(type.begin(), type.end(), type.begin(), [](unsigned char ch)
+                       { return static_cast<char>(std::tolower(ch)); });
+        return type[0] == '.' ? type : "." + type;
+    }
+
+    size_t addNode(Node::Kind kind, std::vector<size_t> children)
+    {
+        Node node{kind, std::move(children)};
+        nodes.push_back(std::move(node));
+        return nodes.size() - 1;
+    }
+
+    size_t addTest(const Instruction &test)
+    {
+        const size_t index = addNode(Node::Test, {});
+        nodes[index].test = test;
+        return index;
+    }
+
+    size_t parseTest(Parser &parser)
+    {
+        const size_t fieldPos = parser.pos;
+        const std::string field = word(parser);
+        Instruction test;
+        if (field == "size")
+            test.field = Field::Size;
+        else if (field == "mtime")
+            test.field = Field::Mtime;
+        else if (field == "owner")
+            test.field = Field::Owner;
+        else if (field == "ext" || field == "type")
+            test.field = Field::Type;
+        else if (field == "name")
+            test.field = Field::Name;
+        else if (field == "path")
+            test.field = Field::Path;
+        else
+        {
+            parser.pos = fieldPos;
+            fail(parser, "unknown field " + field + " (expected size, mtime, owner, ext, name or path)");
+        }
+
+        bool list = false;
+        if (accept(parser, "<="))
+            test.op = Op::LessEqual;
+        else if (accept(parser, ">="))
+            test.op = Op::GreaterEqual;
+        else if (accept(parser, "<"))
+            test.op = Op::Less;
+        else if (accept(parser, ">"))
+            test.op = Op::Greater;
+        else if (accept(parser, "==") || accept(parser, "="))
+            test.op = Op::Equal;
+        else if (accept(parser, "!="))
+            test.op = Op::NotEqual;
+        else if (accept(parser, "in"))
+        {
+            test.op = Op::Equal;
+            list = true;
+        }
+        else
+        {
+            fail(parser, "expected a comparison after " + field);
+        }
+
+        const bool ordered = test.field == Field::Size || test.field == Field::Mtime;
+        const bool relational = test.op != Op::Equal && test.op != Op::NotEqual;
+        if ((ordered && list) || (!ordered && relational) || (test.field == Field::Mtime && !relational))
+        {
+            fail(parser, "unsupported comparison for " + field);
+        }
+        const std::vector<std::string> operands = values(parser);
+        switch (test.field)
+        {
+        case Field::Size:
+            try
+            {
+                test.value = static_cast<int64_t>(parseSize(operands[0]));
+            }
+            catch (const std::runtime_error &e)
+            {
+                fail(parser, e.what());
+            }
+            break;
+        case Field::Mtime:
+            test.value = parseAge(parser, operands[0]);
+            timed = true;
+            break;
+        case Field::Owner:
+        {
+            std::vector<uint32_t> uids;
+            for (const auto &owner : operands)
+            {
+                uids.push_back(parseOwner(parser, owner));
+            }
+            std::sort(uids.begin(), uids.end());
+            test.operand = static_cast<uint32_t>(owners.size());
+            owners.push_back(std::move(uids));
+            break;
+        }
+        case Field::Type:
+        {
+            std::vector<std::string> types;
+            for (const auto &type : operands)
+            {
+                types.push_back(normalizeType(type));
+            }
+            std::sort(types.begin(), types.end());
+            test.operand = static_cast<uint32_t>(typeSets.size());
+            typeSets.push_back(std::move(types));
+            break;
+        }
+        default:
+            test.operand = static_cast<uint32_t>(patterns.size());
+            patterns.push_back(operands);
+            break;
+        }
+        return addTest(test);
+    }
+
+    size_t parseUnary(Parser &parser)
+    {
+        if (accept(parser, "!"))
+        {
+            return addNode(Node::Not, {parseUnary(parser)});
+        }
+        if (accept(parser, "("))
+        {
+            const size_t inner = parseOr(parser);
+            if (!accept(parser, ")"))
+            {
+                fail(parser, "expected ')'");
+            }
+            return inner;
+        }
+        return parseTest(parser);
+    }
+
+    size_t parseAnd(Parser &parser)
+    {
+        std::vector<size_t> children{parseUnary(parser)};
+        while (accept(parser, "&&"))
+        {
+            children.push_back(parseUnary(parser));
+        }
+        return children.size() == 1 ? children[0] : addNode(Node::And, std::move(children));
+    }
+
+    size_t parseOr(Parser &parser)
+    {
+        std::vector<size_t> children{parseAnd(parser)};
+        while (accept(parser, "||"))
+        {
+            children.push_back(parseAnd(parser));
+        }
+        return children.size() == 1 ? children[0] : addNode(Node::Or, std::move(children));
+    }
+
+    // Cost of a subtree, with the children of every && and || sorted cheapest first
+    uint64_t order(size_t index)
+    {
+        Node &node = nodes[index];
+        if (node.kind == Node::Test)
+        {
+            node.cost = fieldCost(node.test.field);
+            return node.cost;
+        }
+        uint64_t cost = 0;
+        for (const size_t child : node.children)
+        {
+            cost += order(child);
+        }
+        std::stable_sort(node.children.begin(), node.children.end(), [this](size_t a, size_t b)
+                         { return nodes[a].cost < nodes[b].cost; });
+        nodes[index].cost = cost;
+        return cost;
+    }
+
+    // Emit a subtree that continues at onTrue or onFalse; returns its first instruction.
+    // Conjunctions and disjunctions are emitted back to front so each test knows where to go
+    int32_t emit(size_t index, int32_t onTrue, int32_t onFalse, int64_t nowNs)
+    {
+        const Node &node = nodes[index];
+        switch (node.kind)
+        {
+        case Node::Not:
+            return emit(node.children[0], onFalse, onTrue, nowNs);
+        case Node::And:
+        case Node::Or:
+        {
+            int32_t next = node.kind == Node::And ? onTrue : onFalse;
+            for (size_t i = node.children.size(); i-- > 0;)
+            {
+                next = node.kind == Node::And ? emit(node.children[i], next, onFalse, nowNs)
+                                              : emit(node.children[i], onTrue, next, nowNs);
+            }
+            return next;
+        }
+        case Node::Test:
+        default:
+        {
+            Instruction instruction = node.test;
+            instruction.onTrue = onTrue;
+            instruction.onFalse = onFalse;
+            if (instruction.field == Field::Mtime)
+            {
+                // An age below the limit is a modification time after the cutoff
+                static const Op mirrored[] = {Op::Greater, Op::GreaterEqual, Op::Less, Op::LessEqual};
+                instruction.value = nowNs - instruction.value;
+                instruction.op = mirrored[static_cast<int>(instruction.op)];
+            }
+            program.push_back(instruction);
+            return static_cast<int32_t>(program.size() - 1);
+        }
+        }
+    }
+
+    template <typename T>
+    static bool compare(Op op, T actual, T limit)
+    {
+        switch (op)
+        {
+        case Op::Less:
+            return actual < limit;
+        case Op::LessEqual:
+            return actual <= limit;
+        case Op::Greater:
+            return actual > limit;
+        case Op::GreaterEqual:
+            return actual >= limit;
+        case Op::Equal:
+            return actual == limit;
+        default:
+            return actual != limit;
+        }
+    }
+
+    static bool matchesAny(const std::vector<std::string> &globs, std::string_view text)
+    {
+        for (const auto &glob : globs)
+        {
+            if (globMatch(glob, text))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool test(const Instruction &instruction, const FilterInput &input) const
+    {
+        bool member = false;
+        switch (instruction.field)
+        {
+        case Field::Size:
+            return compare(instruction.op, input.size, static_cast<uint64_t>(instruction.value));
+        case Field::Mtime:
+            return compare(instruction.op, input.mtimeNs, instruction.value);
+        case Field::Type:
+        {
+            const auto &types = typeSets[instruction.operand];
+            member = std::binary_search(types.begin(), types.end(), input.type);
+            break;
+        }
+        case Field::Name:
+            member = matchesAny(patterns[instruction.operand], input.name);
+            break;
+        case Field::Path:
+            member = matchesAny(patterns[instruction.operand], buildChildPath(*input.scratch, input.directory, input.name));
+            break;
+        case Field::Owner:
+        {
+            const auto &uids = owners[instruction.operand];
+            member = std::binary_search(uids.begin(), uids.end(), input.uid);
+            break;
+        }
+        }
+        return member == (instruction.op == Op::Equal);
+    }
+
+public:
+    // AND a filter expression onto the filter; throws std::runtime_error if it does not parse
+    void addExpression(const std::string &expression)
+    {
+        Parser parser{expression};
+        const size_t root = parseOr(parser);
+        skipSpace(parser);
+        if (parser.pos != expression.size())
+        {
+            fail(parser, "unexpected input");
+        }
+#ifndef __linux__
+        for (const auto &node : nodes)
+        {
+            if (node.kind == Node::Test && (node.test.field == Field::Mtime || node.test.field == Field::Owner))
+            {
+                throw std::runtime_error("mtime and owner filters are only supported on Linux");
+            }
+        }
+#endif
+        clauses.push_back(root);
+        sources.push_back(expression);
+    }
+
+    // AND a size range (the -s/-S options); the full range adds no test
+    void addSizeRange(uint64_t minSize, uint64_t maxSize)
+    {
+        if (minSize > 0)
+        {
+            Instruction test{Field::Size, Op::GreaterEqual};
+            test.value = static_cast<int64_t>(minSize);
+            clauses.push_back(addTest(test));
+        }
+        if (maxSize < static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+        {
+            Instruction test{Field::Size, Op::LessEqual};
+            test.value = static_cast<int64_t>(maxSize);
+            clauses.push_back(addTest(test));
+        }
+    }
+
+    // AND a set of file type keys that must contain the file's type (the -t option)
+    template <typename Types>
+    void addTypes(const Types &types)
+    {
+        if (types.empty())
+        {
+            return;
+        }
+        Instruction test{Field::Type, Op::Equal};
+        test.operand = static_cast<uint32_t>(typeSets.size());
+        typeSets.emplace_back(types.begin(), types.end());
+        std::sort(typeSets.back().begin(), typeSets.back().end());
+        clauses.push_back(addTest(test));
+    }
+
+    // Build the program; mtime ages are measured back from nowNs (wall clock)
+    void compile(int64_t nowNs)
+    {
+        program.clear();
+        if (clauses.empty())
+        {
+            start = ACCEPT;
+            return;
+        }
+        const size_t root = clauses.size() == 1 ? clauses[0] : addNode(Node::And, clauses);
+        order(root);
+        start = emit(root, ACCEPT, REJECT, nowNs);
+    }
+
+    bool empty() const
+    {
+        return clauses.empty();
+    }
+
+    // Whether the outcome depends on the time of the scan, not only on the files
+    bool dependsOnTime() const
+    {
+        return timed;
+    }
+
+    const std::vector<std::string> &expressions() const
+    {
+        return sources;
+    }
+
+    int32_t entry() const
+    {
+        return start;
+    }
+
+    // Run the program from pc to ACCEPT or REJECT. Without stat information it stops at the
+    // first test that needs it and returns that test's index, to be resumed once stat'ed
+    int32_t evaluate(const FilterInput &input, bool statKnown, int32_t pc) const
+    {
+        while (pc >= 0)
+        {
+            const Instruction &instruction = program[pc];
+            if (!statKnown && instruction.field >= Field::Size)
+            {
+                return pc;
+            }
+            pc = test(instruction, input) ? instruction.onTrue : instruction.onFalse;
+        }
+        return pc;
+    }
+};
+
+// Concurrent set of (device, inode) pairs, used to count each hard-linked file once. A key
+// packs a small per-set device number above a 48-bit inode into one 64-bit word (0 marks an
+// empty slot) and lives in one of 64 open-addressing tables chosen by hash, each behind its
+// own lock; workers rarely meet on a shard, a table grows one shard at a time, and memory
+// stays at 8 bytes per slot. Inodes that do not fit in 48 bits go to a small ordered set.
+class InodeSet
+{
+public:
+    // Per-worker memo of the last device looked up, so the device table is rarely locked
+    struct DeviceCache
+    {
+        uint64_t device = std::numeric_limits<uint64_t>::max();
+        uint64_t number = 0;
+    };
+
+private:
+    static constexpr unsigned SHARD_BITS = 6;
+    static constexpr unsigned INODE_BITS = 48;
+    static constexpr size_t INITIAL_SLOTS = 1024;
+
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        std::vector<uint64_t> slots;
+        size_t used = 0;
+    };
+
+    Shard shards[size_t(1) << SHARD_BITS];
+    std::mutex devicesMutex;
+    std::vector<uint64_t> devices;
+    std::mutex overflowMutex;
+    std::set<std::pair<uint64_t, uint64_t>> overflow;
+
+    // splitmix64 finalizer: spreads packed keys, whose low bits are sequential inode numbers
+    static uint64_t mix(uint64_t key)
+    {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebULL;
+        return key ^ (key >> 31);
+    }
+
+    // Returns true if the key was not present
+    static bool insertSlot(std::vector<uint64_t> &slots, uint64_t key, uint64_t hash)
+    {
+        const size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            if (slots[i] == key)
+            {
+                return false;
+            }
+            if (slots[i] == 0)
+            {
+                slots[i] = key;
+                return true;
+            }
+        }
+    }
+
+    uint64_t deviceNumber(uint64_t device, DeviceCache &cache)
+    {
+        if (cache.device == device)
+        {
+            return cache.number;
+        }
+        std::lock_guard<std::mutex> lock(devicesMutex);
+        auto it = std::find(devices.begin(), devices.end(), device);
+        if (it == devices.end())
+        {
+            it = devices.insert(devices.end(), device);
+        }
+        cache.device = device;
+        cache.number = static_cast<uint64_t>(it - devices.begin()) + 1;
+        return cache.number;
+    }
+
+public:
+    // Returns true the first time a (device, inode) pair is inserted
+    bool insert(uint64_t device, uint64_t inode, DeviceCache &cache)
+    {
+        const uint64_t number = deviceNumber(device, cache);
+        if ((inode >> INODE_BITS) != 0 || number >= (uint64_t(1) << (64 - INODE_BITS)))
+        {
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            return overflow.emplace(device, inode).second;
+        }
+
+        const uint64_t key = (number << INODE_BITS) | inode;
+        const uint64_t hash = mix(key);
+        Shard &shard = shards[hash >> (64 - SHARD_BITS)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if ((shard.used + 1) * 10 > shard.slots.size() * 7)
+        {
+            // Grow at 70% load; only this shard is rehashed
+            std::vector<uint64_t> grown(std::max(INITIAL_SLOTS, shard.slots.size() * 2), 0);
+            for (const uint64_t existing : shard.slots)
+            {
+                if (existing != 0)
+                {
+                    insertSlot(grown, existing, mix(existing));
+                }
+            }
+            shard.slots.swap(grown);
+        }
+        if (!insertSlot(shard.slots, key, hash))
+        {
+            return false;
+        }
+        shard.used++;
+        return true;
+    }
+};
+
+// Bounded list of the N largest paths. A heap ordered worst-first keeps the smallest kept
+// entry on top, so an offer that cannot make the list is rejected on its size alone and
+// memory stays O(N) however many entries are offered
+class TopList
+{
+public:
+    struct Entry
+    {
+        uint64_t size;
+        std::string path;
+    };
+
+private:
+    size_t limit = 0;
+    std::vector<Entry> heap;
+
+    // Larger sizes rank first; equal sizes by path so merged results are deterministic
+    static bool ranksBefore(const Entry &a, const Entry &b)
+    {
+        return a.size != b.size ? a.size > b.size : a.path < b.path;
+    }
+
+public:
+    void setLimit(size_t count)
+    {
+        limit = count;
+        heap.clear();
+        heap.reserve(count);
+    }
+
+    bool enabled() const
+    {
+        return limit != 0;
+    }
+
+    size_t limitCount() const
+    {
+        return limit;
+    }
+
+    // Cheap pre-check so callers only build a path for entries that may be kept
+    bool accepts(uint64_t size) const
+    {
+        return limit != 0 && (heap.size() < limit || size >= heap.front().size);
+    }
+
+    void offer(uint64_t size, std::string_view path)
+    {
+        if (!accepts(size))
+        {
+            return;
+        }
+        Entry candidate{size, std::string(path)};
+        if (heap.size() < limit)
+        {
+            heap.push_back(std::move(candidate));
+            std::push_heap(heap.begin(), heap.end(), ranksBefore);
+            return;
+        }
+        if (!ranksBefore(candidate, heap.front()))
+        {
+            return;
+        }
+        std::pop_heap(heap.begin(), heap.end(), ranksBefore);
+        heap.back() = std::move(candidate);
+        std::push_heap(heap.begin(), heap.end(), ranksBefore);
+    }
+
+    void merge(const TopList &other)
+    {
+        for (const auto &entry : other.heap)
+        {
+            offer(entry.size, entry.path);
+        }
+    }
+
+    std::vector<Entry> sorted() const
+    {
+        std::vector<Entry> entries = heap;
+        std::sort(entries.begin(), entries.end(), ranksBefore);
+        return entries;
+    }
+};
+
+// Wire format of scan results exchanged between a distributed scan's coordinator and its
+// workers: the totals with every type's stats and sparse size sketch, and top lists
+inline void appendTotals(std::string &out, const ScanTotals &totals)
+{
+    for (const size_t value : {totals.totalFiles, totals.totalSize, totals.hiddenFiles, totals.hiddenSize,
+                               totals.entries, totals.allocatedSize, totals.linkedFiles, totals.linkedSize})
+    {
+        appendBinary(out, uint64_t(value));
+    }
+    appendBinary(out, uint32_t(totals.stats.size()));
+    totals.forEachType([&out](const std::string &fileType, const FileTypeStats &stat)
+                       {
+                           appendBinary(out, uint16_t(fileType.size()));
+                           out += fileType;
+                           for (const size_t value : {stat.count, stat.totalSize, stat.minSize, stat.maxSize, stat.allocatedSize})
+                           {
+                               appendBinary(out, uint64_t(value));
+                           }
+                           const auto &counts = stat.sketch.counts;
+                           appendBinary(out, uint16_t(counts.size() - std::count(counts.begin(), counts.end(), 0)));
+                           for (size_t bucket = 0; bucket < counts.size(); bucket++)
+                           {
+                               if (counts[bucket] != 0)
+                               {
+                                   appendBinary(out, uint16_t(bucket));
+                                   appendBinary(out, uint64_t(counts[bucket]));
+                               }
+                           } });
+}
+
+// Merge totals read from cursor into totals
+inline void readTotals(BinaryCursor &cursor, ScanTotals &totals)
+{
+    ScanTotals part;
+    for (size_t *value : {&part.totalFiles, &part.totalSize, &part.hiddenFiles, &part.hiddenSize,
+                          &part.entries, &part.allocatedSize, &part.linkedFiles, &part.linkedSize})
+    {
+        *value = cursor.read<uint64_t>();
+    }
+    const uint32_t typeCount = cursor.read<uint32_t>();
+    for (uint32_t i = 0; i < typeCount; i++)
+    {
+        FileTypeStats &stat = part.statsFor(cursor.readString());
+        for (size_t *value : {&stat.count, &stat.totalSize, &stat.minSize, &stat.maxSize, &stat.allocatedSize})
+        {
+            *value = cursor.read<uint64_t>();
+        }
+        const uint16_t buckets = cursor.read<uint16_t>();
+        if (buckets != 0)
+        {
+            stat.sketch.enable();
+        }
+        for (uint16_t b = 0; b < buckets; b++)
+        {
+            const uint16_t bucket = cursor.read<uint16_t>();
+            if (bucket >= SizeSketch::BUCKETS)
+            {
+                throw std::runtime_error("Corrupt results: bad size bucket");
+            }
+            stat.sketch.counts[bucket] = cursor.read<uint64_t>();
+        }
+    }
+    totals.merge(part);
+}
+
+inline void appendTopList(std::string &out, const TopList &list)
+{
+    const auto entries = list.sorted();
+    appendBinary(out, uint32_t(entries.size()));
+    for (const auto &entry : entries)
+    {
+        appendBinary(out, entry.size);
+        appendBinary(out, uint16_t(entry.path.size()));
+        out += entry.path;
+    }
+}
+
+// Offer the entries read from cursor to list
+inline void readTopList(BinaryCursor &cursor, TopList &list)
+{
+    const uint32_t count = cursor.read<uint32_t>();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint64_t size = cursor.read<uint64_t>();
+        list.offer(size, cursor.readString());
+    }
+}
+
+// Run fn(thread, i) for every i below count on up to threads threads (the caller is thread 0)
+template <typename Fn>
+void parallelFor(size_t count, size_t threads, Fn fn)
+{
+    std::atomic<size_t> next{0};
+    const auto work = [&](size_t thread)
+    {
+        for (size_t i = next++; i < count; i = next++)
+        {
+            fn(thread, i);
+        }
+    };
+    std::vector<std::thread> helpers;
+    for (size_t thread = 1; thread < std::min(threads, count); thread++)
+    {
+        helpers.emplace_back(work, thread);
+    }
+    work(0);
+    for (auto &helper : helpers)
+    {
+        helper.join();
+    }
+}
+
+// A regular file considered by --find-duplicates
+struct DuplicateCandidate
+{
+    uint64_t size;
+    uint64_t device;
+    uint64_t inode;
+    std::string path;
+    uint64_t hash = 0; // partial, then full content hash
+    bool failed = false;
+};
+
+// Staged duplicate search. Each stage only sees the files that survived the previous one:
+// files with a unique size are dropped without being opened, the rest are hashed over their
+// first and last 4 KiB, and only files whose size and partial hash still collide are hashed
+// in full. Hard links to one inode are one file, not duplicates. Contents are compared by
+// XXH64, so two different files match only on a 64-bit hash collision.
+class DuplicateFinder
+{
+public:
+    struct Group
+    {
+        uint64_t size;
+        std::vector<std::string> paths; // sorted
+    };
+
+    struct Stats
+    {
+        size_t candidates = 0;
+        size_t sizeMatches = 0;    // files left after grouping by size
+        size_t partialMatches = 0; // files left after the head/tail hash
+        uint64_t bytesRead = 0;
+    };
+
+private:
+    static constexpr size_t EDGE = 4096;
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    // Aligned read buffer, one per hashing thread
+    struct Buffer
+    {
+        struct Free
+        {
+            void operator()(unsigned char *data) const
+            {
+                ::operator delete[](data, std::align_val_t(EDGE));
+            }
+        };
+        std::unique_ptr<unsigned char[], Free> data{static_cast<unsigned char *>(::operator new[](BUFFER_SIZE, std::align_val_t(EDGE)))};
+    };
+
+    size_t jobs;
+    Stats stats;
+    std::atomic<uint64_t> bytesRead{0};
+
+    // Hash [offset, offset + length) of an open file into state; returns false on a read error
+    bool hashRange(int fd, uint64_t offset, uint64_t length, Xxh64 &state, unsigned char *buffer)
+    {
+        while (length > 0)
+        {
+            const size_t want = static_cast<size_t>(std::min<uint64_t>(length, BUFFER_SIZE));
+#ifdef __linux__
+            const ssize_t got = ::pread(fd, buffer, want, static_cast<off_t>(offset));
+#else
+            const long got = -1;
+            (void)fd;
+#endif
+            if (got <= 0)
+            {
+                return false;
+            }
+            state.update(buffer, static_cast<size_t>(got));
+            bytesRead.fetch_add(static_cast<uint64_t>(got), std::memory_order_relaxed);
+            offset += static_cast<uint64_t>(got);
+            length -= static_cast<uint64_t>(got);
+        }
+        return true;
+    }
+
+    // Partial hash (first and last EDGE bytes) or full hash of a candidate. Files of at most
+    // 2 * EDGE bytes are read whole by the partial pass, which is then also their full hash
+    void hashFile(DuplicateCandidate &file, bool full, unsigned char *buffer)
+    {
+#ifdef __linux__
+        // O_NOATIME is refused (EPERM) for files the caller does not own
+        int fd = ::open(file.path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+        if (fd < 0 && errno == EPERM)
+        {
+            fd = ::open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (fd < 0)
+        {
+            printWarning("Warning: Cannot read " + file.path + " - " + std::generic_category().message(errno));
+            file.failed = true;
+            return;
+        }
+        if (full)
+        {
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        Xxh64 state(file.size);
+        bool ok;
+        if (full || file.size <= 2 * EDGE)
+        {
+            ok = hashRange(fd, 0, file.size, state, buffer);
+        }
+        else
+        {
+            ok = hashRange(fd, 0, EDGE, state, buffer) &&
+                 hashRange(fd, file.size - EDGE, EDGE, state, buffer);
+        }
+        ::close(fd);
+        if (!ok)
+        {
+            // Also covers files truncated since the scan
+            printWarning("Warning: Cannot read " + file.path + " (changed during the scan?)");
+            file.failed = true;
+            return;
+        }
+        file.hash = state.digest();
+#else
+        (void)full;
+        (void)buffer;
+        file.failed = true;
+#endif
+    }
+
+    // Hash every file on the pool of threads, each with its own buffer
+    void hashAll(std::vector<DuplicateCandidate *> &files, bool full)
+    {
+        std::vector<Buffer> buffers(std::max<size_t>(1, std::min(jobs, files.size())));
+        parallelFor(files.size(), buffers.size(), [&](size_t thread, size_t i)
+                    { hashFile(*files[i], full, buffers[thread].data.get()); });
+    }
+
+    // Keep the files that share their size (and hash, if compareHash) with another file
+    static std::vector<DuplicateCandidate *> colliding(std::vector<DuplicateCandidate *> files, bool compareHash)
+    {
+        const auto key = [compareHash](const DuplicateCandidate *file)
+        {
+            return std::make_pair(file->size, compareHash ? file->hash : 0);
+        };
+        std::stable_sort(files.begin(), files.end(), [&](const auto *a, const auto *b)
+                         { return key(a) < key(b); });
+        std::vector<DuplicateCandidate *> kept;
+        for (size_t start = 0, end; start < files.size(); start = end)
+        {
+            for (end = start + 1; end < files.size() && key(files[end]) == key(files[start]); end++)
+            {
+            }
+            if (end - start > 1)
+            {
+                kept.insert(kept.end(), files.begin() + start, files.begin() + end);
+            }
+        }
+        return kept;
+    }
+
+    static std::vector<DuplicateCandidate *> withoutFailures(const std::vector<DuplicateCandidate *> &files)
+    {
+        std::vector<DuplicateCandidate *> kept;
+        for (auto *file : files)
+        {
+            if (!file->failed)
+            {
+                kept.push_back(file);
+            }
+        }
+        return kept;
+    }
+
+public:
+    explicit DuplicateFinder(size_t jobs) : jobs(std::max<size_t>(jobs, 1)) {}
+
+    std::vector<Group> find(std::vector<DuplicateCandidate> &files)
+    {
+        stats = Stats();
+        stats.candidates = files.size();
+
+        // Order by identity so that hard links to one inode are adjacent; keep the first path
+        std::sort(files.begin(), files.end(), [](const auto &a, const auto &b)
+                  { return std::tie(a.size, a.device, a.inode, a.path) < std::tie(b.size, b.device, b.inode, b.path); });
+        std::vector<DuplicateCandidate *> current;
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            if (files[i].size != 0 &&
+                (i == 0 || files[i].device != files[i - 1].device || files[i].inode != files[i - 1].inode))
+            {
+                current.push_back(&files[i]);
+            }
+        }
+
+        current = colliding(std::move(current), false);
+        stats.sizeMatches = current.size();
+
+        hashAll(current, false);
+        current = colliding(withoutFailures(current), true);
+        stats.partialMatches = current.size();
+
+        std::vector<DuplicateCandidate *> large;
+        for (auto *file : current)
+        {
+            if (file->size > 2 * EDGE)
+            {
+                large.push_back(file);
+            }
+        }
+        hashAll(large, true);
+        current = colliding(withoutFailures(current), true);
+        stats.bytesRead = bytesRead.load();
+
+        std::vector<Group> groups;
+        for (size_t start = 0, end; start < current.size(); start = end)
+        {
+            Group group{current[start]->size, {}};
+            for (end = start; end < current.size() && current[end]->size == current[start]->size &&
+                              current[end]->hash == current[start]->hash;
+                 end++)
+            {
+                group.paths.push_back(current[end]->path);
+            }
+            std::sort(group.paths.begin(), group.paths.end());
+            groups.push_back(std::move(group));
+        }
+        // Most reclaimable space first
+        std::sort(groups.begin(), groups.end(), [](const Group &a, const Group &b)
+                  {
+                      const uint64_t wastedA = a.size * (a.paths.size() - 1);
+                      const uint64_t wastedB = b.size * (b.paths.size() - 1);
+                      return wastedA != wastedB ? wastedA > wastedB : a.paths.front() < b.paths.front(); });
+        return groups;
+    }
+
+    const Stats &lastStats() const
+    {
+        return stats;
+    }
+};
+
+// CSV fields appended to a row buffer; numbers are formatted with std::to_chars, which
+// neither allocates nor consults the locale
+inline void appendCsvField(std::string &row, std::string_view field)
+{
+    if (field.find_first_of(",\"\n") == std::string_view::npos)
+    {
+        row.append(field.data(), field.size());
+        return;
+    }
+    row += '"';
+    for (const char c : field)
+    {
+        if (c == '"')
+        {
+            row += '"';
+        }
+        row += c;
+    }
+    row += '"';
+}
+
+inline void appendCsvNumber(std::string &row, uint64_t value)
+{
+    char digits[24];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    row.append(digits, result.ptr);
+}
+
+// How AsyncWriter compresses its output
+enum class OutputCompression
+{
+    None,
+    Gzip, // through gzip -c
+    Zstd  // through zstd -c
+};
+
+// Compression implied by a file name: .gz or .zst
+inline OutputCompression compressionFor(std::string_view filename)
+{
+    const auto endsWith = [filename](std::string_view suffix)
+    {
+        return filename.size() > suffix.size() && filename.substr(filename.size() - suffix.size()) == suffix;
+    };
+    return endsWith(".gz") ? OutputCompression::Gzip : endsWith(".zst") ? OutputCompression::Zstd
+                                                                          : OutputCompression::None;
+}
+
+// File written by a background thread. Producers fill buffers of about BUFFER_BYTES and hand
+// them over with submit(), which gives back an empty buffer that keeps its capacity, so the
+// formatting threads never wait on the disk unless MAX_PENDING buffers are already queued.
+// Compressed output is piped through the gzip or zstd command, which then runs in parallel
+// with both the scan and the writer thread
+class AsyncWriter
+{
+public:
+    static constexpr size_t BUFFER_BYTES = 1 << 20;
+    static constexpr size_t MAX_PENDING = 8;
+
+private:
+    std::FILE *file = nullptr;
+    bool piped = false;
+    std::string filename;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ready;   // a buffer was queued, or closing
+    std::condition_variable drained; // a buffer was written
+    std::deque<std::string> pending;
+    std::vector<std::string> spare;
+    bool closing = false;
+    std::string error;
+
+    static std::string shellQuote(const std::string &text)
+    {
+        std::string quoted = "'";
+        for (const char c : text)
+        {
+            quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+        }
+        return quoted + "'";
+    }
+
+    void run()
+    {
+        // A compressor that died makes writes fail with EPIPE instead of killing the process;
+        // SIGPIPE is raised on the writing thread, so blocking it here is enough
+        sigset_t pipeSignal;
+        sigemptyset(&pipeSignal);
+        sigaddset(&pipeSignal, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipeSignal, nullptr);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            ready.wait(lock, [this]
+                       { return closing || !pending.empty(); });
+            if (pending.empty())
+            {
+                return;
+            }
+            std::string buffer = std::move(pending.front());
+            pending.pop_front();
+            lock.unlock();
+            const bool written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+            buffer.clear();
+            lock.lock();
+            if (!written && error.empty())
+            {
+                error = "Cannot write " + filename + ": " + std::generic_category().message(errno);
+            }
+            spare.push_back(std::move(buffer));
+            drained.notify_all();
+        }
+    }
+
+public:
+    AsyncWriter() = default;
+    AsyncWriter(const AsyncWriter &) = delete;
+    AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+    ~AsyncWriter()
+    {
+        try
+        {
+            close();
+        }
+        catch (const std::exception &)
+        {
+        }
+    }
+
+    void open(const std::string &name, OutputCompression compression)
+    {
+        close();
+        filename = name;
+        error.clear();
+        closing = false;
+        if (compression == OutputCompression::None)
+        {
+            file = std::fopen(name.c_str(), "wb");
+        }
+        else
+        {
+            const std::string command = std::string(compression == OutputCompression::Gzip ? "gzip" : "zstd -q") +
+                                        " -c > " + shellQuote(name);
+            file = ::popen(command.c_str(), "w");
+            piped = true;
+        }
+        if (!file)
+        {
+            throw std::runtime_error("Cannot create output file: " + name);
+        }
+        thread = std::thread([this]
+                             { run(); });
+    }
+
+    bool isOpen() const
+    {
+        return file != nullptr;
+    }
+
+    // Queue buffer for writing and replace it with an empty one
+    void submit(std::string &buffer)
+    {
+        if (buffer.empty())
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        drained.wait(lock, [this]
+                     { return pending.size() < MAX_PENDING; });
+        pending.push_back(std::move(buffer));
+        if (!spare.empty())
+        {
+            buffer = std::move(spare.back());
+            spare.pop_back();
+        }
+        else
+        {
+            buffer = std::string();
+            buffer.reserve(BUFFER_BYTES + BUFFER_BYTES / 8);
+        }
+        ready.notify_one();
+    }
+
+    // Write everything queued and close the file; throws if any write failed
+    void close()
+    {
+        if (!file)
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        ready.notify_one();
+        thread.join();
+        const int status = piped ? ::pclose(file) : std::fclose(file);
+        file = nullptr;
+        piped = false;
+        spare.clear();
+        if (error.empty() && status != 0)
+        {
+            error = "Cannot write " + filename;
+        }
+        if (!error.empty())
+        {
+            throw std::runtime_error(error);
+        }
+    }
+};
+
+// A directory whose subtree is still being scanned (--top-dirs). Each node counts its
+// unfinished children plus itself; the worker that finishes the last of them knows the
+// subtree size, adds it to the parent and repeats the check there, so sizes roll up bottom-up
+// during the single traversal. The node owns its path until then
+struct DirNode
+{
+    DirNode *parent;
+    PathArena::Path path;
+    std::atomic<size_t> pending{1};
+    std::atomic<uint64_t> size{0};
+
+    DirNode(DirNode *parent, const PathArena::Path &path) : parent(parent), path(path) {}
+};
+
+// Directory names stored once each, back to back, and referred to by a 32-bit ID
+class NamePool
+{
+private:
+    std::string bytes;
+    std::vector<uint32_t> starts{0}; // start of every name, and the end of the last
+    std::vector<uint32_t> slots;     // ID + 1, 0 marks an empty slot
+    size_t mask = 0;
+
+    void rehash(size_t capacity)
+    {
+        slots.assign(capacity, 0);
+        mask = capacity - 1;
+        for (uint32_t id = 0; id + 1 < starts.size(); id++)
+        {
+            size_t slot = hashBytes(name(id)) & mask;
+            while (slots[slot] != 0)
+            {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = id + 1;
+        }
+    }
+
+public:
+    uint32_t intern(std::string_view key)
+    {
+        if (slots.empty())
+        {
+            rehash(1024);
+        }
+        size_t slot = hashBytes(key) & mask;
+        while (slots[slot] != 0)
+        {
+            if (name(slots[slot] - 1) == key)
+            {
+                return slots[slot] - 1;
+            }
+            slot = (slot + 1) & mask;
+        }
+        if (bytes.size() + key.size() > std::numeric_limits<uint32_t>::max())
+        {
+            throw std::overflow_error("Directory name pool overflow");
+        }
+        const uint32_t id = static_cast<uint32_t>(starts.size() - 1);
+        bytes.append(key.data(), key.size());
+        starts.push_back(static_cast<uint32_t>(bytes.size()));
+        slots[slot] = id + 1;
+        if ((id + 1) * 2 > slots.size())
+        {
+            rehash(slots.size() * 2);
+        }
+        return id;
+    }
+
+    std::string_view name(uint32_t id) const
+    {
+        return std::string_view(bytes.data() + starts[id], starts[id + 1] - starts[id]);
+    }
+
+    uint32_t offset(uint32_t id) const
+    {
+        return starts[id];
+    }
+
+    const std::string &data() const
+    {
+        return bytes;
+    }
+
+    size_t memoryBytes() const
+    {
+        return bytes.capacity() + (starts.capacity() + slots.capacity()) * sizeof(uint32_t);
+    }
+};
+
+// Every scanned directory with its own and subtree totals, for seeing where the space goes
+// (--export-tree). Nodes are kept as a struct of arrays in breadth-first order, so the
+// children of a node are contiguous and always come after it, and names are IDs into a
+// shared pool instead of strings: about 50 bytes per directory plus its distinct names
+class DirectoryTree
+{
+public:
+    static constexpr uint32_t NO_PARENT = std::numeric_limits<uint32_t>::max();
+
+    // Directories one scan worker has read, linked to parents that any worker may hold;
+    // a reference is the worker in the top 16 bits and the index in its part below
+    class Part
+    {
+    private:
+        friend class DirectoryTree;
+
+        std::vector<uint64_t> parents;
+        std::vector<uint32_t> nameEnds;
+        std::string names;
+        std::vector<uint64_t> files;
+        std::vector<uint64_t> sizes;
+        uint64_t worker = 0;
+
+    public:
+        static constexpr uint64_t NONE = ~uint64_t(0);
+
+        explicit Part(size_t worker = 0) : worker(static_cast<uint64_t>(worker) << 48) {}
+
+        // Record a directory as it is read; returns its reference
+        uint64_t add(uint64_t parent, std::string_view name)
+        {
+            parents.push_back(parent);
+            names.append(name.data(), name.size());
+            nameEnds.push_back(static_cast<uint32_t>(names.size()));
+            files.push_back(0);
+            sizes.push_back(0);
+            return worker | (parents.size() - 1);
+        }
+
+        void setTotals(uint64_t ref, uint64_t fileCount, uint64_t bytes)
+        {
+            const size_t index = ref & ((uint64_t(1) << 48) - 1);
+            files[index] = fileCount;
+            sizes[index] = bytes;
+        }
+    };
+
+private:
+    std::vector<uint32_t> parentIndex;
+    std::vector<uint32_t> firstChildIndex;
+    std::vector<uint32_t> childCounts;
+    std::vector<uint32_t> nameIds;
+    std::vector<uint64_t> ownFiles;
+    std::vector<uint64_t> ownSizes;
+    std::vector<uint64_t> subtreeFileCounts;
+    std::vector<uint64_t> subtreeSizes;
+    NamePool names;
+
+    void clearNodes()
+    {
+        for (auto *column : {&parentIndex, &firstChildIndex, &childCounts, &nameIds})
+        {
+            column->clear();
+            column->shrink_to_fit();
+        }
+        for (auto *column : {&ownFiles, &ownSizes, &subtreeFileCounts, &subtreeSizes})
+        {
+            column->clear();
+            column->shrink_to_fit();
+        }
+    }
+
+    void reserveNodes(size_t count)
+    {
+        for (auto *column : {&parentIndex, &firstChildIndex, &childCounts, &nameIds})
+        {
+            column->reserve(count);
+        }
+        for (auto *column : {&ownFiles, &ownSizes})
+        {
+            column->reserve(count);
+        }
+    }
+
+public:
+    // Link the parts of all workers into one tree, children ordered by name, and roll the
+    // totals up in a single pass from the last node to the first. Frees the parts
+    void build(std::vector<Part> &parts)
+    {
+        std::vector<size_t> base(parts.size() + 1, 0);
+        for (size_t worker = 0; worker < parts.size(); worker++)
+        {
+            base[worker + 1] = base[worker] + parts[worker].parents.size();
+        }
+        const size_t count = base.back();
+        if (count >= NO_PARENT)
+        {
+            throw std::overflow_error("Too many directories for the directory tree");
+        }
+        names = NamePool();
+
+        // Scan order: global index = worker base + index in the worker's part
+        std::vector<uint32_t> parent(count);
+        std::vector<uint32_t> name(count);
+        std::vector<uint64_t> files(count);
+        std::vector<uint64_t> sizes(count);
+        uint32_t root = NO_PARENT;
+        for (size_t worker = 0; worker < parts.size(); worker++)
+        {
+            Part &part = parts[worker];
+            uint32_t start = 0;
+            for (size_t i = 0; i < part.parents.size(); i++)
+            {
+                const uint32_t index = static_cast<uint32_t>(base[worker] + i);
+                const uint64_t ref = part.parents[i];
+                parent[index] = ref == Part::NONE ? NO_PARENT
+                                                  : static_cast<uint32_t>(base[ref >> 48] + (ref & ((uint64_t(1) << 48) - 1)));
+                if (ref == Part::NONE)
+                {
+                    root = index;
+                }
+                name[index] = names.intern(std::string_view(part.names).substr(start, part.nameEnds[i] - start));
+                start = part.nameEnds[i];
+                files[index] = part.files[i];
+                sizes[index] = part.sizes[i];
+            }
+            part = Part();
+        }
+        clearNodes();
+        if (root == NO_PARENT)
+        {
+            return;
+        }
+
+        // Children of every node, grouped by parent (counting sort) and ordered by name
+        std::vector<uint32_t> childStart(count + 1, 0);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (parent[i] != NO_PARENT)
+            {
+                childStart[parent[i] + 1]++;
+            }
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            childStart[i + 1] += childStart[i];
+        }
+        std::vector<uint32_t> children(count);
+        {
+            std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                if (parent[i] != NO_PARENT)
+                {
+                    children[fill[parent[i]]++] = i;
+                }
+            }
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            std::sort(children.begin() + childStart[i], children.begin() + childStart[i + 1], [&](uint32_t a, uint32_t b)
+                      { return names.name(name[a]) < names.name(name[b]); });
+        }
+
+        // Lay the nodes out breadth-first
+        std::vector<uint32_t> order;
+        order.reserve(count);
+        order.push_back(root);
+        reserveNodes(count);
+        for (size_t next = 0; next < order.size(); next++)
+        {
+            const uint32_t node = order[next];
+            const uint32_t first = static_cast<uint32_t>(order.size());
+            order.insert(order.end(), children.begin() + childStart[node], children.begin() + childStart[node + 1]);
+            parentIndex.push_back(NO_PARENT); // filled in by the parent below
+            firstChildIndex.push_back(first);
+            childCounts.push_back(childStart[node + 1] - childStart[node]);
+            nameIds.push_back(name[node]);
+            ownFiles.push_back(files[node]);
+            ownSizes.push_back(sizes[node]);
+        }
+        for (uint32_t i = 0; i < order.size(); i++)
+        {
+            for (uint32_t child = firstChildIndex[i]; child < firstChildIndex[i] + childCounts[i]; child++)
+            {
+                parentIndex[child] = i;
+            }
+        }
+
+        // Post-order rollup: in breadth-first order every child comes after its parent
+        subtreeFileCounts = ownFiles;
+        subtreeSizes = ownSizes;
+        for (size_t i = order.size(); i-- > 1;)
+        {
+            subtreeFileCounts[parentIndex[i]] += subtreeFileCounts[i];
+            subtreeSizes[parentIndex[i]] += subtreeSizes[i];
+        }
+    }
+
+    // Number of directories; the root is node 0
+    size_t size() const
+    {
+        return nameIds.size();
+    }
+
+    bool empty() const
+    {
+        return nameIds.empty();
+    }
+
+    uint32_t parent(uint32_t node) const
+    {
+        return parentIndex[node];
+    }
+
+    // Children of node are firstChild(node) up to firstChild(node) + childCount(node)
+    uint32_t firstChild(uint32_t node) const
+    {
+        return firstChildIndex[node];
+    }
+
+    uint32_t childCount(uint32_t node) const
+    {
+        return childCounts[node];
+    }
+
+    // Name within its parent; the root's name is the scanned path
+    std::string_view name(uint32_t node) const
+    {
+        return names.name(nameIds[node]);
+    }
+
+    uint64_t files(uint32_t node) const
+    {
+        return ownFiles[node];
+    }
+
+    uint64_t bytes(uint32_t node) const
+    {
+        return ownSizes[node];
+    }
+
+    uint64_t subtreeFiles(uint32_t node) const
+    {
+        return subtreeFileCounts[node];
+    }
+
+    uint64_t subtreeBytes(uint32_t node) const
+    {
+        return subtreeSizes[node];
+    }
+
+    std::string path(uint32_t node) const
+    {
+        std::vector<std::string_view> parts;
+        for (; node != NO_PARENT; node = parentIndex[node])
+        {
+            parts.push_back(name(node));
+        }
+        std::string result;
+        for (size_t i = parts.size(); i-- > 0;)
+        {
+            if (!result.empty() && result.back() != '/')
+            {
+                result += '/';
+            }
+            result.append(parts[i].data(), parts[i].size());
+        }
+        return result;
+    }
+
+    // Offset of a node's name in namePool(), for writing the tree out
+    uint32_t nameOffset(uint32_t node) const
+    {
+        return names.offset(nameIds[node]);
+    }
+
+    const std::string &namePool() const
+    {
+        return names.data();
+    }
+
+    size_t memoryBytes() const
+    {
+        return (parentIndex.capacity() + firstChildIndex.capacity() + childCounts.capacity() + nameIds.capacity()) * sizeof(uint32_t) +
+               (ownFiles.capacity() + ownSizes.capacity() + subtreeFileCounts.capacity() + subtreeSizes.capacity()) * sizeof(uint64_t) +
+               names.memoryBytes();
+    }
+};
+
+// Per-type and per-directory totals kept current from filesystem events (--watch). Every
+// reported file is remembered with its size and type, so a change is applied as a delta to
+// its type in constant time and to the subtree totals of its directory and each directory
+// above it, without reading anything else
+class LiveTotals
+{
+public:
+    struct TypeTotals
+    {
+        uint64_t count = 0;
+        uint64_t size = 0;
+    };
+
+private:
+    struct File
+    {
+        uint64_t size;
+        uint32_t type;
+    };
+
+    // Directories are linked to their parent, so a directory seen before its parent (workers
+    // merge in any order) creates the parent as a placeholder until the scan reports it
+    struct Directory
+    {
+        const std::string *path = nullptr; // the key in directories
+        Directory *parent = nullptr;
+        std::vector<Directory *> children;
+        size_t slot = 0;    // index in parent->children
+        bool known = false; // reported by a scan, not just an ancestor of one
+        uint64_t subtreeFiles = 0;
+        uint64_t subtreeBytes = 0;
+        std::unordered_map<std::string, File> entries;
+    };
+
+    std::unordered_map<std::string, Directory> directories;
+    size_t knownDirectories = 0;
+    TypeTable types;
+    std::vector<TypeTotals> typeTotals;
+    uint64_t totalFiles = 0;
+    uint64_t totalSize = 0;
+    std::vector<std::string> added; // directories registered since takeAdded()
+
+    // "dir/" and "dir" are the same directory; the root "/" keeps its slash
+    static std::string_view trimmed(std::string_view path)
+    {
+        while (path.size() > 1 && path.back() == '/')
+        {
+            path.remove_suffix(1);
+        }
+        return path;
+    }
+
+    // The directory above path, or empty at the top of the path
+    static std::string_view parentOf(std::string_view path)
+    {
+        const size_t slash = path.rfind('/');
+        if (path.size() <= 1 || slash == std::string_view::npos)
+        {
+            return {};
+        }
+        return trimmed(path.substr(0, std::max<size_t>(slash, 1)));
+    }
+
+    // The directory at a trimmed path, created with its missing ancestors
+    Directory &directory(std::string_view path)
+    {
+        const auto [it, inserted] = directories.try_emplace(std::string(path));
+        Directory &dir = it->second;
+        if (inserted)
+        {
+            dir.path = &it->first;
+            const std::string_view parent = parentOf(path);
+            if (!parent.empty())
+            {
+                dir.parent = &directory(parent);
+                dir.slot = dir.parent->children.size();
+                dir.parent->children.push_back(&dir);
+            }
+        }
+        return dir;
+    }
+
+    Directory &known(std::string_view path)
+    {
+        Directory &dir = directory(path);
+        if (!dir.known)
+        {
+            dir.known = true;
+            knownDirectories++;
+            added.push_back(*dir.path);
+        }
+        return dir;
+    }
+
+    const Directory *find(const std::string &path) const
+    {
+        const auto it = directories.find(std::string(trimmed(path)));
+        return it == directories.end() ? nullptr : &it->second;
+    }
+
+    Directory *find(const std::string &path)
+    {
+        const auto it = directories.find(std::string(trimmed(path)));
+        return it == directories.end() ? nullptr : &it->second;
+    }
+
+    // Add (files, bytes) to the subtree totals of from and every directory above it
+    static void propagate(Directory *from, int64_t files, int64_t bytes)
+    {
+        for (Directory *dir = from; dir; dir = dir->parent)
+        {
+            dir->subtreeFiles += static_cast<uint64_t>(files);
+            dir->subtreeBytes += static_cast<uint64_t>(bytes);
+        }
+    }
+
+    void account(const File &file, bool adding)
+    {
+        TypeTotals &type = typeTotals[file.type];
+        if (adding)
+        {
+            type.count++;
+            type.size += file.size;
+            totalFiles++;
+            totalSize += file.size;
+        }
+        else
+        {
+            type.count--;
+            type.size -= file.size;
+            totalFiles--;
+            totalSize -= file.size;
+        }
+    }
+
+    void account(Directory &directory, const File &file, bool adding)
+    {
+        account(file, adding);
+        const int64_t size = static_cast<int64_t>(file.size);
+        propagate(&directory, adding ? 1 : -1, adding ? size : -size);
+    }
+
+public:
+    LiveTotals() = default;
+    // Directories point into the map, which a move keeps but a copy would not
+    LiveTotals(const LiveTotals &) = delete;
+    LiveTotals &operator=(const LiveTotals &) = delete;
+    LiveTotals(LiveTotals &&) = default;
+    LiveTotals &operator=(LiveTotals &&) = default;
+
+    void addDirectory(std::string_view path)
+    {
+        known(trimmed(path));
+    }
+
+    bool hasDirectory(const std::string &path) const
+    {
+        const Directory *dir = find(path);
+        return dir && dir->known;
+    }
+
+    // Directories added since the last call, to be watched
+    std::vector<std::string> takeAdded()
+    {
+        return std::exchange(added, {});
+    }
+
+    // Add a file, or replace what was known about it
+    void setFile(std::string_view directory, std::string_view name, std::string_view fileType, uint64_t size)
+    {
+        Directory &dir = known(trimmed(directory));
+        const uint32_t type = types.intern(fileType);
+        if (type >= typeTotals.size())
+        {
+            typeTotals.resize(type + 1);
+        }
+        const auto entry = dir.entries.try_emplace(std::string(name), File{size, type});
+        if (!entry.second)
+        {
+            account(dir, entry.first->second, false);
+            entry.first->second = File{size, type};
+        }
+        account(dir, entry.first->second, true);
+    }
+
+    void removeFile(const std::string &directory, const std::string &name)
+    {
+        Directory *dir = find(directory);
+        if (!dir)
+        {
+            return;
+        }
+        const auto entry = dir->entries.find(name);
+        if (entry != dir->entries.end())
+        {
+            account(*dir, entry->second, false);
+            dir->entries.erase(entry);
+        }
+    }
+
+    // Forget a directory and everything beneath it; returns the directories removed. The
+    // directories above lose its subtree totals at once, then only the subtree is visited
+    std::vector<std::string> removeSubtree(const std::string &path)
+    {
+        std::vector<std::string> removed;
+        Directory *top = find(path);
+        if (!top)
+        {
+            return removed;
+        }
+        propagate(top->parent, -static_cast<int64_t>(top->subtreeFiles), -static_cast<int64_t>(top->subtreeBytes));
+        if (Directory *parent = top->parent)
+        {
+            Directory *last = parent->children.back();
+            last->slot = top->slot;
+            parent->children[top->slot] = last;
+            parent->children.pop_back();
+        }
+
+        std::vector<Directory *> pending = {top};
+        while (!pending.empty())
+        {
+            Directory *dir = pending.back();
+            pending.pop_back();
+            pending.insert(pending.end(), dir->children.begin(), dir->children.end());
+            for (const auto &entry : dir->entries)
+            {
+                account(entry.second, false);
+            }
+            const std::string key = *dir->path;
+            if (dir->known)
+            {
+                knownDirectories--;
+                removed.push_back(key);
+            }
+            directories.erase(key);
+        }
+        return removed;
+    }
+
+    void clear()
+    {
+        *this = LiveTotals();
+    }
+
+    // Files and bytes in a directory and all directories beneath it; false if the
+    // directory is not known
+    bool subtree(const std::string &path, uint64_t &files, uint64_t &bytes) const
+    {
+        files = 0;
+        bytes = 0;
+        const Directory *dir = find(path);
+        if (!dir || !dir->known)
+        {
+            return false;
+        }
+        files = dir->subtreeFiles;
+        bytes = dir->subtreeBytes;
+        return true;
+    }
+
+    uint64_t files() const
+    {
+        return totalFiles;
+    }
+
+    uint64_t bytes() const
+    {
+        return totalSize;
+    }
+
+    size_t directoryCount() const
+    {
+        return knownDirectories;
+    }
+
+    // Visit every type that has files as (name, totals)
+    template <typename Visitor>
+    void forEachType(Visitor visitor) const
+    {
+        for (uint32_t id = 0; id < typeTotals.size(); id++)
+        {
+            if (typeTotals[id].count > 0)
+            {
+                visitor(types.name(id), typeTotals[id]);
+            }
+        }
+    }
+};
+
+// A reported file as seen by scan aggregators. The full path is only built on request, in a
+// per-worker buffer that the next call overwrites, so aggregators that don't need it pay nothing
+struct FileEvent
+{
+    std::string_view directory;
+    std::string_view name;
+    std::string_view type;
+    uint64_t size;
+    uint64_t allocated;
+    uint64_t device;
+    uint64_t inode;
+    std::string *scratch;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    int64_t mtimeNs = 0;
+    int64_t atimeNs = 0;
+    uint16_t depth = 0; // of the directory below the scan root, 0 at the root
+
+    const std::string &path() const
+    {
+        return buildChildPath(*scratch, directory, name);
+    }
+};
+
+// No-op hooks for scan aggregators. An aggregator keeps its options and merged result, and
+// hands each scan worker a private State; the hooks are const so workers never share writes.
+// onFile sees every file that passes the filters and is not hidden, onDirectory every
+// directory once its whole subtree is scanned (only when some aggregator wantsDirectories()),
+// merge folds a worker's state in after the scan and finish runs once everything is merged
+struct AggregatorBase
+{
+    struct State
+    {
+    };
+
+    bool wantsFiles() const
+    {
+        return false;
+    }
+
+    bool wantsDirectories() const
+    {
+        return false;
+    }
+
+    template <typename State>
+    void onFile(State &, const FileEvent &) const
+    {
+    }
+
+    template <typename State>
+    void onDirectory(State &, std::string_view, uint64_t) const
+    {
+    }
+
+    template <typename State>
+    void merge(State &)
+    {
+    }
+
+    void finish(size_t)
+    {
+    }
+};
+
+// A fixed list of aggregators, dispatched statically: every hook expands to a direct call
+// on each part, so a hook that is a no-op for an aggregator compiles to nothing
+template <typename... Parts>
+class Aggregators
+{
+private:
+    std::tuple<Parts...> parts;
+
+    template <size_t... I>
+    bool anyWantsFiles(std::index_sequence<I...>) const
+    {
+        return (false || ... || std::get<I>(parts).wantsFiles());
+    }
+
+    template <size_t... I>
+    bool anyWantsDirectories(std::index_sequence<I...>) const
+    {
+        return (false || ... || std::get<I>(parts).wantsDirectories());
+    }
+
+    template <typename StateTuple, size_t... I>
+    void fileEach(StateTuple &state, const FileEvent &event, std::index_sequence<I...>) const
+    {
+        (std::get<I>(parts).onFile(std::get<I>(state), event), ...);
+    }
+
+    template <typename StateTuple, size_t... I>
+    void directoryEach(StateTuple &state, [[maybe_unused]] std::string_view path, [[maybe_unused]] uint64_t size,
+                       std::index_sequence<I...>) const
+    {
+        (std::get<I>(parts).onDirectory(std::get<I>(state), path, size), ...);
+    }
+
+    template <typename StateTuple, size_t... I>
+    void mergeEach(StateTuple &state, std::index_sequence<I...>)
+    {
+        (std::get<I>(parts).merge(std::get<I>(state)), ...);
+    }
+
+    template <size_t... I>
+    void finishEach([[maybe_unused]] size_t jobs, std::index_sequence<I...>)
+    {
+        (std::get<I>(parts).finish(jobs), ...);
+    }
+
+public:
+    using State = std::tuple<typename Parts::State...>;
+
+    template <typename Part>
+    Part &get()
+    {
+        return std::get<Part>(parts);
+    }
+
+    template <typename Part>
+    const Part &get() const
+    {
+        return std::get<Part>(parts);
+    }
+
+    bool wantsFiles() const
+    {
+        return anyWantsFiles(std::index_sequence_for<Parts...>());
+    }
+
+    bool wantsDirectories() const
+    {
+        return anyWantsDirectories(std::index_sequence_for<Parts...>());
+    }
+
+    State makeState() const
+    {
+        return std::apply([](const Parts &...part)
+                          { return State(part.makeState()...); },
+                          parts);
+    }
+
+    void onFile(State &state, const FileEvent &event) const
+    {
+        fileEach(state, event, std::index_sequence_for<Parts...>());
+    }
+
+    void onDirectory(State &state, std::string_view path, uint64_t size) const
+    {
+        directoryEach(state, path, size, std::index_sequence_for<Parts...>());
+    }
+
+    void merge(State &state)
+    {
+        mergeEach(state, std::index_sequence_for<Parts...>());
+    }
+
+    void finish(size_t jobs)
+    {
+        finishEach(jobs, std::index_sequence_for<Parts...>());
+    }
+};
+
+// The N largest files (--top-files)
+class TopFilesAggregator : public AggregatorBase
+{
+private:
+    TopList top;
+
+public:
+    using State = TopList;
+
+    void setLimit(size_t count)
+    {
+        top.setLimit(count);
+    }
+
+    bool wantsFiles() const
+    {
+        return top.enabled();
+    }
+
+    State makeState() const
+    {
+        State state;
+        state.setLimit(top.limitCount());
+        return state;
+    }
+
+    void onFile(State &state, const FileEvent &event) const
+    {
+        if (state.accepts(event.size))
+        {
+            state.offer(event.size, event.path());
+        }
+    }
+
+    void merge(State &state)
+    {
+        top.merge(state);
+    }
+
+    const TopList &result() const
+    {
+        return top;
+    }
+};
+
+// The N largest directories by subtree size (--top-dirs)
+class TopDirsAggregator : public AggregatorBase
+{
+private:
+    TopList top;
+
+public:
+    using State = TopList;
+
+    void setLimit(size_t count)
+    {
+        top.setLimit(count);
+    }
+
+    bool wantsDirectories() const
+    {
+        return top.enabled();
+    }
+
+    State makeState() const
+    {
+        State state;
+        state.setLimit(top.limitCount());
+        return state;
+    }
+
+    void onDirectory(State &state, std::string_view path, uint64_t size) const
+    {
+        state.offer(size, path);
+    }
+
+    void merge(State &state)
+    {
+        top.merge(state);
+    }
+
+    const TopList &result() const
+    {
+        return top;
+    }
+};
+
+// Groups of files with identical contents (--find-duplicates); workers only collect
+// candidates, the staged search runs once after the scan
+class DuplicateAggregator : public AggregatorBase
+{
+private:
+    bool enabled = false;
+    std::vector<DuplicateCandidate> candidates;
+    std::vector<DuplicateFinder::Group> duplicateGroups;
+    DuplicateFinder::Stats duplicateStats;
+
+public:
+    using State = std::vector<DuplicateCandidate>;
+
+    void setEnabled(bool enable)
+    {
+#ifndef __linux__
+        if (enable)
+        {
+            throw std::runtime_error("Duplicate search is only supported on Linux");
+        }
+#endif
+        enabled = enable;
+    }
+
+    bool isEnabled() const
+    {
+        return enabled;
+    }
+
+    bool wantsFiles() const
+    {
+        return enabled;
+    }
+
+    State makeState() const
+    {
+        return State();
+    }
+
+    void onFile(State &state, const FileEvent &event) const
+    {
+        if (enabled)
+        {
+            state.push_back({event.size, event.device, event.inode, event.path()});
+        }
+    }
+
+    void merge(State &state)
+    {
+        std::move(state.begin(), state.end(), std::back_inserter(candidates));
+        state = State();
+    }
+
+    void finish(size_t jobs)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        DuplicateFinder finder(jobs);
+        duplicateGroups = finder.find(candidates);
+        duplicateStats = finder.lastStats();
+        candidates = std::vector<DuplicateCandidate>();
+    }
+
+    const std::vector<DuplicateFinder::Group> &groups() const
+    {
+        return duplicateGroups;
+    }
+
+    const DuplicateFinder::Stats &stats() const
+    {
+        return duplicateStats;
+    }
+};
+
+// Streams one CSV row per reported file (path, type, size, allocated size) or per finished
+// directory (path, subtree size) while the scan runs. Each worker formats rows into its own
+// buffer and submits it to the AsyncWriter when full, so rows reach the file during the scan
+class ExportAggregator : public AggregatorBase
+{
+private:
+    std::unique_ptr<AsyncWriter> files = std::make_unique<AsyncWriter>();
+    std::unique_ptr<AsyncWriter> dirs = std::make_unique<AsyncWriter>();
+    size_t fileRows = 0;
+    size_t dirRows = 0;
+
+public:
+    struct State
+    {
+        AsyncWriter *files = nullptr; // null unless that export is open
+        AsyncWriter *dirs = nullptr;
+        std::string fileBuffer;
+        std::string dirBuffer;
+        size_t fileRows = 0;
+        size_t dirRows = 0;
+    };
+
+    // Export files to filename, compressed as its extension says (.gz, .zst)
+    void setFileOutput(const std::string &filename)
+    {
+        files->open(filename, compressionFor(filename));
+        std::string header = "Path,FileType,Size,AllocatedSize\n";
+        files->submit(header);
+    }
+
+    void setDirectoryOutput(const std::string &filename)
+    {
+        dirs->open(filename, compressionFor(filename));
+        std::string header = "Path,SubtreeSize\n";
+        dirs->submit(header);
+    }
+
+    bool wantsFiles() const
+    {
+        return files->isOpen();
+    }
+
+    bool wantsDirectories() const
+    {
+        return dirs->isOpen();
+    }
+
+    State makeState() const
+    {
+        State state;
+        state.files = files->isOpen() ? files.get() : nullptr;
+        state.dirs = dirs->isOpen() ? dirs.get() : nullptr;
+        return state;
+    }
+
+    void onFile(State &state, const FileEvent &event) const
+    {
+        if (!state.files)
+        {
+            return;
+        }
+        std::string &row = state.fileBuffer;
+        appendCsvField(row, event.path());
+        row += ',';
+        appendCsvField(row, event.type);
+        row += ',';
+        appendCsvNumber(row, event.size);
+        row += ',';
+        appendCsvNumber(row, event.allocated);
+        row += '\n';
+        state.fileRows++;
+        if (row.size() >= AsyncWriter::BUFFER_BYTES)
+        {
+            state.files->submit(row);
+        }
+    }
+
+    void onDirectory(State &state, std::string_view path, uint64_t size) const
+    {
+        if (!state.dirs)
+        {
+            return;
+        }
+        std::string &row = state.dirBuffer;
+        appendCsvField(row, path);
+        row += ',';
+        appendCsvNumber(row, size);
+        row += '\n';
+        state.dirRows++;
+        if (row.size() >= AsyncWriter::BUFFER_BYTES)
+        {
+            state.dirs->submit(row);
+        }
+    }
+
+    void merge(State &state)
+    {
+        if (files->isOpen())
+        {
+            files->submit(state.fileBuffer);
+        }
+        if (dirs->isOpen())
+        {
+            dirs->submit(state.dirBuffer);
+        }
+        fileRows += state.fileRows;
+        dirRows += state.dirRows;
+    }
+
+    void finish(size_t)
+    {
+        files->close();
+        dirs->close();
+    }
+
+    size_t filesExported() const
+    {
+        return fileRows;
+    }
+
+    size_t directoriesExported() const
+    {
+        return dirRows;
+    }
+};
+
+// Collects every reported file and every directory into LiveTotals, so that --watch can keep
+// them current afterwards. Workers record the files of each directory they scan as one group
+class LiveAggregator : public AggregatorBase
+{
+private:
+    bool enabled = false;
+    LiveTotals live;
+
+public:
+    struct File
+    {
+        std::string name;
+        std::string type;
+        uint64_t size;
+    };
+
+    struct State
+    {
+        std::vector<std::string> directories;
+        std::vector<std::pair<std::string, std::vector<File>>> groups; // files by directory
+    };
+
+    void setEnabled(bool enable)
+    {
+        enabled = enable;
+    }
+
+    bool isEnabled() const
+    {
+        return enabled;
+    }
+
+    bool wantsFiles() const
+    {
+        return enabled;
+    }
+
+    bool wantsDirectories() const
+    {
+        return enabled;
+    }
+
+    State makeState() const
+    {
+        return State();
+    }
+
+    void onFile(State &state, const FileEvent &event) const
+    {
+        if (state.groups.empty() || state.groups.back().first != event.directory)
+        {
+            state.groups.emplace_back(std::string(event.directory), std::vector<File>());
+        }
+        state.groups.back().second.push_back({std::string(event.name), std::string(event.type), event.size});
+    }
+
+    void onDirectory(State &state, std::string_view path, uint64_t) const
+    {
+        state.directories.emplace_back(path);
+    }
+
+    void merge(State &state)
+    {
+        for (const auto &path : state.directories)
+        {
+            live.addDirectory(path);
+        }
+        for (const auto &[directory, files] : state.groups)
+        {
+            for (const auto &file : files)
+            {
+                live.setFile(directory, file.name, file.type, file.size);
+            }
+        }
+        state = State();
+    }
+
+    LiveTotals &totals()
+    {
+        return live;
+    }
+
+    const LiveTotals &totals() const
+    {
+        return live;
+    }
+};
+
+// Dimensions of a --group-by rollup
+enum class GroupDimension : uint8_t
+{
+    Uid,
+    Gid,
+    Age,   // age bucket of the modification time
+    Atime, // age bucket of the access time
+    Depth, // of the file's directory below the scan root
+    Ext,   // file type, as in the main report
+};
+
+struct GroupDimensionInfo
+{
+    GroupDimension dimension;
+    const char *name;
+    unsigned bits; // width of the dimension's field in a composite key
+};
+
+const GroupDimensionInfo GROUP_DIMENSIONS[] = {
+    {GroupDimension::Uid, "uid", 32},
+    {GroupDimension::Gid, "gid", 32},
+    {GroupDimension::Age, "age", 2},
+    {GroupDimension::Atime, "atime", 2},
+    {GroupDimension::Depth, "depth", 16},
+    {GroupDimension::Ext, "ext", 32},
+};
+
+// Age buckets of the age and atime dimensions, by time before the scan started; files
+// dated in the future count as new
+const std::pair<const char *, int64_t> AGE_BUCKETS[] = {
+    {"<7d", 7},
+    {"<30d", 30},
+    {"<1y", 365},
+    {"older", 0},
+};
+
+inline const GroupDimensionInfo &groupDimensionInfo(GroupDimension dimension)
+{
+    return GROUP_DIMENSIONS[static_cast<size_t>(dimension)];
+}
+
+// Parse a comma-separated --group-by list such as "uid,age,ext"
+inline std::vector<GroupDimension> parseGroupBy(const std::string &list)
+{
+    std::vector<GroupDimension> dimensions;
+    std::istringstream names(list);
+    std::string name;
+    while (std::getline(names, name, ','))
+    {
+        const auto known = std::find_if(std::begin(GROUP_DIMENSIONS), std::end(GROUP_DIMENSIONS), [&name](const GroupDimensionInfo &info)
+                                        { return name == info.name; });
+        if (known == std::end(GROUP_DIMENSIONS))
+        {
+            throw std::runtime_error("Unknown group-by dimension: " + name + " (expected uid, gid, age, atime, depth or ext)");
+        }
+        if (std::find(dimensions.begin(), dimensions.end(), known->dimension) != dimensions.end())
+        {
+            throw std::runtime_error("Group-by dimension given twice: " + name);
+        }
+        dimensions.push_back(known->dimension);
+    }
+    if (dimensions.empty())
+    {
+        throw std::runtime_error("Group-by needs at least one dimension");
+    }
+    return dimensions;
+}
+
+// Totals per composite key of a --group-by rollup. Every dimension of a file is packed into
+// a fixed-width field of a 128-bit key (all six dimensions take 116 bits), and the keys live
+// in an open-addressing table, so adding a file to a group that exists never allocates
+class GroupTable
+{
+public:
+    struct Key
+    {
+        uint64_t low = 0;
+        uint64_t high = 0;
+
+        bool operator==(const Key &other) const
+        {
+            return low == other.low && high == other.high;
+        }
+
+        // Append a field of bits at offset, which then moves past it
+        void put(uint64_t value, unsigned bits, unsigned &offset)
+        {
+            value &= bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+            if (offset < 64)
+            {
+                low |= value << offset;
+                if (offset + bits > 64)
+                {
+                    high |= value >> (64 - offset);
+                }
+            }
+            else
+            {
+                high |= value << (offset - 64);
+            }
+            offset += bits;
+        }
+
+        uint64_t get(unsigned bits, unsigned &offset) const
+        {
+            uint64_t value;
+            if (offset < 64)
+            {
+                value = low >> offset;
+                if (offset + bits > 64)
+                {
+                    value |= high << (64 - offset);
+                }
+            }
+            else
+            {
+                value = high >> (offset - 64);
+            }
+            offset += bits;
+            return value & (bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1);
+        }
+    };
+
+    struct Totals
+    {
+        uint64_t files = 0;
+        uint64_t size = 0;
+        uint64_t allocated = 0;
+    };
+
+private:
+    std::vector<Key> keys;
+    std::vector<Totals> totals;
+    std::vector<uint32_t> slots; // index + 1, 0 marks an empty slot
+    size_t mask = 0;
+
+    // splitmix64 finalizer over both words
+    static uint64_t hash(const Key &key)
+    {
+        uint64_t h = key.low ^ (key.high * 0x9e3779b97f4a7c15ULL);
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+
+    void rehash(size_t capacity)
+    {
+        slots.assign(capacity, 0);
+        mask = capacity - 1;
+        for (uint32_t i = 0; i < keys.size(); i++)
+        {
+            size_t slot = hash(keys[i]) & mask;
+            while (slots[slot] != 0)
+            {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = i + 1;
+        }
+    }
+
+public:
+    // Totals of a key, added on first sight
+    Totals &at(const Key &key)
+    {
+        if (slots.empty())
+        {
+            rehash(64);
+        }
+        size_t slot = hash(key) & mask;
+        while (slots[slot] != 0)
+        {
+            if (keys[slots[slot] - 1] == key)
+            {
+                return totals[slots[slot] - 1];
+            }
+            slot = (slot + 1) & mask;
+        }
+        keys.push_back(key);
+        totals.emplace_back();
+        slots[slot] = static_cast<uint32_t>(keys.size());
+        if (keys.size() * 2 > slots.size())
+        {
+            rehash(slots.size() * 2);
+        }
+        return totals.back();
+    }
+
+    size_t size() const
+    {
+        return keys.size();
+    }
+
+    const Key &key(size_t i) const
+    {
+        return keys[i];
+    }
+
+    const Totals &totalsAt(size_t i) const
+    {
+        return totals[i];
+    }
+};
+
+// Files and bytes per combination of owner, age, depth and type (--group-by), for
+// chargeback. Everything comes from the metadata the scan already has for each file's size.
+// Workers intern the types they see in a table of their own, so a type costs an allocation
+// only on a worker's first sighting of it; merge() translates those IDs
+class GroupByAggregator : public AggregatorBase
+{
+public:
+    struct Group
+    {
+        std::array<uint64_t, std::size(GROUP_DIMENSIONS)> values{}; // per dimension; ext is an index into typeName()
+        GroupTable::Totals totals;
+    };
+
+    struct State
+    {
+        int64_t nowNs = 0;
+        TypeTable types;
+        GroupTable groups;
+    };
+
+private:
+    std::vector<GroupDimension> dimensions;
+    TypeTable types;
+    GroupTable merged;
+    std::vector<Group> sortedGroups;
+
+    static uint64_t ageBucket(int64_t nowNs, int64_t timeNs)
+    {
+        const int64_t days = (nowNs - timeNs) / (86400 * int64_t(1000000000));
+        uint64_t bucket = 0;
+        while (bucket + 1 < std::size(AGE_BUCKETS) && days >= AGE_BUCKETS[bucket].second)
+        {
+            bucket++;
+        }
+        return bucket;
+    }
+
+    GroupTable::Key encode(const Group &group) const
+    {
+        GroupTable::Key key;
+        unsigned offset = 0;
+        for (size_t i = 0; i < dimensions.size(); i++)
+        {
+            key.put(group.values[i], groupDimensionInfo(dimensions[i]).bits, offset);
+        }
+        return key;
+    }
+
+    Group decode(const GroupTable::Key &key) const
+    {
+        Group group;
+        unsigned offset = 0;
+        for (size_t i = 0; i < dimensions.size(); i++)
+        {
+            group.values[i] = key.get(groupDimensionInfo(dimensions[i]).bits, offset);
+        }
+        return group;
+    }
+
+public:
+    void setDimensions(std::vector<GroupDimension> list)
+    {
+        dimensions = std::move(list);
+    }
+
+    const std::vector<GroupDimension> &groupedBy() const
+    {
+        return dimensions;
+    }
+
+    bool wantsFiles() const
+    {
+        return !dimensions.empty();
+    }
+
+    State makeState() const
+    {
+        State state;
+        state.nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+        return state;
+    }
+
+    void onFile(State &state, const FileEvent &event) const
+    {
+        GroupTable::Key key;
+        unsigned offset = 0;
+        for (const GroupDimension dimension : dimensions)
+        {
+            uint64_t value = 0;
+            switch (dimension)
+            {
+            case GroupDimension::Uid:
+                value = event.uid;
+                break;
+            case GroupDimension::Gid:
+                value = event.gid;
+                break;
+            case GroupDimension::Age:
+                value = ageBucket(state.nowNs, event.mtimeNs);
+                break;
+            case GroupDimension::Atime:
+                value = ageBucket(state.nowNs, event.atimeNs);
+                break;
+            case GroupDimension::Depth:
+                value = event.depth;
+                break;
+            case GroupDimension::Ext:
+                value = state.types.intern(event.type);
+                break;
+            }
+            key.put(value, groupDimensionInfo(dimension).bits, offset);
+        }
+        GroupTable::Totals &totals = state.groups.at(key);
+        totals.files++;
+        totals.size += event.size;
+        totals.allocated += event.allocated;
+    }
+
+    void merge(State &state)
+    {
+        const auto ext = std::find(dimensions.begin(), dimensions.end(), GroupDimension::Ext);
+        for (size_t i = 0; i < state.groups.size(); i++)
+        {
+            Group group = decode(state.groups.key(i));
+            if (ext != dimensions.end())
+            {
+                uint64_t &type = group.values[ext - dimensions.begin()];
+                type = types.intern(state.types.name(static_cast<uint32_t>(type)));
+            }
+            const GroupTable::Totals &from = state.groups.totalsAt(i);
+            GroupTable::Totals &to = merged.at(encode(group));
+            to.files += from.files;
+            to.size += from.size;
+            to.allocated += from.allocated;
+        }
+        state = State();
+    }
+
+    // Sort the groups by size, largest first; ties are ordered by their values, types by name
+    void finish(size_t)
+    {
+        sortedGroups.clear();
+        sortedGroups.reserve(merged.size());
+        for (size_t i = 0; i < merged.size(); i++)
+        {
+            Group group = decode(merged.key(i));
+            group.totals = merged.totalsAt(i);
+            sortedGroups.push_back(group);
+        }
+        std::sort(sortedGroups.begin(), sortedGroups.end(), [this](const Group &a, const Group &b)
+                  {
+                      if (a.totals.size != b.totals.size)
+                      {
+                          return a.totals.size > b.totals.size;
+                      }
+                      for (size_t i = 0; i < dimensions.size(); i++)
+                      {
+                          if (a.values[i] != b.values[i])
+                          {
+                              return dimensions[i] == GroupDimension::Ext
+                                         ? types.name(static_cast<uint32_t>(a.values[i])) < types.name(static_cast<uint32_t>(b.values[i]))
+                                         : a.values[i] < b.values[i];
+                          }
+                      }
+                      return false; });
+        merged = GroupTable();
+    }
+
+    const std::vector<Group> &groups() const
+    {
+        return sortedGroups;
+    }
+
+    // The value of a group's i-th dimension as shown in reports: a number, an age bucket
+    // or a type
+    std::string label(const Group &group, size_t i) const
+    {
+        switch (dimensions[i])
+        {
+        case GroupDimension::Age:
+        case GroupDimension::Atime:
+            return AGE_BUCKETS[group.values[i]].first;
+        case GroupDimension::Ext:
+            return types.name(static_cast<uint32_t>(group.values[i]));
+        default:
+            return std::to_string(group.values[i]);
+        }
+    }
+};
+
+#ifdef __linux__
+// inotify watches on the directories of a tree, addressed by path. inotify does not recurse,
+// so every directory gets its own watch; events name the directory by its watch
+class TreeWatcher
+{
+public:
+    static constexpr uint32_t EVENTS = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE |
+                                       IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+    struct Event
+    {
+        std::string directory; // empty for IN_Q_OVERFLOW
+        std::string name;
+        uint32_t mask;
+    };
+
+private:
+    int fd = -1;
+    std::unordered_map<int, std::string> paths;
+    std::unordered_map<std::string, int> descriptors;
+    bool warnedLimit = false;
+
+public:
+    TreeWatcher()
+    {
+        fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot start inotify: " + std::generic_category().message(errno));
+        }
+    }
+
+    TreeWatcher(const TreeWatcher &) = delete;
+    TreeWatcher &operator=(const TreeWatcher &) = delete;
+
+    ~TreeWatcher()
+    {
+        ::close(fd);
+    }
+
+    int descriptor() const
+    {
+        return fd;
+    }
+
+    size_t size() const
+    {
+        return paths.size();
+    }
+
+    void watch(const std::string &path)
+    {
+        const int wd = ::inotify_add_watch(fd, path.c_str(), EVENTS);
+        if (wd < 0)
+        {
+            if (errno == ENOSPC && !warnedLimit)
+            {
+                warnedLimit = true;
+                printWarning("Warning: Out of inotify watches (see fs.inotify.max_user_watches); changes in " + path +
+                             " and further new directories are not seen");
+            }
+            return; // otherwise the directory is already gone again
+        }
+        paths[wd] = path;
+        descriptors[path] = wd;
+    }
+
+    void unwatch(const std::string &path)
+    {
+        const auto it = descriptors.find(path);
+        if (it != descriptors.end())
+        {
+            ::inotify_rm_watch(fd, it->second);
+            paths.erase(it->second);
+            descriptors.erase(it);
+        }
+    }
+
+    void unwatchAll()
+    {
+        for (const auto &[wd, path] : paths)
+        {
+            ::inotify_rm_watch(fd, wd);
+        }
+        paths.clear();
+        descriptors.clear();
+    }
+
+    // Drain the events that are ready, without blocking
+    std::vector<Event> read()
+    {
+        std::vector<Event> events;
+        alignas(inotify_event) char buffer[64 * 1024];
+        while (true)
+        {
+            const ssize_t got = ::read(fd, buffer, sizeof(buffer));
+            if (got <= 0)
+            {
+                if (got < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                return events;
+            }
+            for (ssize_t offset = 0; offset < got;)
+            {
+                const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    events.push_back({std::string(), std::string(), event->mask});
+                    continue;
+                }
+                const auto it = paths.find(event->wd);
+                if (it == paths.end())
+                {
+                    continue;
+                }
+                if (event->mask & IN_IGNORED) // the directory was deleted or unwatched
+                {
+                    const auto path = descriptors.find(it->second);
+                    if (path != descriptors.end() && path->second == event->wd)
+                    {
+                        descriptors.erase(path);
+                    }
+                    paths.erase(it);
+                    continue;
+                }
+                events.push_back({it->second, event->len ? std::string(event->name) : std::string(), event->mask});
+            }
+        }
+    }
+};
+#endif
+
+// A queued directory scan
+struct DirTask
+{
+    PathArena::Path path;
+    int32_t opaque = -1;      // index of the enclosing opaque directory name, -1 outside them
+    DirNode *node = nullptr; // set when directory sizes are rolled up
+    uint16_t lane = 0;        // mount the directory is on, an index into the scan's mounts
+    uint16_t depth = 0;       // below the scan root, saturating
+    uint64_t treeParent = DirectoryTree::Part::NONE; // parent's node while building the directory tree
+};
+
+// Everything one scan worker owns; nothing in here is shared with other workers
+struct WorkerContext
+{
+    std::unique_ptr<DirectoryReader> reader;
+    DirListing listing;
+    ScanTotals totals;
+    PathArena arena;
+    std::string scratchPath;
+    TypeKeyBuffer typeKey;
+    InodeSet::DeviceCache deviceCache;
+    std::vector<int32_t> filterResume; // per listing entry: where the filter continues after stat
+    std::vector<std::pair<uint64_t, uint64_t>> mountTotals; // files and bytes per mount
+    MemoryBudget::Account memory;
+    MemoryBudget::Account retained; // snapshot records and tree nodes, never limited
+    uint64_t treeNode = 0; // node of the directory being scanned in the worker's tree part
+};
+
+// Live counters of one scan worker. Each is written only by its worker (relaxed, uncontended)
+// and read by the progress reporter; the current path is the only thing behind a mutex, and
+// it is only maintained with --progress
+struct alignas(64) WorkerProgress
+{
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> dirs{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> readdirNs{0};
+    std::atomic<int64_t> statNs{0};
+    std::atomic<int64_t> aggregateNs{0};
+    std::atomic<uint64_t> operations{0};  // readdir calls and lookups, for --adaptive
+    std::atomic<int64_t> operationNs{0}; // their summed latency
+    std::atomic<int64_t> dirStartNs{0}; // 0 while idle
+    std::mutex pathMutex;
+    std::string currentPath;
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static void add(std::atomic<int64_t> &counter, int64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+// Scan progress as reported to a progress callback; rates are since the previous report
+struct ScanProgress
+{
+    uint64_t files = 0;
+    uint64_t dirs = 0;
+    uint64_t bytes = 0;
+    double filesPerSecond = 0;
+    double dirsPerSecond = 0;
+    size_t queued = 0;
+    std::string slowestPath; // directory in progress longest, empty if all workers are idle
+    double slowestSeconds = 0;
+    // Last decision of the --adaptive controller, when it runs, and the limits it works in
+    bool adaptive = false;
+    ConcurrencyController::Decision concurrency;
+    size_t maxWorkers = 0;
+    unsigned maxDepth = 0; // 1 without a backend that overlaps lookups
+};
+
+// Directory analyzer. Per-type totals are always kept, since indexes and snapshots persist
+// them; everything else is computed by Visitor, an Aggregators<...> list (or any type with
+// the same hooks) that receives each reported file and each finished directory subtree.
+// The hooks are resolved at compile time, so an unused aggregator costs nothing per file
+template <typename Visitor>
+class BasicFileAnalyzer
+{
+private:
+    ScanTotals totals;
+    ExclusionMatcher exclusions;
+    Visitor visitor;
+    std::vector<typename Visitor::State> visitorStates; // one per worker
+    std::vector<std::string> opaqueNames{".git"};
+    OpaqueMode opaqueMode = OpaqueMode::Walk;
+    ScanOrder scanOrder = ScanOrder::Readdir;
+    std::set<std::string, std::less<>> includeTypes;
+    bool showHidden = false;
+    SizeThreshold sizeThreshold;
+    FileFilter where;  // --where expressions as given
+    FileFilter filter; // where, types and size range, compiled by analyze()
+    size_t jobs = 1;
+    ScanBackend backend = defaultBackend();
+
+    // Incremental rescan state (--index)
+    std::string indexFile;
+    ScanIndex previousIndex;
+    int64_t scanStartNs = 0;
+    std::vector<SpillBuffer> indexBuffers;
+    std::vector<size_t> indexCounts;
+    std::atomic<size_t> reusedDirs{0};
+    std::atomic<size_t> rescannedDirs{0};
+
+    // Per-directory totals for snapshots (--save)
+    bool collectDirectories = false;
+    std::string scanRoot;
+    std::vector<std::vector<DirectoryRecord>> dirRecords;
+
+    // Memory accounting of the scan's growing structures (--memory-budget). Types admitted
+    // before the budget ran out are shared, so every worker keeps counting them exactly
+    MemoryBudget memory;
+    // Directory records for --save and tree nodes for --export-tree are kept until the scan
+    // ends, whatever the budget, so they are tallied apart: charging them to the budget
+    // would fold later file types into [other types] just for asking for a snapshot
+    MemoryBudget retained;
+    std::mutex admittedMutex;
+    TypeTable admittedTypes;
+
+    // Filesystem boundaries and per-mount scheduling (-x, --mount-jobs)
+    bool oneFileSystem = false;
+    uint64_t rootDevice = 0;
+    std::vector<std::pair<std::string, size_t>> mountJobs;     // user limits by mount point
+    std::vector<MountUsage> mountUsage;                        // by lane; lane 0 holds the root
+    std::vector<std::pair<std::string, uint16_t>> mountPoints; // paths of lanes 1..n as scanned, sorted
+
+    // Shards of a distributed scan (--worker): subdirectories reached once the budget is
+    // spent are handed back instead of being scanned
+    int64_t shardBudgetNs = 0;
+    int64_t deferAfterNs = 0;
+    std::vector<std::vector<std::string>> deferred; // per worker
+
+    // Directory tree (--export-tree): each worker records the directories it reads
+    bool collectTree = false;
+    std::vector<DirectoryTree::Part> treeParts;
+    DirectoryTree tree;
+
+    // Adaptive concurrency (--adaptive): -j is the maximum, and a controller thread moves the
+    // active worker count and the io_uring queue depth between 1 and their maximum
+    bool adaptive = false;
+    int64_t latencyCeilingNs = 10000000;
+    unsigned maxQueueDepth = 1;
+    std::atomic<unsigned> queueDepth{1};
+    mutable std::mutex decisionMutex;
+    ConcurrencyController::Decision lastDecision;
+
+    // Sampling scans (--estimate): the estimate behind the current results, if any
+    std::unique_ptr<TreeEstimate> lastEstimate;
+
+    // Instrumentation (--progress, --stats-json)
+    std::function<void(const ScanProgress &)> progressCallback;
+    std::chrono::milliseconds progressInterval{500};
+    std::string statsJsonFile;
+    std::vector<std::unique_ptr<WorkerProgress>> progress;
+    int64_t scanElapsedNs = 0;
+
+    // Per-type size sketches for quantiles and the size histogram (--histogram)
+    bool distributions = false;
+
+    // Hard links counted once and allocated sizes reported (--disk-usage)
+    bool diskUsage = false;
+    std::unique_ptr<InodeSet> inodes;
+
+    // Index of an opaque directory name, or -1
+    int32_t opaqueIndex(std::string_view name) const
+    {
+        for (size_t i = 0; i < opaqueNames.size(); i++)
+        {
+            if (opaqueNames[i] == name)
+            {
+                return static_cast<int32_t>(i);
+            }
+        }
+        return -1;
+    }
+
+    // Opaque directories are reported under their name, or with the hidden files if their
+    // name starts with a dot and hidden files are not shown
+    bool opaqueHidden(int32_t opaque) const
+    {
+        return !showHidden && opaqueNames[opaque][0] == '.';
+    }
+
+    // Count a newly found opaque directory as a single entry; its size accrues as its files
+    // are scanned, by whichever workers end up walking it
+    void addOpaqueDirectory(int32_t opaque, ScanTotals &target) const
+    {
+        if (opaqueHidden(opaque))
+        {
+            target.hiddenFiles++;
+        }
+        else
+        {
+            target.statsFor(opaqueNames[opaque]).addEntry();
+            target.totalFiles++;
+        }
+    }
+
+    void addOpaqueFile(int32_t opaque, size_t size, size_t allocated, ScanTotals &target) const
+    {
+        if (opaqueHidden(opaque))
+        {
+            target.hiddenSize += size;
+        }
+        else
+        {
+            FileTypeStats &stat = target.statsFor(opaqueNames[opaque]);
+            stat.addSize(size);
+            stat.allocatedSize += allocated;
+        }
+        target.totalSize += size;
+        target.allocatedSize += allocated;
+    }
+
+    // Whether a directory symlink leads back to the directory holding it or to one of the
+    // directories above it, which would make the walk loop (build/Release -> .. ). The walked
+    // path is stat'ed component by component as spelled, so ancestors reached through other
+    // symlinks are matched by the directory they resolve to. Directory symlinks are rare, so
+    // the lookups are only made for them
+    static bool leadsToAncestor(std::string_view path, uint64_t device, uint64_t inode)
+    {
+#ifdef __linux__
+        std::string ancestor(path);
+        if (ancestor.empty() || ancestor[0] != '/')
+        {
+            std::error_code ec;
+            ancestor = (fs::current_path(ec) / ancestor).string();
+        }
+        while (true)
+        {
+            struct stat st;
+            if (::stat(ancestor.c_str(), &st) == 0 && st.st_dev == device && st.st_ino == inode)
+            {
+                return true;
+            }
+            const size_t slash = ancestor.find_last_of('/');
+            if (ancestor.size() <= 1 || slash == std::string::npos)
+            {
+                break;
+            }
+            ancestor.resize(std::max<size_t>(slash, 1));
+        }
+#else
+        (void)path;
+        (void)device;
+        (void)inode;
+#endif
+        return false;
+    }
+
+    // Opaque state of a subdirectory: inherited inside an opaque tree, looked up by name outside
+    int32_t childOpaque(const DirTask &parent, std::string_view name) const
+    {
+        return parent.opaque >= 0 ? parent.opaque : opaqueIndex(name);
+    }
+
+    // Mount of a subdirectory: its own if it is a mount point, otherwise its parent's.
+    // Directory symlinks into another mount count towards the mount they are reached from
+    uint16_t childLane(uint16_t parentLane, std::string_view path) const
+    {
+        const auto it = std::lower_bound(mountPoints.begin(), mountPoints.end(), path,
+                                         [](const auto &mount, std::string_view key)
+                                         { return mount.first < key; });
+        return it != mountPoints.end() && it->first == path ? it->second : parentLane;
+    }
+
+    // Whether a type the worker does not track yet may get its own stats; charges it if so.
+    // Once the budget is spent only types some worker already tracks are admitted, and the
+    // rest are folded into OTHER_TYPES and the heavy hitters. Only runs on a worker's first
+    // sighting of a type, so the lock is rarely taken
+    bool admitType(std::string_view fileType, const ScanTotals &local, WorkerContext &context)
+    {
+        std::lock_guard<std::mutex> lock(admittedMutex);
+        if (admittedTypes.find(fileType) == TypeTable::NONE)
+        {
+            if (context.memory.exhausted())
+            {
+                return false;
+            }
+            admittedTypes.intern(fileType);
+        }
+        context.memory.charge(local.typeCost(fileType));
+        return true;
+    }
+
+    // Stats that a file of fileType is counted in. target is the worker's totals, or the
+    // totals of the current directory that are merged into them once it is indexed
+    FileTypeStats &boundedStats(std::string_view fileType, size_t size, ScanTotals &target, WorkerContext &context)
+    {
+        if (FileTypeStats *known = target.find(fileType))
+        {
+            return *known;
+        }
+        if ((&target != &context.totals && context.totals.find(fileType)) || admitType(fileType, context.totals, context))
+        {
+            return target.statsFor(fileType);
+        }
+        target.untracked.offer(fileType, size);
+        return target.statsFor(OTHER_TYPES);
+    }
+
+    // Charge index bytes a worker just appended; over budget, its buffer goes to disk
+    void chargeIndex(size_t worker, size_t appended, WorkerContext &context)
+    {
+        SpillBuffer &buffer = indexBuffers[worker];
+        context.memory.charge(appended);
+        if (buffer.buffer().size() >= SpillBuffer::MIN_SPILL && context.memory.exhausted())
+        {
+            context.memory.release(buffer.buffer().size());
+            buffer.spill();
+        }
+    }
+
+    // Queue a subdirectory of task, linked to its parent's node when sizes are rolled up
+    void pushChild(const DirTask &task, std::string_view name, WorkerContext &context,
+                   WorkStealingPool<DirTask> &pool, size_t worker)
+    {
+        const int32_t opaque = childOpaque(task, name);
+        if (deferAfterNs && opaque < 0 && monotonicNs() > deferAfterNs)
+        {
+            std::string path;
+            deferred[worker].push_back(buildChildPath(path, task.path.view(), name));
+            return;
+        }
+        DirTask child{context.arena.allocate(task.path.view(), name), opaque};
+        child.lane = mountPoints.empty() ? task.lane : childLane(task.lane, child.path.view());
+        child.depth = static_cast<uint16_t>(task.depth + (task.depth < std::numeric_limits<uint16_t>::max()));
+        if (task.node)
+        {
+            task.node->pending.fetch_add(1, std::memory_order_relaxed);
+            child.node = new DirNode(task.node, child.path);
+        }
+        if (collectTree)
+        {
+            child.treeParent = context.treeNode;
+        }
+        pool.push(worker, child);
+    }
+
+    // Add a scanned directory's own bytes to its node, then complete every node whose
+    // subtree is now fully scanned, walking up towards the root
+    void finishDirectory(DirNode *node, uint64_t bytes, size_t worker)
+    {
+        node->size.fetch_add(bytes, std::memory_order_relaxed);
+        while (node && node->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            const uint64_t total = node->size.load(std::memory_order_relaxed);
+            visitor.onDirectory(visitorStates[worker], node->path.view(), total);
+            DirNode *parent = node->parent;
+            if (parent)
+            {
+                parent->size.fetch_add(total, std::memory_order_relaxed);
+            }
+            PathArena::release(node->path);
+            delete node;
+            node = parent;
+        }
+    }
+
+    // Fingerprint of every option that changes which files are counted and how; an index
+    // written under a different configuration is ignored
+    uint64_t configHash() const
+    {
+        std::ostringstream config;
+        config << "hidden=" << showHidden << "|min=" << sizeThreshold.minSize << "|max=" << sizeThreshold.maxSize
+               << "|opaque-mode=" << static_cast<int>(opaqueMode) << "|histogram=" << distributions
+               << "|disk-usage=" << diskUsage << "|one-file-system=" << oneFileSystem;
+        for (const auto &name : opaqueNames)
+        {
+            config << "|opaque=" << name;
+        }
+        for (const auto &type : includeTypes)
+        {
+            config << "|type=" << type;
+        }
+        for (const auto &expression : where.expressions())
+        {
+            config << "|where=" << expression;
+        }
+        for (const auto &rule : exclusions.rules())
+        {
+            config << "|exclude=" << rule;
+        }
+        return hashBytes(config.str());
+    }
+
+    // Replay a directory from the previous index if its stamp is unchanged
+    bool replayDirectory(const DirTask &task, uint64_t pathHash, const DirectoryStamp &stamp,
+                         WorkerContext &context, WorkStealingPool<DirTask> &pool, size_t worker)
+    {
+        ScanIndex::CachedDirectory cached;
+        std::string_view raw;
+        if (!previousIndex.lookup(pathHash, stamp, cached, raw))
+        {
+            return false;
+        }
+
+        ScanTotals &local = context.totals;
+        local.merge(cached.own, [&](std::string_view fileType)
+                    { return admitType(fileType, local, context); });
+        for (const auto &name : cached.subdirs)
+        {
+            pushChild(task, name, context, pool, worker);
+        }
+        indexBuffers[worker].buffer().append(raw.data(), raw.size());
+        indexCounts[worker]++;
+        chargeIndex(worker, raw.size(), context);
+        reusedDirs++;
+        return true;
+    }
+
+    // Report progress to the callback every interval until the scan finishes: throughput
+    // since the last report, queue depth and the directory that has been in progress longest
+    void reportProgress(const WorkStealingPool<DirTask> &pool, std::mutex &mutex, std::condition_variable &cv, const bool &done) const
+    {
+        uint64_t lastFiles = 0;
+        uint64_t lastDirs = 0;
+        int64_t lastNs = monotonicNs();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cv.wait_for(lock, progressInterval, [&]
+                            { return done; }))
+        {
+            ScanProgress report;
+            int64_t oldestStart = 0;
+            WorkerProgress *slowest = nullptr;
+            for (const auto &live : progress)
+            {
+                report.files += live->files.load(std::memory_order_relaxed);
+                report.dirs += live->dirs.load(std::memory_order_relaxed);
+                report.bytes += live->bytes.load(std::memory_order_relaxed);
+                const int64_t start = live->dirStartNs.load(std::memory_order_relaxed);
+                if (start != 0 && (oldestStart == 0 || start < oldestStart))
+                {
+                    oldestStart = start;
+                    slowest = live.get();
+                }
+            }
+
+            const int64_t now = monotonicNs();
+            const double seconds = std::max(1e-9, (now - lastNs) / 1e9);
+            report.filesPerSecond = (report.files - lastFiles) / seconds;
+            report.dirsPerSecond = (report.dirs - lastDirs) / seconds;
+            report.queued = pool.pendingTasks();
+            if (adaptive)
+            {
+                std::lock_guard<std::mutex> decisionLock(decisionMutex);
+                report.adaptive = true;
+                report.concurrency = lastDecision;
+                report.maxWorkers = pool.size();
+                report.maxDepth = maxQueueDepth;
+            }
+            if (slowest)
+            {
+                {
+                    std::lock_guard<std::mutex> pathLock(slowest->pathMutex);
+                    report.slowestPath = slowest->currentPath;
+                }
+                report.slowestSeconds = (now - oldestStart) / 1e9;
+            }
+            lastFiles = report.files;
+            lastDirs = report.dirs;
+            lastNs = now;
+            progressCallback(report);
+        }
+    }
+
+    // Apply a decision of the --adaptive controller to the pool and the readers' queue depth
+    void applyDecision(WorkStealingPool<DirTask> &pool, const ConcurrencyController::Decision &decision)
+    {
+        pool.setActiveWorkers(decision.workers);
+        queueDepth.store(decision.depth, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(decisionMutex);
+        lastDecision = decision;
+    }
+
+    // Feed the controller the operations the workers completed every interval until the
+    // scan finishes, and apply what it decides
+    void controlConcurrency(ConcurrencyController &controller, WorkStealingPool<DirTask> &pool,
+                            std::mutex &mutex, std::condition_variable &cv, const bool &done)
+    {
+        uint64_t lastOperations = 0;
+        int64_t lastLatencyNs = 0;
+        int64_t lastNs = monotonicNs();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cv.wait_for(lock, ConcurrencyController::INTERVAL, [&]
+                            { return done; }))
+        {
+            uint64_t operations = 0;
+            int64_t latencyNs = 0;
+            for (const auto &live : progress)
+            {
+                operations += live->operations.load(std::memory_order_relaxed);
+                latencyNs += live->operationNs.load(std::memory_order_relaxed);
+            }
+            if (operations - lastOperations < ConcurrencyController::MIN_OPERATIONS)
+            {
+                continue;
+            }
+            const int64_t now = monotonicNs();
+            const bool starved = pool.pendingTasks() <= pool.activeWorkers();
+            applyDecision(pool, controller.update(operations - lastOperations, latencyNs - lastLatencyNs, now - lastNs, starved));
+            lastOperations = operations;
+            lastLatencyNs = latencyNs;
+            lastNs = now;
+        }
+    }
+
+    static void stopReporter(std::thread &reporter, std::mutex &mutex, std::condition_variable &cv, bool &done)
+    {
+        if (!reporter.joinable())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        cv.notify_all();
+        reporter.join();
+    }
+
+    // Combine -w expressions, -t types and the size range into the filter a scan applies
+    void compileFilter()
+    {
+        filter = where;
+        filter.addTypes(includeTypes);
+        filter.addSizeRange(sizeThreshold.minSize, sizeThreshold.maxSize);
+        filter.compile(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count());
+    }
+
+    // Scan a single directory, queueing its subdirectories as new pool tasks
+    void scanDirectory(const DirTask &task, WorkerContext &context, WorkStealingPool<DirTask> &pool, size_t worker)
+    {
+        const std::string_view path = task.path.view();
+        const bool inOpaque = task.opaque >= 0;
+        ScanTotals &local = context.totals;
+        DirListing &listing = context.listing;
+        DirectoryReader &reader = *context.reader;
+
+        // With an index, stamp the directory before reading it so that any change made while
+        // it is being read shows up as a mismatch on the next run
+        const bool indexing = !indexFile.empty();
+        DirectoryStamp stamp;
+        bool recordable = false;
+        uint64_t pathHash = 0;
+        if (indexing && readDirectoryStamp(task.path.data, stamp))
+        {
+            pathHash = hashBytes(path);
+            // The index keeps only per-directory aggregates, so aggregators that need individual
+            // files and --disk-usage read every directory, as do filters on file age, whose
+            // outcome changes without the directory changing
+            if (!diskUsage && !visitor.wantsFiles() && !filter.dependsOnTime() && replayDirectory(task, pathHash, stamp, context, pool, worker))
+            {
+                return;
+            }
+            // Directories touched within the timestamp granularity of this scan could change
+            // again without their stamp moving, so they are always rescanned next time
+            recordable = stamp.mtimeNs < scanStartNs - 1000000000 && stamp.ctimeNs < scanStartNs - 1000000000;
+        }
+        std::unique_ptr<ScanTotals> own(recordable ? new ScanTotals() : nullptr);
+        if (own)
+        {
+            own->distributions = distributions;
+        }
+        ScanTotals &target = recordable ? *own : local;
+        std::vector<std::string> subdirs;
+        if (indexing)
+        {
+            rescannedDirs++;
+        }
+
+        // Phase timings are only taken when instrumentation is on
+        WorkerProgress *live = progress.empty() ? nullptr : progress[worker].get();
+        int64_t phaseStart = live ? monotonicNs() : 0;
+        const auto endPhase = [&](std::atomic<int64_t> &counter)
+        {
+            const int64_t now = monotonicNs();
+            const int64_t elapsed = now - phaseStart;
+            WorkerProgress::add(counter, elapsed);
+            phaseStart = now;
+            return elapsed;
+        };
+        int64_t readdirElapsed = 0;
+
+        listing.clear();
+        std::error_code ec;
+        const bool listed = reader.list(task.path.data, listing, ec);
+        if (live)
+        {
+            readdirElapsed = endPhase(live->readdirNs);
+        }
+        if (!listed)
+        {
+            reader.close();
+            if (ec && ec != std::errc::permission_denied)
+            {
+                std::ostringstream message;
+                message << "Warning: Cannot read directory " << fs::path(path) << " - " << ec.message();
+                printWarning(message.str());
+            }
+            return;
+        }
+        local.entries += listing.entries.size();
+
+        // Inodes are laid out in inode number order on ext4 and XFS, so stat'ing in that order
+        // reads the inode table sequentially instead of seeking for every entry
+        if (scanOrder == ScanOrder::Inode)
+        {
+            std::sort(listing.entries.begin(), listing.entries.end(), [](const DirEntry &a, const DirEntry &b)
+                      { return a.inode < b.inode; });
+        }
+
+        // Only regular files need their size; links and unknown types need their target type,
+        // and directories need their identity if exclusions are matched by (device, inode),
+        // the scan stays on one filesystem or they are symlinks that could form a loop.
+        // Regular files the filter rejects by name are not stat'ed at all
+        const bool directoryIdentity = exclusions.needsIdentity() || oneFileSystem;
+        const bool filtering = !filter.empty();
+        if (filtering)
+        {
+            context.filterResume.assign(listing.entries.size(), filter.entry());
+        }
+        size_t lookups = 0;
+        for (size_t i = 0; i < listing.entries.size(); i++)
+        {
+            DirEntry &entry = listing.entries[i];
+            entry.needsStat = entry.type == EntryType::Regular ||
+                              entry.type == EntryType::Symlink ||
+                              entry.type == EntryType::Unknown ||
+                              ((directoryIdentity || entry.symlink) && entry.type == EntryType::Directory);
+            if (filtering && !inOpaque && entry.type == EntryType::Regular)
+            {
+                const std::string_view name = listing.name(entry);
+                const FilterInput input{path, name, fileTypeKey(name, context.typeKey), &context.scratchPath};
+                context.filterResume[i] = filter.evaluate(input, false, filter.entry());
+                entry.needsStat = context.filterResume[i] != FileFilter::REJECT;
+            }
+            lookups += entry.needsStat;
+        }
+        reader.stat(listing);
+        reader.close();
+        if (live)
+        {
+            // The readdir counts as one operation; overlapped lookups are timed one by one
+            int64_t lookupNs = endPhase(live->statNs);
+            reader.overlappedLookups(lookups, lookupNs);
+            WorkerProgress::add(live->operations, 1 + lookups);
+            WorkerProgress::add(live->operationNs, readdirElapsed + lookupNs);
+        }
+
+        // Subdirectories are queued highest inode first, so that this worker, which takes its
+        // newest task first, descends into them in inode order too
+        if (scanOrder == ScanOrder::Inode)
+        {
+            std::reverse(listing.entries.begin(), listing.entries.end());
+            if (filtering)
+            {
+                std::reverse(context.filterResume.begin(), context.filterResume.end());
+            }
+        }
+
+        for (size_t i = 0; i < listing.entries.size(); i++)
+        {
+            const DirEntry &entry = listing.entries[i];
+            const std::string_view name = listing.name(entry);
+            if (entry.type == EntryType::Directory)
+            {
+                if (!exclusions.empty() &&
+                    exclusions.excludes(name, entry.device, entry.inode, [&]() -> std::string_view
+                                        { return buildChildPath(context.scratchPath, path, name); }))
+                {
+                    continue;
+                }
+                if (oneFileSystem && entry.error == 0 && entry.device != rootDevice)
+                {
+                    continue;
+                }
+                if (entry.symlink && !inOpaque && entry.error == 0 && leadsToAncestor(path, entry.device, entry.inode))
+                {
+                    std::ostringstream message;
+                    message << "Warning: Not following " << fs::path(buildChildPath(context.scratchPath, path, name))
+                            << " - it leads back to a directory above it";
+                    printWarning(message.str());
+                    continue;
+                }
+
+                if (inOpaque)
+                {
+                    // Inside an opaque directory: the whole tree counts, but directory symlinks
+                    // are not followed and approx mode stops at the first level
+                    if (entry.symlink || opaqueMode == OpaqueMode::Approx)
+                    {
+                        continue;
+                    }
+                }
+                else if (const int32_t opaque = opaqueIndex(name); opaque >= 0)
+                {
+                    if (opaqueMode == OpaqueMode::Skip)
+                    {
+                        continue;
+                    }
+                    addOpaqueDirectory(opaque, target);
+                }
+                pushChild(task, name, context, pool, worker); // Subdirectories become tasks, possibly stolen by other workers
+                if (recordable)
+                {
+                    subdirs.emplace_back(name);
+                }
+                continue;
+            }
+
+            if (entry.type == EntryType::Regular)
+            {
+                try
+                {
+                    if (filtering && context.filterResume[i] == FileFilter::REJECT)
+                    {
+                        continue;
+                    }
+                    if (entry.error != 0)
+                    {
+                        std::ostringstream message;
+                        message << "Warning: Cannot get size of " << fs::path(buildChildPath(context.scratchPath, path, name))
+                                << " - " << std::generic_category().message(entry.error);
+                        printWarning(message.str());
+                        continue;
+                    }
+                    size_t size = entry.size;
+                    const size_t allocated = entry.blocks * 512;
+
+                    // Further links to an inode that was already counted add nothing; only a link
+                    // that is counted claims the inode, so a filtered-out link cannot hide a later one
+                    const auto furtherLink = [&]
+                    {
+                        if (inodes && entry.links > 1 && !inodes->insert(entry.device, entry.inode, context.deviceCache))
+                        {
+                            target.linkedFiles++;
+                            target.linkedSize += size;
+                            return true;
+                        }
+                        return false;
+                    };
+
+                    if (inOpaque)
+                    {
+                        if (!furtherLink())
+                        {
+                            addOpaqueFile(task.opaque, size, allocated, target);
+                        }
+                        continue;
+                    }
+
+                    const std::string_view fileType = fileTypeKey(name, context.typeKey);
+                    if (filtering)
+                    {
+                        FilterInput input{path, name, fileType, &context.scratchPath};
+                        input.size = size;
+                        input.mtimeNs = entry.mtimeNs;
+                        input.uid = entry.uid;
+                        if (filter.evaluate(input, true, context.filterResume[i]) != FileFilter::ACCEPT)
+                        {
+                            continue;
+                        }
+                    }
+                    if (furtherLink())
+                    {
+                        continue;
+                    }
+
+                    if (name[0] == '.' && !showHidden)
+                    {
+                        target.hiddenFiles++;
+                        target.hiddenSize += size;
+                    }
+                    else
+                    {
+                        FileTypeStats &stat = boundedStats(fileType, size, target, context);
+                        stat.update(size);
+                        stat.allocatedSize += allocated;
+                        target.totalFiles++;
+                        visitor.onFile(visitorStates[worker], FileEvent{path, name, fileType, size, allocated,
+                                                                        entry.device, entry.inode, &context.scratchPath,
+                                                                        entry.uid, entry.gid, entry.mtimeNs, entry.atimeNs, task.depth});
+                    }
+
+                    target.totalSize += size;
+                    target.allocatedSize += allocated;
+                }
+                catch (const std::exception &e)
+                {
+                    std::ostringstream message;
+                    message << "Error processing file " << fs::path(buildChildPath(context.scratchPath, path, name))
+                            << ": " << e.what();
+                    printWarning(message.str());
+                    continue;
+                }
+            }
+        }
+
+        if (recordable)
+        {
+            // Types folded into OTHER_TYPES are lost, so such a directory is not indexed
+            if (own->untracked.empty())
+            {
+                std::string &buffer = indexBuffers[worker].buffer();
+                const size_t before = buffer.size();
+                ScanIndex::appendRecord(buffer, pathHash, stamp, *own, subdirs);
+                indexCounts[worker]++;
+                chargeIndex(worker, buffer.size() - before, context);
+            }
+            local.merge(*own);
+        }
+        if (live)
+        {
+            endPhase(live->aggregateNs);
+        }
+    }
+
+    // Directories per probe worker whose results are kept, so the levels near the root,
+    // which every probe passes through, are read only once
+    static constexpr size_t PROBE_CACHE_DIRS = 4096;
+    // Guards probes against directory symlink loops
+    static constexpr size_t MAX_PROBE_DEPTH = 4096;
+
+    struct ProbedDirectory
+    {
+        ScanTotals totals;
+        std::vector<std::pair<std::string, int32_t>> children; // subdirectory and its opaque index
+    };
+
+    // Read one directory for an estimate: count its files the way scanDirectory() does
+    // and list the subdirectories a scan would descend into
+    void probeDirectory(const std::string &path, int32_t opaque, WorkerContext &context, ProbedDirectory &dir)
+    {
+        DirListing &listing = context.listing;
+        DirectoryReader &reader = *context.reader;
+        listing.clear();
+        std::error_code ec;
+        if (!reader.list(path.c_str(), listing, ec))
+        {
+            reader.close();
+            if (ec && ec != std::errc::permission_denied)
+            {
+                std::ostringstream message;
+                message << "Warning: Cannot read directory " << fs::path(path) << " - " << ec.message();
+                printWarning(message.str());
+            }
+            return;
+        }
+        const bool directoryIdentity = exclusions.needsIdentity() || oneFileSystem;
+        for (DirEntry &entry : listing.entries)
+        {
+            entry.needsStat = entry.type == EntryType::Regular ||
+                              entry.type == EntryType::Symlink ||
+                              entry.type == EntryType::Unknown ||
+                              (directoryIdentity && entry.type == EntryType::Directory);
+        }
+        reader.stat(listing);
+        reader.close();
+
+        ScanTotals &target = dir.totals;
+        for (const DirEntry &entry : listing.entries)
+        {
+            const std::string_view name = listing.name(entry);
+            if (entry.type == EntryType::Directory)
+            {
+                if (!exclusions.empty() &&
+                    exclusions.excludes(name, entry.device, entry.inode, [&]() -> std::string_view
+                                        { return buildChildPath(context.scratchPath, path, name); }))
+                {
+                    continue;
+                }
+                if (oneFileSystem && entry.error == 0 && entry.device != rootDevice)
+                {
+                    continue;
+                }
+                int32_t childOpaque = opaque;
+                if (opaque >= 0)
+                {
+                    if (entry.symlink || opaqueMode == OpaqueMode::Approx)
+                    {
+                        continue;
+                    }
+                }
+                else if ((childOpaque = opaqueIndex(name)) >= 0)
+                {
+                    if (opaqueMode == OpaqueMode::Skip)
+                    {
+                        continue;
+                    }
+                    addOpaqueDirectory(childOpaque, target);
+                }
+                dir.children.emplace_back(name, childOpaque);
+                continue;
+            }
+            if (entry.type != EntryType::Regular || entry.error != 0)
+            {
+                continue;
+            }
+            const size_t size = entry.size;
+            const size_t allocated = entry.blocks * 512;
+            if (opaque >= 0)
+            {
+                addOpaqueFile(opaque, size, allocated, target);
+                continue;
+            }
+            const std::string_view fileType = fileTypeKey(name, context.typeKey);
+            if (!filter.empty())
+            {
+                FilterInput input{path, name, fileType, &context.scratchPath};
+                input.size = size;
+                input.mtimeNs = entry.mtimeNs;
+                input.uid = entry.uid;
+                if (filter.evaluate(input, true, filter.entry()) != FileFilter::ACCEPT)
+                {
+                    continue;
+                }
+            }
+            if (name[0] == '.' && !showHidden)
+            {
+                target.hiddenFiles++;
+                target.hiddenSize += size;
+            }
+            else
+            {
+                FileTypeStats &stat = target.statsFor(fileType);
+                stat.update(size);
+                stat.allocatedSize += allocated;
+                target.totalFiles++;
+            }
+            target.totalSize += size;
+            target.allocatedSize += allocated;
+        }
+    }
+
+    // Walk random probes from the root until stop is set, adding each finished one to part
+    void runProbes(size_t worker, TreeEstimate &part, std::mutex &partMutex, const std::atomic<bool> &stop)
+    {
+        WorkerContext context;
+        context.reader = makeDirectoryReader(backend);
+        std::mt19937_64 random(std::random_device{}() ^ (static_cast<uint64_t>(worker) << 32));
+        std::unordered_map<std::string, ProbedDirectory> cache;
+        ProbedDirectory uncached;
+        std::string path;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            TreeEstimate::Probe probe;
+            path = scanRoot;
+            int32_t opaque = -1;
+            double weight = 1;
+            size_t read = 0;
+            for (size_t depth = 0; depth < MAX_PROBE_DEPTH && !stop.load(std::memory_order_relaxed); depth++)
+            {
+                const ProbedDirectory *dir = nullptr;
+                const auto cached = cache.find(path);
+                if (cached != cache.end())
+                {
+                    dir = &cached->second;
+                }
+                else
+                {
+                    uncached = ProbedDirectory();
+                    probeDirectory(path, opaque, context, uncached);
+                    read++;
+                    dir = cache.size() < PROBE_CACHE_DIRS ? &cache.emplace(path, std::move(uncached)).first->second : &uncached;
+                }
+                probe.addDirectory(dir->totals, weight);
+                if (dir->children.empty())
+                {
+                    break;
+                }
+                std::uniform_int_distribution<size_t> pick(0, dir->children.size() - 1);
+                const auto &child = dir->children[pick(random)];
+                weight *= static_cast<double>(dir->children.size());
+                opaque = child.second;
+                path = buildChildPath(context.scratchPath, path, child.first);
+            }
+            // A probe cut short by stopping would underestimate, so it is dropped
+            if (stop.load(std::memory_order_relaxed))
+            {
+                break;
+            }
+            std::lock_guard<std::mutex> lock(partMutex);
+            part.add(probe);
+            part.directoriesRead += read;
+        }
+    }
+
+public:
+    BasicFileAnalyzer(bool showHidden = false) : showHidden(showHidden) {}
+
+    // Merged results of the last analyze() or loadSnapshot()
+    const ScanTotals &results() const
+    {
+        return totals;
+    }
+
+    // Stats ordered by total size (largest first), ties broken by type name so output is
+    // identical no matter how many workers produced it
+    std::vector<std::pair<std::string, FileTypeStats>> sortedStats() const
+    {
+        std::vector<std::pair<std::string, FileTypeStats>> sorted;
+        sorted.reserve(totals.stats.size());
+        totals.forEachType([&sorted](const std::string &fileType, const FileTypeStats &stat)
+                           { sorted.emplace_back(fileType, stat); });
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const auto &a, const auto &b)
+                  {
+                      if (a.second.totalSize != b.second.totalSize)
+                      {
+                          return a.second.totalSize > b.second.totalSize;
+                      }
+                      return a.first < b.first;
+                  });
+        return sorted;
+    }
+
+    bool includesHidden() const
+    {
+        return showHidden;
+    }
+
+    bool tracksDistributions() const
+    {
+        return distributions;
+    }
+
+    bool tracksDiskUsage() const
+    {
+        return diskUsage;
+    }
+
+    void addExcludeDir(const std::string &dir)
+    {
+        exclusions.add(dir);
+    }
+
+    void addIncludeType(const std::string &type)
+    {
+        includeTypes.insert(type.empty() ? "[no extension]" : type);
+    }
+
+    void setSizeThreshold(const SizeThreshold &threshold)
+    {
+        if (!threshold.isValid())
+        {
+            throw std::runtime_error("Invalid size threshold: min size must be less than or equal to max size");
+        }
+        sizeThreshold = threshold;
+    }
+
+    // Don't descend into directories on other filesystems than the root (like du -x)
+    void setOneFileSystem(bool enabled)
+    {
+#ifndef __linux__
+        if (enabled)
+        {
+            throw std::runtime_error("--one-file-system is only supported on Linux");
+        }
+#endif
+        oneFileSystem = enabled;
+    }
+
+    // Let at most count workers scan the mount at mountPoint at once, instead of the
+    // default chosen from its filesystem type and device
+    void setMountJobs(const std::string &mountPoint, size_t count)
+    {
+        mountJobs.emplace_back(mountPoint, count);
+    }
+
+    // Files and bytes per mount reached by the last analyze(); the root's mount comes first
+    const std::vector<MountUsage> &mounts() const
+    {
+        return mountUsage;
+    }
+
+    // Approximate memory the scan may use for its growing structures; 0 means unlimited
+    void setMemoryBudget(size_t bytes)
+    {
+        memory.setLimit(bytes);
+    }
+
+    // Peak of the memory charged against the budget by the last analyze()
+    size_t memoryPeak() const
+    {
+        return memory.peakBytes();
+    }
+
+    // Scan for about budget, then stop descending: subdirectories reached later are left for
+    // takeDeferred(), so a distributed scan can hand them to other nodes
+    void setShardBudget(std::chrono::milliseconds budget)
+    {
+        shardBudgetNs = std::chrono::duration_cast<std::chrono::nanoseconds>(budget).count();
+    }
+
+    // Directories the last analyze() left unscanned because the shard budget ran out
+    std::vector<std::string> takeDeferred()
+    {
+        std::vector<std::string> all;
+        for (auto &paths : deferred)
+        {
+            std::move(paths.begin(), paths.end(), std::back_inserter(all));
+            paths.clear();
+        }
+        return all;
+    }
+
+    // Fingerprint of the options that decide what is counted; all nodes of a distributed
+    // scan must agree on it
+    uint64_t optionsHash() const
+    {
+        return configHash();
+    }
+
+    // Add results scanned elsewhere (by the workers of a distributed scan)
+    void mergeResults(const ScanTotals &part)
+    {
+        totals.merge(part);
+    }
+
+    // Whether the last analyze() would have reported this file rather than skipping it or
+    // counting it as hidden, for keeping its results live (--watch)
+    bool reportsFile(std::string_view directory, std::string_view name, std::string_view fileType,
+                     const struct stat &st, std::string &scratch) const
+    {
+        if (name.empty() || (name[0] == '.' && !showHidden))
+        {
+            return false;
+        }
+        if (filter.empty())
+        {
+            return true;
+        }
+        FilterInput input{directory, name, fileType, &scratch};
+        input.size = static_cast<uint64_t>(st.st_size);
+        input.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        input.uid = st.st_uid;
+        return filter.evaluate(input, true, 0) == FileFilter::ACCEPT;
+    }
+
+    // Whether a scan would descend into the subdirectory name of directory: it is neither
+    // excluded nor opaque
+    bool descendsInto(std::string_view directory, std::string_view name, const struct stat &st, std::string &scratch) const
+    {
+        if (opaqueIndex(name) >= 0)
+        {
+            return false;
+        }
+        return exclusions.empty() ||
+               !exclusions.excludes(name, st.st_dev, st.st_ino, [&]() -> std::string_view
+                                    { return buildChildPath(scratch, directory, name); });
+    }
+
+    bool isOpaqueName(std::string_view name) const
+    {
+        return opaqueIndex(name) >= 0;
+    }
+
+    // Only count files matching expression (see FileFilter); several expressions are ANDed
+    void addFilter(const std::string &expression)
+    {
+        where.addExpression(expression);
+    }
+
+    void setJobs(size_t count)
+    {
+        if (count == 0)
+        {
+            throw std::runtime_error("Invalid job count: must be at least 1");
+        }
+        jobs = count;
+    }
+
+    // Let a controller pick how many of the jobs workers run, and with io_uring how many
+    // lookups each keeps in flight, to maximize throughput while the mean latency of a
+    // readdir or stat stays under latencyCeiling
+    void setAdaptive(bool enabled, std::chrono::nanoseconds latencyCeiling = std::chrono::milliseconds(10))
+    {
+        if (latencyCeiling.count() <= 0)
+        {
+            throw std::runtime_error("Invalid latency ceiling: must be positive");
+        }
+        adaptive = enabled;
+        latencyCeilingNs = latencyCeiling.count();
+    }
+
+    // The controller's last decision in the last analyze() with setAdaptive
+    ConcurrencyController::Decision concurrencyDecision() const
+    {
+        std::lock_guard<std::mutex> lock(decisionMutex);
+        return lastDecision;
+    }
+
+    // Treat directories with this name like .git: one aggregated entry instead of their contents
+    void addOpaqueName(const std::string &name)
+    {
+        if (name.empty() || name.find('/') != std::string::npos)
+        {
+            throw std::runtime_error("Invalid opaque directory name: " + name);
+        }
+        if (opaqueIndex(name) < 0)
+        {
+            opaqueNames.push_back(name);
+        }
+    }
+
+    void setOpaqueMode(OpaqueMode mode)
+    {
+        opaqueMode = mode;
+    }
+
+    // Metadata access order; it affects speed only, never the results
+    void setScanOrder(ScanOrder order)
+    {
+        scanOrder = order;
+    }
+
+    void setBackend(ScanBackend scanBackend)
+    {
+        backend = scanBackend;
+    }
+
+    // Enable incremental rescans backed by an index file that is read before and rewritten after the scan
+    void setIndexFile(const std::string &filename)
+    {
+#ifndef __linux__
+        throw std::runtime_error("Incremental index is only supported on Linux");
+#endif
+        indexFile = filename;
+    }
+
+    size_t reusedDirectories() const
+    {
+        return reusedDirs;
+    }
+
+    size_t rescannedDirectories() const
+    {
+        return rescannedDirs;
+    }
+
+    size_t entriesExamined() const
+    {
+        return totals.entries;
+    }
+
+    // Count each hard-linked inode once and report allocated blocks next to apparent sizes
+    void setDiskUsage(bool enabled)
+    {
+#ifndef __linux__
+        if (enabled)
+        {
+            throw std::runtime_error("Disk usage accounting is only supported on Linux");
+        }
+#endif
+        diskUsage = enabled;
+    }
+
+    // Track per-type size sketches for p50/p90/p99 and the size histogram
+    void setDistributions(bool enabled)
+    {
+        distributions = enabled;
+    }
+
+    // The aggregators fed by analyze(); configure them before scanning and read their
+    // results afterwards
+    Visitor &aggregators()
+    {
+        return visitor;
+    }
+
+    const Visitor &aggregators() const
+    {
+        return visitor;
+    }
+
+    // Call callback from a reporter thread every interval during analyze()
+    void setProgressCallback(std::function<void(const ScanProgress &)> callback,
+                             std::chrono::milliseconds interval = std::chrono::milliseconds(500))
+    {
+        progressCallback = std::move(callback);
+        progressInterval = interval;
+    }
+
+    // Collect per-phase timings during analyze() for writeStatsJson()
+    void setStatsJsonFile(const std::string &filename)
+    {
+        statsJsonFile = filename;
+    }
+
+    // Write the instrumentation of the last analyze() as JSON; the phase times are summed
+    // over workers, so with -j N they can add up to N times the wall time
+    void writeStatsJson() const
+    {
+        if (statsJsonFile.empty() || progress.empty())
+        {
+            return;
+        }
+        std::ofstream file(statsJsonFile);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot create stats file: " + statsJsonFile);
+        }
+
+        uint64_t files = 0;
+        uint64_t dirs = 0;
+        uint64_t bytes = 0;
+        int64_t readdirNs = 0;
+        int64_t statNs = 0;
+        int64_t aggregateNs = 0;
+        std::ostringstream workers;
+        for (size_t i = 0; i < progress.size(); i++)
+        {
+            const WorkerProgress &live = *progress[i];
+            files += live.files;
+            dirs += live.dirs;
+            bytes += live.bytes;
+            readdirNs += live.readdirNs;
+            statNs += live.statNs;
+            aggregateNs += live.aggregateNs;
+            workers << (i ? ",\n" : "\n") << "    {\"dirs\": " << live.dirs << ", \"files\": " << live.files
+                    << ", \"readdir_ns\": " << live.readdirNs << ", \"stat_ns\": " << live.statNs
+                    << ", \"aggregate_ns\": " << live.aggregateNs << "}";
+        }
+        const double seconds = std::max(1e-9, scanElapsedNs / 1e9);
+
+        file << "{\n"
+             << "  \"wall_ns\": " << scanElapsedNs << ",\n"
+             << "  \"jobs\": " << progress.size() << ",\n"
+             << "  \"backend\": \"" << backendName(backend) << "\",\n"
+             << "  \"dirs\": " << dirs << ",\n"
+             << "  \"files\": " << files << ",\n"
+             << "  \"entries\": " << totals.entries << ",\n"
+             << "  \"bytes\": " << bytes << ",\n"
+             << std::fixed << std::setprecision(1)
+             << "  \"files_per_sec\": " << files / seconds << ",\n"
+             << "  \"dirs_per_sec\": " << dirs / seconds << ",\n"
+             << "  \"readdir_ns\": " << readdirNs << ",\n"
+             << "  \"stat_ns\": " << statNs << ",\n"
+             << "  \"aggregate_ns\": " << aggregateNs << ",\n"
+             << "  \"memory_budget\": " << memory.budgetBytes() << ",\n"
+             << "  \"memory_peak_bytes\": " << memory.peakBytes() << ",\n"
+             << "  \"retained_peak_bytes\": " << retained.peakBytes() << ",\n"
+             << "  \"untracked_types\": " << totals.untracked.sorted().size() << ",\n"
+             << "  \"workers\": [" << workers.str() << "\n  ]\n"
+             << "}\n";
+    }
+
+    // Find the mount holding root and every mount beneath it, spelled the way the scan will
+    // build their paths, and return each one's concurrency limit (one lane per mount)
+    std::vector<size_t> planMounts(const std::string &root)
+    {
+        mountUsage.clear();
+        mountPoints.clear();
+        rootDevice = 0;
+        MountInfo rootMount;
+        rootMount.mountPoint = root;
+        std::vector<MountInfo> below;
+#ifdef __linux__
+        struct stat st;
+        std::error_code ec;
+        const std::string canonical = fs::canonical(root, ec).string();
+        if (::stat(root.c_str(), &st) == 0 && !ec)
+        {
+            rootDevice = st.st_dev;
+            const auto contains = [](const std::string &outer, const std::string &inner)
+            {
+                return inner.compare(0, outer.size(), outer) == 0 &&
+                       (outer.back() == '/' || inner.size() == outer.size() || inner[outer.size()] == '/');
+            };
+            size_t longest = 0;
+            for (const auto &mount : readMounts())
+            {
+                if (mount.device == rootDevice && contains(mount.mountPoint, canonical) && mount.mountPoint.size() >= longest)
+                {
+                    longest = mount.mountPoint.size();
+                    rootMount = mount;
+                }
+                else if (mount.mountPoint.size() > canonical.size() && contains(canonical, mount.mountPoint))
+                {
+                    // A later mount on the same path hides the earlier one
+                    below.erase(std::remove_if(below.begin(), below.end(), [&mount](const MountInfo &other)
+                                               { return other.mountPoint == mount.mountPoint; }),
+                                below.end());
+                    below.push_back(mount);
+                }
+            }
+            below.resize(std::min<size_t>(below.size(), std::numeric_limits<uint16_t>::max()));
+            for (auto &mount : below)
+            {
+                // Rebuild the path from the root as given, component by component
+                std::string spelled = root;
+                std::istringstream components(mount.mountPoint.substr(canonical.size()));
+                std::string component;
+                while (std::getline(components, component, '/'))
+                {
+                    if (!component.empty())
+                    {
+                        buildChildPath(spelled, std::string(spelled), component);
+                    }
+                }
+                mountPoints.emplace_back(spelled, static_cast<uint16_t>(mountPoints.size() + 1));
+            }
+        }
+#endif
+        std::vector<size_t> limits;
+        const auto addLane = [&](const MountInfo &mount)
+        {
+            // A single worker needs no limit, nor the /sys lookups that choose one
+            size_t limit = jobs > 1 ? defaultMountJobs(mount, jobs) : 1;
+            for (const auto &[mountPoint, count] : mountJobs)
+            {
+                std::error_code ignored;
+                if (fs::equivalent(mountPoint, mount.mountPoint, ignored))
+                {
+                    limit = count;
+                }
+            }
+            limit = std::max<size_t>(1, std::min(limit, jobs));
+            limits.push_back(limit);
+            mountUsage.push_back({mount.mountPoint, mount.type, limit});
+        };
+        addLane(rootMount);
+        for (const auto &mount : below)
+        {
+            addLane(mount);
+        }
+        std::sort(mountPoints.begin(), mountPoints.end());
+        // With a single mount the pool needs no lanes
+        return limits.size() > 1 ? limits : std::vector<size_t>();
+    }
+
+    // Walk the tree on a pool of workers; each keeps private totals that are merged afterwards
+    void analyze(const fs::path &path)
+    {
+        WorkStealingPool<DirTask> pool(jobs, planMounts(path.string()));
+        pool.setBreadthFirst(scanOrder == ScanOrder::Bfs);
+        if (!indexFile.empty())
+        {
+            if (!previousIndex.load(indexFile, configHash()) && fs::exists(indexFile))
+            {
+                printWarning("Warning: Ignoring index " + indexFile + " (corrupt or written with different options)");
+            }
+            scanStartNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::system_clock::now().time_since_epoch())
+                              .count();
+            indexBuffers.clear();
+            indexBuffers.resize(pool.size());
+            indexCounts.assign(pool.size(), 0);
+        }
+        inodes.reset(diskUsage ? new InodeSet() : nullptr);
+        lastEstimate.reset();
+        compileFilter();
+        std::vector<WorkerContext> contexts(pool.size());
+        for (auto &context : contexts)
+        {
+            context.reader = makeDirectoryReader(backend);
+            context.reader->limitInFlight(adaptive ? &queueDepth : nullptr);
+            context.totals.distributions = distributions;
+            context.mountTotals.assign(mountUsage.size(), {0, 0});
+            context.memory = MemoryBudget::Account(&memory);
+            context.retained = MemoryBudget::Account(&retained);
+        }
+        memory.reset();
+        retained.reset();
+        retained.setLimit(0);
+        admittedTypes = TypeTable();
+        visitorStates.assign(pool.size(), visitor.makeState());
+        scanRoot = path.string();
+        deferred.assign(pool.size(), {});
+        dirRecords.assign(collectDirectories ? pool.size() : 0, {});
+        tree = DirectoryTree();
+        treeParts.clear();
+        for (size_t worker = 0; collectTree && worker < pool.size(); worker++)
+        {
+            treeParts.emplace_back(worker);
+        }
+        exclusions.compile();
+        if (!exclusions.empty() && exclusions.excludesRoot(scanRoot))
+        {
+            return;
+        }
+
+        const bool instrumented = progressCallback || !statsJsonFile.empty() || adaptive;
+        progress.clear();
+        for (size_t worker = 0; instrumented && worker < pool.size(); worker++)
+        {
+            progress.push_back(std::make_unique<WorkerProgress>());
+        }
+        maxQueueDepth = contexts[0].reader->maxInFlight();
+        ConcurrencyController controller(pool.size(), maxQueueDepth, latencyCeilingNs);
+        std::mutex controllerMutex;
+        std::condition_variable controllerCv;
+        bool controllerDone = false;
+        std::thread controllerThread;
+        if (adaptive)
+        {
+            applyDecision(pool, controller.decision());
+            controllerThread = std::thread([&]
+                                           { controlConcurrency(controller, pool, controllerMutex, controllerCv, controllerDone); });
+        }
+        std::mutex reporterMutex;
+        std::condition_variable reporterCv;
+        bool scanDone = false;
+        std::thread reporter;
+        if (progressCallback)
+        {
+            reporter = std::thread([&]
+                                   { reportProgress(pool, reporterMutex, reporterCv, scanDone); });
+        }
+
+        const int64_t scanStart = monotonicNs();
+        deferAfterNs = shardBudgetNs ? scanStart + shardBudgetNs : 0;
+        try
+        {
+            DirTask root{contexts[0].arena.allocate(scanRoot, ""), -1};
+            if (visitor.wantsDirectories())
+            {
+                root.node = new DirNode(nullptr, root.path);
+            }
+            pool.run(root, [&](size_t worker, const DirTask &task)
+                     {
+                         WorkerContext &context = contexts[worker];
+                         WorkerProgress *live = progress.empty() ? nullptr : progress[worker].get();
+                         if (live && progressCallback)
+                         {
+                             std::lock_guard<std::mutex> lock(live->pathMutex);
+                             live->currentPath.assign(task.path.view());
+                             live->dirStartNs.store(monotonicNs(), std::memory_order_relaxed);
+                         }
+                         if (collectTree)
+                         {
+                             const std::string_view path = task.path.view();
+                             const std::string_view name = task.treeParent == DirectoryTree::Part::NONE
+                                                               ? path
+                                                               : path.substr(path.find_last_of('/') + 1);
+                             context.treeNode = treeParts[worker].add(task.treeParent, name);
+                             context.retained.charge(3 * sizeof(uint64_t) + sizeof(uint32_t) + name.size());
+                         }
+                         const size_t filesBefore = context.totals.totalFiles + context.totals.hiddenFiles;
+                         const size_t sizeBefore = context.totals.totalSize;
+                         scanDirectory(task, context, pool, worker);
+                         const size_t files = context.totals.totalFiles + context.totals.hiddenFiles - filesBefore;
+                         const size_t bytes = context.totals.totalSize - sizeBefore;
+                         if (live)
+                         {
+                             WorkerProgress::add(live->files, files);
+                             WorkerProgress::add(live->bytes, bytes);
+                             WorkerProgress::add(live->dirs, 1);
+                             live->dirStartNs.store(0, std::memory_order_relaxed);
+                         }
+                         context.mountTotals[task.lane].first += files;
+                         context.mountTotals[task.lane].second += bytes;
+                         if (collectTree)
+                         {
+                             treeParts[worker].setTotals(context.treeNode, files, bytes);
+                         }
+                         if (collectDirectories)
+                         {
+                             dirRecords[worker].push_back({std::string(task.path.view()), files, bytes});
+                             context.retained.charge(sizeof(DirectoryRecord) + task.path.view().size());
+                         }
+                         if (task.node)
+                         {
+                             finishDirectory(task.node, bytes, worker); // releases the path once the subtree is done
+                         }
+                         else
+                         {
+                             PathArena::release(task.path);
+                         } });
+        }
+        catch (...)
+        {
+            stopReporter(reporter, reporterMutex, reporterCv, scanDone);
+            stopReporter(controllerThread, controllerMutex, controllerCv, controllerDone);
+            throw;
+        }
+        scanElapsedNs = monotonicNs() - scanStart;
+        stopReporter(reporter, reporterMutex, reporterCv, scanDone);
+        stopReporter(controllerThread, controllerMutex, controllerCv, controllerDone);
+
+        for (auto &context : contexts)
+        {
+            context.memory.flush();
+            context.retained.flush();
+            totals.merge(context.totals);
+            for (size_t lane = 0; lane < mountUsage.size(); lane++)
+            {
+                mountUsage[lane].files += context.mountTotals[lane].first;
+                mountUsage[lane].size += context.mountTotals[lane].second;
+            }
+        }
+        for (auto &state : visitorStates)
+        {
+            visitor.merge(state);
+        }
+        visitorStates.clear();
+
+        inodes.reset();
+        visitor.finish(jobs);
+        if (collectTree)
+        {
+            tree.build(treeParts);
+        }
+
+        if (!indexFile.empty())
+        {
+            ScanIndex::write(indexFile, configHash(), indexBuffers, indexCounts);
+            indexBuffers.clear();
+        }
+    }
+
+    // Estimate the results under path from random probes instead of reading every directory
+    // (see TreeEstimate). Probes run on the -j workers until budget runs out (0 for no limit)
+    // or refined, which gets the estimate so far every interval, returns false. Afterwards
+    // results() holds the estimated totals and estimated() the estimate they come from.
+    // Hard links are not deduplicated and aggregators see no files
+    void estimate(const fs::path &path, std::chrono::milliseconds budget, std::chrono::milliseconds interval,
+                  const std::function<bool(const TreeEstimate &)> &refined)
+    {
+        planMounts(path.string());
+        compileFilter();
+        exclusions.compile();
+        scanRoot = path.string();
+        totals = ScanTotals();
+        lastEstimate.reset(new TreeEstimate());
+        if (!exclusions.empty() && exclusions.excludesRoot(scanRoot))
+        {
+            return;
+        }
+
+        std::vector<TreeEstimate> parts(jobs);
+        std::unique_ptr<std::mutex[]> partMutexes(new std::mutex[jobs]);
+        std::atomic<bool> stop{false};
+        std::mutex waitMutex;
+        std::condition_variable waitCv;
+        std::exception_ptr failure;
+        std::vector<std::thread> workers;
+        for (size_t worker = 0; worker < jobs; worker++)
+        {
+            workers.emplace_back([&, worker]
+                                 {
+                                     try
+                                     {
+                                         runProbes(worker, parts[worker], partMutexes[worker], stop);
+                                     }
+                                     catch (...)
+                                     {
+                                         std::lock_guard<std::mutex> lock(waitMutex);
+                                         if (!failure)
+                                         {
+                                             failure = std::current_exception();
+                                         }
+                                         stop = true;
+                                         waitCv.notify_all();
+                                     } });
+        }
+        const auto merged = [&]()
+        {
+            TreeEstimate all;
+            for (size_t worker = 0; worker < jobs; worker++)
+            {
+                std::lock_guard<std::mutex> lock(partMutexes[worker]);
+                all.merge(parts[worker]);
+            }
+            return all;
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+        auto nextReport = start + interval;
+        {
+            std::unique_lock<std::mutex> lock(waitMutex);
+            while (!stop)
+            {
+                const auto wake = budget.count() > 0 ? std::min(nextReport, start + budget) : nextReport;
+                if (waitCv.wait_until(lock, wake, [&]
+                                      { return stop.load(); }))
+                {
+                    break;
+                }
+                if (budget.count() > 0 && std::chrono::steady_clock::now() >= start + budget)
+                {
+                    break;
+                }
+                if (std::chrono::steady_clock::now() >= nextReport)
+                {
+                    nextReport += interval;
+                    lock.unlock();
+                    const bool more = !refined || refined(merged());
+                    lock.lock();
+                    if (!more)
+                    {
+                        break;
+                    }
+                }
+            }
+            stop = true;
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+
+        *lastEstimate = merged();
+        const TreeEstimate &result = *lastEstimate;
+        const auto rounded = [&result](const TreeEstimate::Moments &moments)
+        {
+            return static_cast<size_t>(std::llround(result.mean(moments)));
+        };
+        result.forEachType([&](const std::string &fileType, const TreeEstimate::TypeEstimate &stat)
+                           {
+                               FileTypeStats &own = totals.statsFor(fileType);
+                               own.count = rounded(stat.count);
+                               own.totalSize = rounded(stat.size);
+                               own.minSize = stat.minSize;
+                               own.maxSize = stat.maxSize; });
+        totals.totalFiles = rounded(result.files);
+        totals.totalSize = rounded(result.size);
+        totals.hiddenFiles = rounded(result.hiddenFiles);
+        totals.hiddenSize = rounded(result.hiddenSize);
+    }
+
+    // The estimate behind results() after estimate(), or nullptr after a full scan
+    const TreeEstimate *estimated() const
+    {
+        return lastEstimate.get();
+    }
+
+    // Build directoryTree() during analyze()
+    void enableDirectoryTree()
+    {
+        collectTree = true;
+    }
+
+    // Every directory scanned by the last analyze() with its own and subtree totals
+    const DirectoryTree &directoryTree() const
+    {
+        return tree;
+    }
+
+    // Keep per-directory totals during analyze() so saveSnapshot() can record the tree
+    void enableSnapshot()
+    {
+        collectDirectories = true;
+    }
+
+    void saveSnapshot(const std::string &filename) const
+    {
+        std::vector<DirectoryRecord> dirs;
+        for (const auto &records : dirRecords)
+        {
+            dirs.insert(dirs.end(), records.begin(), records.end());
+        }
+        writeSnapshot(filename, scanRoot, totals, showHidden, std::move(dirs));
+    }
+
+    // Replace the current results with those of a saved snapshot; returns the scanned root
+    std::string loadSnapshot(const std::string &filename)
+    {
+        MappedSnapshot snapshot(filename);
+        const SnapshotHeader &header = snapshot.header();
+        totals = ScanTotals();
+        lastEstimate.reset();
+        totals.totalFiles = header.totalFiles;
+        totals.totalSize = header.totalSize;
+        totals.hiddenFiles = header.hiddenFiles;
+        totals.hiddenSize = header.hiddenSize;
+        const SnapshotType *types = snapshot.types();
+        for (uint64_t i = 0; i < header.typeCount; i++)
+        {
+            FileTypeStats &stat = totals.statsFor(snapshot.string(types[i].nameOffset, types[i].nameLength));
+            stat.count = types[i].count;
+            stat.totalSize = types[i].totalSize;
+            stat.minSize = types[i].minSize;
+            stat.maxSize = types[i].maxSize;
+        }
+        showHidden = header.flags & 1;
+        scanRoot = std::string(snapshot.root());
+        return scanRoot + " (" + std::to_string(header.dirCount) + " directories)";
+    }
+
+};
+
+using FileAnalyzer = BasicFileAnalyzer<Aggregators<>>;
+
+} // namespace da
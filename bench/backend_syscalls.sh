@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compare system calls per file for the std, getdents and uring scanning backends.
+# Usage: bench/backend_syscalls.sh [files-per-dir] [dirs]
+set -e
+
+FILES_PER_DIR=${1:-200}
+DIRS=${2:-50}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+g++ -std=c++17 -O2 -pthread "$ROOT/da.cpp" -o "$WORK/da"
+g++ -std=c++17 -O2 "$ROOT/bench/syscount.cpp" -o "$WORK/syscount"
+
+# Synthetic tree: DIRS directories with FILES_PER_DIR small files of mixed extensions
+TREE="$WORK/tree"
+d=0
+while [ $d -lt "$DIRS" ]; do
+    mkdir -p "$TREE/dir$d"
+    f=0
+    while [ $f -lt "$FILES_PER_DIR" ]; do
+        case $((f % 4)) in
+        0) ext=.txt ;;
+        1) ext=.log ;;
+        2) ext=.cpp ;;
+        *) ext= ;;
+        esac
+        : >"$TREE/dir$d/file$f$ext"
+        f=$((f + 1))
+    done
+    d=$((d + 1))
+done
+FILES=$((FILES_PER_DIR * DIRS))
+
+# Baseline: process startup and output without any scanning
+mkdir -p "$WORK/empty"
+BASE=$("$WORK/syscount" "$WORK/da" "$WORK/empty" 2>&1 >/dev/null | sed -n 's/^syscalls: //p')
+
+printf "%-10s %12s %16s\n" "backend" "syscalls" "syscalls/file"
+for backend in std getdents uring; do
+    COUNT=$("$WORK/syscount" "$WORK/da" -b "$backend" "$TREE" 2>&1 >/dev/null | sed -n 's/^syscalls: //p')
+    awk -v b="$backend" -v c="$COUNT" -v base="$BASE" -v f="$FILES" \
+        'BEGIN { printf "%-10s %12d %16.2f\n", b, c, (c - base) / f }'
+done
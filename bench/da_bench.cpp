@@ -0,0 +1,452 @@
+// Benchmark for FileAnalyzer::analyze on reproducible synthetic trees.
+// Usage: da_bench [--files N] [--runs N] [-j N] [-b backend] [--order name]... [--shape name]... [--dir path] [--keep]
+// Each shape is generated from a fixed seed, then scanned in forked children so that every
+// run starts from a fresh heap and its peak RSS can be read from wait4(). Warm runs follow an
+// untimed warm-up scan; cold runs drop the page, dentry and inode caches first, which needs
+// root. System calls are counted in one extra ptrace-traced run, since tracing slows the scan.
+// Every shape is scanned with each --order; the access order matters most for cold runs on
+// spinning disks, so point --dir at an HDD and at an SSD to compare them.
+#include "../analyzer.h"
+
+#include "ptrace_count.h"
+
+#include <random>
+#include <sys/resource.h>
+
+using namespace da;
+
+namespace
+{
+
+struct Shape
+{
+    const char *name;
+    const char *description;
+};
+
+const Shape SHAPES[] = {
+    {"wide", "10 directories holding every file"},
+    {"deep", "chains of 200 nested directories, 5 files per level"},
+    {"tiny", "1024 directories of files under 64 bytes"},
+    {"mixed", "random fan-out, 40 extensions in mixed case, sizes up to 1 MiB"},
+    {"hidden", "70% dotfiles, a third of the directories hidden"},
+};
+
+struct TreeInfo
+{
+    size_t files = 0;
+    size_t dirs = 0;
+};
+
+// Creates directories and files of a given size (sparse, so large trees are cheap to build);
+// every random choice comes from one seeded generator, so a shape is identical on every run
+class TreeBuilder
+{
+private:
+    std::mt19937_64 rng;
+    TreeInfo info;
+
+public:
+    explicit TreeBuilder(uint64_t seed) : rng(seed) {}
+
+    uint64_t next(uint64_t bound)
+    {
+        return rng() % bound;
+    }
+
+    void dir(const std::string &path)
+    {
+        if (::mkdir(path.c_str(), 0755) != 0)
+        {
+            throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+        }
+        info.dirs++;
+    }
+
+    void file(const std::string &path, uint64_t size)
+    {
+        const int fd = ::open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || ::ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+        }
+        ::close(fd);
+        info.files++;
+    }
+
+    const TreeInfo &result() const
+    {
+        return info;
+    }
+};
+
+const char *const EXTENSIONS[] = {".txt", ".log", ".cpp", ".h", ".py", ".md", ".json", ".xml", ".csv", ".gz",
+                                  ".jpg", ".png", ".mp4", ".pdf", ".o", ".so", ".a", ".rs", ".go", ".java",
+                                  ".TXT", ".Log", ".CPP", ".H", ".Py", ".MD", ".JSON", ".Xml", ".CSV", ".GZ",
+                                  ".JPG", ".PNG", ".tar.gz", ".bak", ".tmp", ".yaml", ".html", ".css", ".js", ".sh"};
+
+TreeInfo buildTree(const std::string &shape, const std::string &root, size_t files)
+{
+    TreeBuilder tree(hashBytes(shape) ^ files);
+    tree.dir(root);
+
+    if (shape == "wide")
+    {
+        for (int d = 0; d < 10; d++)
+        {
+            tree.dir(root + "/d" + std::to_string(d));
+        }
+        for (size_t i = 0; i < files; i++)
+        {
+            tree.file(root + "/d" + std::to_string(i % 10) + "/f" + std::to_string(i) + EXTENSIONS[i % 4], tree.next(4096));
+        }
+    }
+    else if (shape == "deep")
+    {
+        for (size_t chain = 0, made = 0; made < files; chain++)
+        {
+            std::string path = root + "/c" + std::to_string(chain);
+            tree.dir(path);
+            for (int level = 0; level < 200 && made < files; level++)
+            {
+                path += "/l";
+                tree.dir(path);
+                for (int f = 0; f < 5 && made < files; f++, made++)
+                {
+                    tree.file(path + "/f" + std::to_string(f) + EXTENSIONS[f], tree.next(4096));
+                }
+            }
+        }
+    }
+    else if (shape == "tiny")
+    {
+        std::vector<std::string> leaves;
+        for (int a = 0; a < 32; a++)
+        {
+            tree.dir(root + "/a" + std::to_string(a));
+            for (int b = 0; b < 32; b++)
+            {
+                leaves.push_back(root + "/a" + std::to_string(a) + "/b" + std::to_string(b));
+                tree.dir(leaves.back());
+            }
+        }
+        for (size_t i = 0; i < files; i++)
+        {
+            tree.file(leaves[i % leaves.size()] + "/t" + std::to_string(i), tree.next(64));
+        }
+    }
+    else if (shape == "mixed")
+    {
+        std::vector<std::string> dirs{root};
+        for (size_t i = 0; i < files; i++)
+        {
+            if (tree.next(20) == 0)
+            {
+                dirs.push_back(dirs[tree.next(dirs.size())] + "/m" + std::to_string(dirs.size()));
+                tree.dir(dirs.back());
+            }
+            const uint64_t pick = tree.next(44);
+            const std::string extension = pick < 40 ? EXTENSIONS[pick] : "";
+            tree.file(dirs[tree.next(dirs.size())] + "/f" + std::to_string(i) + extension,
+                      tree.next(uint64_t(1) << tree.next(21)) + 1);
+        }
+    }
+    else if (shape == "hidden")
+    {
+        std::vector<std::string> dirs;
+        for (int d = 0; d < 12; d++)
+        {
+            dirs.push_back(root + (d % 3 == 0 ? "/.cache" : "/d") + std::to_string(d));
+            tree.dir(dirs.back());
+        }
+        for (size_t i = 0; i < files; i++)
+        {
+            const std::string name = tree.next(10) < 7 ? "/.f" + std::to_string(i) : "/f" + std::to_string(i) + ".txt";
+            tree.file(dirs[i % dirs.size()] + name, tree.next(4096));
+        }
+    }
+    else
+    {
+        throw std::runtime_error("Unknown shape: " + shape);
+    }
+    return tree.result();
+}
+
+struct Options
+{
+    size_t files = 20000;
+    size_t runs = 5;
+    size_t jobs = 1;
+    ScanBackend backend = defaultBackend();
+    std::vector<ScanOrder> orders;
+    std::vector<std::string> shapes;
+    std::string dir;
+    bool keep = false;
+};
+
+struct RunResult
+{
+    int64_t elapsedNs = 0;
+    long peakRssKb = 0;
+    unsigned long long syscalls = 0;
+};
+
+// Scan root once in a forked child. With traced set, the child stops for ptrace after the
+// analyzer is configured, so only the scan's system calls are counted
+RunResult runScan(const std::string &root, const Options &options, ScanOrder order, bool traced)
+{
+    int pipeFds[2];
+    if (::pipe(pipeFds) != 0)
+    {
+        throw std::runtime_error(std::string("pipe: ") + std::strerror(errno));
+    }
+    const pid_t child = ::fork();
+    if (child < 0)
+    {
+        throw std::runtime_error(std::string("fork: ") + std::strerror(errno));
+    }
+    if (child == 0)
+    {
+        ::close(pipeFds[0]);
+        int64_t elapsed = -1;
+        try
+        {
+            FileAnalyzer analyzer;
+            analyzer.setJobs(options.jobs);
+            analyzer.setBackend(options.backend);
+            analyzer.setScanOrder(order);
+            if (traced)
+            {
+                ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+                raise(SIGSTOP);
+            }
+            const int64_t start = monotonicNs();
+            analyzer.analyze(root);
+            elapsed = monotonicNs() - start;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Scan failed: " << e.what() << std::endl;
+        }
+        const ssize_t written = ::write(pipeFds[1], &elapsed, sizeof(elapsed));
+        _exit(written == sizeof(elapsed) && elapsed >= 0 ? 0 : 1);
+    }
+    ::close(pipeFds[1]);
+
+    RunResult result;
+    int exitCode = 0;
+    if (traced)
+    {
+        result.syscalls = traceSyscalls(child, exitCode);
+    }
+    else
+    {
+        int status = 0;
+        struct rusage usage;
+        ::wait4(child, &status, 0, &usage);
+        exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        result.peakRssKb = usage.ru_maxrss;
+    }
+    const ssize_t got = ::read(pipeFds[0], &result.elapsedNs, sizeof(result.elapsedNs));
+    ::close(pipeFds[0]);
+    if (exitCode != 0 || got != sizeof(result.elapsedNs))
+    {
+        throw std::runtime_error("Benchmark scan of " + root + " failed");
+    }
+    return result;
+}
+
+// Drop the page cache and the dentry and inode caches; false if not permitted
+bool dropCaches()
+{
+    ::sync();
+    std::ofstream control("/proc/sys/vm/drop_caches");
+    control << "3" << std::endl;
+    return static_cast<bool>(control);
+}
+
+void printRow(const std::string &shape, const TreeInfo &info, ScanOrder order, const char *cache,
+              const std::vector<RunResult> &runs, unsigned long long syscalls)
+{
+    std::vector<int64_t> times;
+    long peakRssKb = 0;
+    for (const auto &run : runs)
+    {
+        times.push_back(run.elapsedNs);
+        peakRssKb = std::max(peakRssKb, run.peakRssKb);
+    }
+    std::sort(times.begin(), times.end());
+    const double seconds = times[times.size() / 2] / 1e9;
+
+    std::cout << std::left << std::setw(8) << shape << std::right
+              << std::setw(10) << info.files << std::setw(8) << info.dirs << std::setw(9) << scanOrderName(order)
+              << std::setw(7) << cache
+              << std::fixed << std::setprecision(1) << std::setw(12) << seconds * 1e3
+              << std::setprecision(0) << std::setw(13) << info.files / std::max(seconds, 1e-9);
+    if (syscalls != 0)
+    {
+        std::cout << std::setw(11) << syscalls << std::setprecision(2) << std::setw(10)
+                  << static_cast<double>(syscalls) / std::max<size_t>(info.files, 1);
+    }
+    else
+    {
+        std::cout << std::setw(11) << "-" << std::setw(10) << "-";
+    }
+    std::cout << std::setprecision(1) << std::setw(10) << peakRssKb / 1024.0 << " MB\n";
+}
+
+Options parseOptions(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const auto value = [&]() -> std::string
+        {
+            if (++i >= argc)
+            {
+                throw std::runtime_error("Error: " + arg + " option requires a value");
+            }
+            return argv[i];
+        };
+        if (arg == "--files")
+        {
+            options.files = parseCount(value());
+        }
+        else if (arg == "--runs")
+        {
+            options.runs = parseCount(value());
+        }
+        else if (arg == "-j" || arg == "--jobs")
+        {
+            options.jobs = parseCount(value());
+        }
+        else if (arg == "-b" || arg == "--backend")
+        {
+            options.backend = parseBackend(value());
+        }
+        else if (arg == "--order")
+        {
+            options.orders.push_back(parseScanOrder(value()));
+        }
+        else if (arg == "--shape")
+        {
+            options.shapes.push_back(value());
+        }
+        else if (arg == "--dir")
+        {
+            options.dir = value();
+        }
+        else if (arg == "--keep")
+        {
+            options.keep = true;
+        }
+        else
+        {
+            throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+    if (options.orders.empty())
+    {
+        options.orders.push_back(ScanOrder::Readdir);
+    }
+    if (options.shapes.empty())
+    {
+        for (const auto &shape : SHAPES)
+        {
+            options.shapes.push_back(shape.name);
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        Options options = parseOptions(argc, argv);
+        const bool temporary = options.dir.empty();
+        if (temporary)
+        {
+            char pattern[] = "/tmp/da_bench.XXXXXX";
+            if (::mkdtemp(pattern) == nullptr)
+            {
+                throw std::runtime_error(std::string("mkdtemp: ") + std::strerror(errno));
+            }
+            options.dir = pattern;
+        }
+
+        std::cout << "Backend " << backendName(options.backend) << ", " << options.jobs << " job(s), "
+                  << options.runs << " run(s) per measurement, trees in " << options.dir << "\n";
+        struct stat st;
+        if (::stat(options.dir.c_str(), &st) == 0)
+        {
+            std::cout << "Trees are on " << (isRotational(st.st_dev) ? "a spinning disk" : "a non-rotational device")
+                      << "\n";
+        }
+        for (const auto &shape : SHAPES)
+        {
+            std::cout << "  " << std::left << std::setw(8) << shape.name << shape.description << "\n";
+        }
+        std::cout << std::left << std::setw(8) << "shape" << std::right << std::setw(10) << "files" << std::setw(8)
+                  << "dirs" << std::setw(9) << "order" << std::setw(7) << "cache" << std::setw(12) << "median ms" << std::setw(13) << "files/s"
+                  << std::setw(11) << "syscalls" << std::setw(10) << "per file" << std::setw(13) << "peak RSS" << "\n";
+
+        bool coldSkipped = false;
+        for (const auto &shape : options.shapes)
+        {
+            const std::string root = options.dir + "/" + shape + "-" + std::to_string(options.files);
+            std::error_code ec;
+            fs::remove_all(root, ec);
+            const TreeInfo info = buildTree(shape, root, options.files);
+
+            for (const ScanOrder order : options.orders)
+            {
+                runScan(root, options, order, false); // warm-up
+                std::vector<RunResult> warm;
+                for (size_t run = 0; run < options.runs; run++)
+                {
+                    warm.push_back(runScan(root, options, order, false));
+                }
+                printRow(shape, info, order, "warm", warm, runScan(root, options, order, true).syscalls);
+
+                std::vector<RunResult> cold;
+                for (size_t run = 0; run < options.runs && dropCaches(); run++)
+                {
+                    cold.push_back(runScan(root, options, order, false));
+                }
+                if (cold.empty())
+                {
+                    coldSkipped = true;
+                }
+                else
+                {
+                    printRow(shape, info, order, "cold", cold, 0);
+                }
+            }
+
+            if (!options.keep)
+            {
+                fs::remove_all(root, ec);
+            }
+        }
+
+        if (coldSkipped)
+        {
+            std::cout << "Cold-cache runs skipped: dropping caches needs root\n";
+        }
+        if (temporary && !options.keep)
+        {
+            std::error_code ec;
+            fs::remove_all(options.dir, ec);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+// Count the system calls of a traced child process and all of its threads.
+// The child must have called ptrace(PTRACE_TRACEME) and stopped itself with SIGSTOP;
+// tracing starts from that stop, so work done before it is not counted.
+#pragma once
+
+#include <cerrno>
+#include <csignal>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// Trace child until it exits; returns the number of system calls and sets exitCode
+inline unsigned long long traceSyscalls(pid_t child, int &exitCode)
+{
+    int status = 0;
+    waitpid(child, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, child, nullptr,
+           PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, child, nullptr, nullptr);
+
+    // Every syscall produces an entry and an exit stop; count entries per thread
+    unsigned long long stops = 0;
+    exitCode = 0;
+    while (true)
+    {
+        pid_t pid = waitpid(-1, &status, __WALL);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            if (pid == child)
+            {
+                exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            }
+            continue;
+        }
+
+        int signal = 0;
+        if (WIFSTOPPED(status))
+        {
+            int stopSignal = WSTOPSIG(status);
+            if (stopSignal == (SIGTRAP | 0x80))
+            {
+                stops++;
+            }
+            else if (stopSignal != SIGTRAP && stopSignal != SIGSTOP)
+            {
+                signal = stopSignal;
+            }
+        }
+        ptrace(PTRACE_SYSCALL, pid, nullptr, reinterpret_cast<void *>(static_cast<long>(signal)));
+    }
+
+    return (stops + 1) / 2;
+}
@@ -0,0 +1,173 @@
+// End-to-end wall time of short da runs, as a script would invoke them.
+// Usage: startup_bench [--da path] [--files N] [--runs N]
+// Builds one flat directory of N small files (100 by default), then spawns da on it with each
+// output format, stdout to /dev/null, and reports the median and 90th percentile from spawn
+// to exit. /bin/true is timed the same way: the cost of starting any process, which no
+// change to da can remove. da defaults to the binary next to this one; point --da at a
+// -DDA_STATIC_RUNTIME=ON build to see what skipping the load of libstdc++ saves.
+#include "../analyzer.h"
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+using namespace da;
+
+namespace
+{
+
+struct Options
+{
+    std::string da;
+    size_t files = 100;
+    size_t runs = 200;
+};
+
+struct Case
+{
+    const char *name;
+    std::vector<std::string> arguments; // after the program, before the directory
+};
+
+const char *const EXTENSIONS[] = {".c", ".h", ".txt", ".log", ".JPG"};
+
+Options parseOptions(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const auto value = [&]() -> std::string
+        {
+            if (++i >= argc)
+            {
+                throw std::runtime_error(arg + " requires a value");
+            }
+            return argv[i];
+        };
+        if (arg == "--da")
+        {
+            options.da = value();
+        }
+        else if (arg == "--files")
+        {
+            options.files = parseCount(value());
+        }
+        else if (arg == "--runs")
+        {
+            options.runs = std::max<size_t>(parseCount(value()), 1);
+        }
+        else
+        {
+            throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+    if (options.da.empty())
+    {
+        options.da = (fs::read_symlink("/proc/self/exe").parent_path() / "da").string();
+    }
+    return options;
+}
+
+// Spawn program with arguments, stdout and stderr on /dev/null, and wait for it to exit;
+// returns the nanoseconds from spawn to exit
+int64_t runOnce(const std::vector<std::string> &command)
+{
+    std::vector<char *> argv;
+    for (const auto &argument : command)
+    {
+        argv.push_back(const_cast<char *>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    const int64_t start = monotonicNs();
+    pid_t child;
+    const int error = posix_spawn(&child, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0)
+    {
+        throw std::runtime_error("Cannot run " + command[0] + ": " + std::strerror(error));
+    }
+    int status = 0;
+    ::waitpid(child, &status, 0);
+    const int64_t elapsed = monotonicNs() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        throw std::runtime_error(command[0] + " failed");
+    }
+    return elapsed;
+}
+
+// Median and 90th percentile of runs, after one untimed run that loads the binary into the
+// page cache
+std::pair<double, double> timeCommand(const std::vector<std::string> &command, size_t runs)
+{
+    runOnce(command);
+    std::vector<int64_t> samples;
+    for (size_t run = 0; run < runs; run++)
+    {
+        samples.push_back(runOnce(command));
+    }
+    std::sort(samples.begin(), samples.end());
+    return {samples[samples.size() / 2] / 1e6, samples[samples.size() * 9 / 10] / 1e6};
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        const Options options = parseOptions(argc, argv);
+        char pattern[] = "/tmp/startup_bench.XXXXXX";
+        if (::mkdtemp(pattern) == nullptr)
+        {
+            throw std::runtime_error(std::string("mkdtemp: ") + std::strerror(errno));
+        }
+        const std::string root = pattern;
+        for (size_t i = 0; i < options.files; i++)
+        {
+            const std::string path = root + "/file" + std::to_string(i) + EXTENSIONS[i % std::size(EXTENSIONS)];
+            std::ofstream(path) << i << "\n";
+        }
+
+        const Case cases[] = {
+            {"table", {}},
+            {"tsv", {"--format", "tsv"}},
+            {"json", {"--format", "json"}},
+            {"quiet", {"-q"}},
+            {"json -j 4", {"--format", "json", "-j", "4"}},
+        };
+        std::cout << options.da << " on " << options.files << " files, median of " << options.runs
+                  << " runs from spawn to exit\n"
+                  << std::left << std::setw(12) << "command" << std::right << std::setw(12) << "median ms"
+                  << std::setw(10) << "p90 ms" << "\n";
+        const auto printRow = [](const std::string &name, std::pair<double, double> times)
+        {
+            std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(12) << times.first << std::setw(10) << times.second << "\n";
+        };
+        printRow("/bin/true", timeCommand({"/bin/true"}, options.runs));
+        for (const auto &run : cases)
+        {
+            std::vector<std::string> command = {options.da};
+            command.insert(command.end(), run.arguments.begin(), run.arguments.end());
+            command.push_back(root);
+            printRow(run.name, timeCommand(command, options.runs));
+        }
+
+        std::error_code ec;
+        fs::remove_all(root, ec);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
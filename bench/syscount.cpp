@@ -0,0 +1,38 @@
+// Count the system calls made by a command and all of its threads using ptrace.
+// Usage: syscount <command> [args...]
+// The command's own output is left untouched; the count is printed to stderr as
+// "syscalls: N" once the command exits.
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "ptrace_count.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <command> [args...]\n", argv[0]);
+        return 2;
+    }
+
+    pid_t child = fork();
+    if (child < 0)
+    {
+        std::perror("fork");
+        return 2;
+    }
+    if (child == 0)
+    {
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+        execvp(argv[1], argv + 1);
+        std::perror("execvp");
+        _exit(127);
+    }
+
+    int exitCode = 0;
+    const unsigned long long syscalls = traceSyscalls(child, exitCode);
+    std::fprintf(stderr, "syscalls: %llu\n", syscalls);
+    return exitCode;
+}
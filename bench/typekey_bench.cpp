@@ -0,0 +1,291 @@
+// Microbenchmark of the fileTypeKey() kernels on synthetic file names.
+// Usage: typekey_bench [--names N] [--runs N] [--set name]...
+// Names are generated from a fixed seed and stored back to back, like a directory listing.
+// Every kernel the CPU supports is first checked against the scalar version, on the name
+// sets and on random bytes placed against an unreadable page, then timed over each set;
+// the median of the runs is reported in nanoseconds per name.
+#include "../analyzer.h"
+
+#include <random>
+
+using namespace da;
+
+namespace
+{
+
+struct NameSet
+{
+    const char *name;
+    const char *description;
+};
+
+const NameSet NAME_SETS[] = {
+    {"scripts", "short source and script names, some upper case"},
+    {"logs", "rotated and dated log names with several dots"},
+    {"long", "names of 40 to 200 bytes, a few with long extensions"},
+    {"mixed", "all of the above plus dotfiles and names without a dot"},
+};
+
+struct Options
+{
+    size_t names = 1000000;
+    size_t runs = 5;
+    std::vector<std::string> sets;
+};
+
+const char *const SCRIPT_EXTENSIONS[] = {".sh", ".py", ".PY", ".js", ".ts", ".rb", ".pl", ".lua", ".c", ".h", ".cpp", ".Go"};
+const char *const LOG_SUFFIXES[] = {".log", ".LOG", ".log.1", ".log.gz", ".out", ".err", ".log.10", ".txt"};
+
+std::string randomWord(std::mt19937_64 &random, size_t length)
+{
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-";
+    std::string word;
+    for (size_t i = 0; i < length; i++)
+    {
+        word += letters[random() % (sizeof(letters) - 1)];
+    }
+    return word;
+}
+
+std::string makeName(const std::string &set, std::mt19937_64 &random)
+{
+    if (set == "scripts")
+    {
+        return randomWord(random, 3 + random() % 10) + SCRIPT_EXTENSIONS[random() % std::size(SCRIPT_EXTENSIONS)];
+    }
+    if (set == "logs")
+    {
+        return randomWord(random, 4 + random() % 8) + "-20" + std::to_string(10 + random() % 15) + "-0" +
+               std::to_string(1 + random() % 9) + LOG_SUFFIXES[random() % std::size(LOG_SUFFIXES)];
+    }
+    if (set == "long")
+    {
+        std::string name = randomWord(random, 40 + random() % 160);
+        return random() % 8 == 0 ? name + "." + randomWord(random, 20 + random() % 60) : name + ".Dat";
+    }
+    switch (random() % 6)
+    {
+    case 0:
+        return "." + randomWord(random, 3 + random() % 8);
+    case 1:
+        return randomWord(random, 4 + random() % 12);
+    case 2:
+        return makeName("logs", random);
+    case 3:
+        return makeName("long", random);
+    default:
+        return makeName("scripts", random);
+    }
+}
+
+// Names stored NUL-terminated back to back, as DirListing keeps them
+struct NameList
+{
+    std::vector<char> bytes;
+    std::vector<std::pair<size_t, size_t>> names; // offset and length
+
+    void add(const std::string &name)
+    {
+        names.emplace_back(bytes.size(), name.size());
+        bytes.insert(bytes.end(), name.begin(), name.end());
+        bytes.push_back('\0');
+    }
+
+    std::string_view operator[](size_t i) const
+    {
+        return std::string_view(bytes.data() + names[i].first, names[i].second);
+    }
+};
+
+// Whether kernel agrees with the scalar version on every name of list
+bool agrees(const TypeKeyKernel &kernel, const NameList &list)
+{
+    TypeKeyBuffer expected;
+    TypeKeyBuffer actual;
+    for (size_t i = 0; i < list.names.size(); i++)
+    {
+        if (fileTypeKeyScalar(list[i], expected) != kernel.function(list[i], actual))
+        {
+            std::cerr << kernel.name << " differs on \"" << list[i] << "\"\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Check kernel on random bytes, including the characters around 'A'-'Z' and bytes above 127,
+// with every name ending right before a page that cannot be read
+bool agreesOnRandomBytes(const TypeKeyKernel &kernel)
+{
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    char *pages = static_cast<char *>(::mmap(nullptr, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (pages == MAP_FAILED || ::mprotect(pages + page, page, PROT_NONE) != 0)
+    {
+        throw std::runtime_error("Cannot map guard page: " + std::string(std::strerror(errno)));
+    }
+    static const char alphabet[] = {'.', '.', 'a', 'z', 'A', 'Z', '@', '[', '`', '{', '0', '_',
+                                    static_cast<char>(0x80), static_cast<char>(0xC3), static_cast<char>(0xFF)};
+    std::mt19937_64 random(42);
+    TypeKeyBuffer expected;
+    TypeKeyBuffer actual;
+    bool ok = true;
+    for (size_t round = 0; round < 200000 && ok; round++)
+    {
+        const size_t length = random() % 300;
+        char *name = pages + page - length;
+        for (size_t i = 0; i < length; i++)
+        {
+            name[i] = alphabet[random() % sizeof(alphabet)];
+        }
+        const std::string_view view(name, length);
+        if (fileTypeKeyScalar(view, expected) != kernel.function(view, actual))
+        {
+            std::cerr << kernel.name << " differs on random name of " << length << " bytes\n";
+            ok = false;
+        }
+    }
+    ::munmap(pages, 2 * page);
+    return ok;
+}
+
+// Median nanoseconds per name for kernel over list
+double timeKernel(const TypeKeyKernel &kernel, const NameList &list, size_t runs)
+{
+    std::vector<double> samples;
+    TypeKeyBuffer buffer;
+    size_t checksum = 0;
+    for (size_t run = 0; run < runs + 1; run++)
+    {
+        const int64_t start = monotonicNs();
+        for (size_t i = 0; i < list.names.size(); i++)
+        {
+            const std::string_view key = kernel.function(list[i], buffer);
+            checksum += key.size() + static_cast<unsigned char>(key.back());
+        }
+        const int64_t elapsed = monotonicNs() - start;
+        if (run > 0) // the first run warms caches and the branch predictor
+        {
+            samples.push_back(static_cast<double>(elapsed) / static_cast<double>(list.names.size()));
+        }
+    }
+    // Keep the loop from being optimized away
+    if (checksum == 0)
+    {
+        std::cerr << "";
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+Options parseOptions(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const auto value = [&]() -> std::string
+        {
+            if (++i >= argc)
+            {
+                throw std::runtime_error(arg + " requires a value");
+            }
+            return argv[i];
+        };
+        if (arg == "--names")
+        {
+            options.names = parseCount(value());
+        }
+        else if (arg == "--runs")
+        {
+            options.runs = parseCount(value());
+        }
+        else if (arg == "--set")
+        {
+            const std::string set = value();
+            if (std::none_of(std::begin(NAME_SETS), std::end(NAME_SETS), [&set](const NameSet &known)
+                             { return set == known.name; }))
+            {
+                throw std::runtime_error("Unknown name set: " + set);
+            }
+            options.sets.push_back(set);
+        }
+        else
+        {
+            throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+    if (options.sets.empty())
+    {
+        for (const auto &set : NAME_SETS)
+        {
+            options.sets.push_back(set.name);
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        const Options options = parseOptions(argc, argv);
+        const std::vector<TypeKeyKernel> kernels = typeKeyKernels();
+        std::cout << options.names << " names per set, median of " << options.runs
+                  << " runs; fileTypeKey() uses " << typeKeyKernel().name << "\n";
+        for (const auto &set : NAME_SETS)
+        {
+            std::cout << "  " << std::left << std::setw(8) << set.name << set.description << "\n";
+        }
+
+        std::vector<NameList> lists;
+        for (const auto &set : options.sets)
+        {
+            std::mt19937_64 random(1);
+            NameList list;
+            for (size_t i = 0; i < options.names; i++)
+            {
+                list.add(makeName(set, random));
+            }
+            lists.push_back(std::move(list));
+        }
+        for (const auto &kernel : kernels)
+        {
+            bool ok = agreesOnRandomBytes(kernel);
+            for (const auto &list : lists)
+            {
+                ok = ok && agrees(kernel, list);
+            }
+            if (!ok)
+            {
+                return 1;
+            }
+        }
+
+        std::cout << "\n"
+                  << std::left << std::setw(10) << "set" << std::setw(10) << "kernel" << std::right
+                  << std::setw(12) << "ns/name" << std::setw(14) << "Mnames/s" << std::setw(10) << "speedup" << "\n";
+        for (size_t s = 0; s < lists.size(); s++)
+        {
+            double scalar = 0;
+            for (const auto &kernel : kernels)
+            {
+                const double ns = timeKernel(kernel, lists[s], options.runs);
+                if (scalar == 0)
+                {
+                    scalar = ns;
+                }
+                std::cout << std::left << std::setw(10) << options.sets[s] << std::setw(10) << kernel.name << std::right
+                          << std::fixed << std::setprecision(2) << std::setw(12) << ns << std::setw(14) << 1000 / ns
+                          << std::setw(9) << scalar / ns << "x" << "\n";
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
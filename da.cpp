@@ -1,514 +1,2167 @@
-#include <iostream>
-#include <filesystem>
-#include <unordered_map>
-#include <vector>
-#include <algorithm>
-#include <iomanip>
-#include <cstring>
-#include <fstream>
-#include <sstream>
-#include <set>
-#include <limits>
-
-namespace fs = std::filesystem;
-
-// ANSI color codes for console output
-const std::string RESET = "\033[0m";
-const std::string RED = "\033[31m";
-const std::string GREEN = "\033[32m";
-const std::string YELLOW = "\033[33m";
-const std::string BLUE = "\033[34m";
-const std::string MAGENTA = "\033[35m";
-const std::string CYAN = "\033[36m";
-
-// Maximum memory limit for stats (100MB)
-const size_t MAX_MEMORY_LIMIT = 100 * 1024 * 1024;
-
-// Structure to store file size threshold
-struct SizeThreshold
-{
-    size_t minSize = 0;
-    size_t maxSize = std::numeric_limits<size_t>::max();
-
-    bool isValid() const
-    {
-        return minSize <= maxSize;
-    }
-};
+#include "analyzer.h"
+
+#ifdef __linux__
+#include <csignal>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#ifdef DA_COUNT_ALLOCATIONS
+// Build with -DDA_COUNT_ALLOCATIONS to count heap allocations; main() reports how many were
+// made per directory entry during the scan
+std::atomic<size_t> heapAllocations{0};
 
-// Safe string to lowercase conversion
-std::string safeToLower(const std::string &input)
+void *operator new(size_t size)
 {
-    std::string result;
-    for (unsigned char ch : input)
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *block = std::malloc(size == 0 ? 1 : size))
     {
-        result += std::tolower(ch);
+        return block;
     }
-    return result;
+    throw std::bad_alloc();
 }
 
-// Convert human-readable size to bytes with validation
-size_t parseSize(const std::string &sizeStr)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // malloc/free back the replaced operators
+#endif
+
+void operator delete(void *block) noexcept
 {
-    std::istringstream iss(sizeStr);
-    double value;
-    std::string unit;
+    std::free(block);
+}
 
-    if (!(iss >> value) || value < 0)
-    {
-        throw std::runtime_error("Invalid size value: " + sizeStr);
-    }
-    iss >> unit;
+void operator delete(void *block, size_t) noexcept
+{
+    std::free(block);
+}
+#endif
+
+using namespace da;
+
+// ANSI color codes for console output; empty after setColors(false)
+std::string RESET = "\033[0m";
+std::string RED = "\033[31m";
+std::string GREEN = "\033[32m";
+std::string YELLOW = "\033[33m";
+std::string BLUE = "\033[34m";
+std::string MAGENTA = "\033[35m";
+std::string CYAN = "\033[36m";
 
-    std::transform(unit.begin(), unit.end(), unit.begin(), ::toupper);
+// Turn the color codes on or off, for output that goes to a pipe or a file; call it before
+// any other thread prints
+void setColors(bool enabled)
+{
+    RESET = enabled ? "\033[0m" : "";
+    RED = enabled ? "\033[31m" : "";
+    GREEN = enabled ? "\033[32m" : "";
+    YELLOW = enabled ? "\033[33m" : "";
+    BLUE = enabled ? "\033[34m" : "";
+    MAGENTA = enabled ? "\033[35m" : "";
+    CYAN = enabled ? "\033[36m" : "";
+}
 
-    if (unit == "B" || unit.empty())
-        return static_cast<size_t>(value);
-    if (unit == "KB" || unit == "K")
-        return static_cast<size_t>(value * 1024);
-    if (unit == "MB" || unit == "M")
-        return static_cast<size_t>(value * 1024 * 1024);
-    if (unit == "GB" || unit == "G")
-        return static_cast<size_t>(value * 1024 * 1024 * 1024);
-    if (unit == "TB" || unit == "T")
-        return static_cast<size_t>(value * 1024 * 1024 * 1024 * 1024);
+// The analyzer behind the command line: per-type totals plus every optional report
+using CliAnalyzer = BasicFileAnalyzer<Aggregators<TopFilesAggregator, TopDirsAggregator, DuplicateAggregator, ExportAggregator, LiveAggregator, GroupByAggregator>>;
 
-    throw std::runtime_error("Invalid size unit: " + unit);
+// Colored output only on a terminal, and never with NO_COLOR set
+bool colorsOnTerminal()
+{
+#ifdef __linux__
+    return isatty(STDOUT_FILENO) && !std::getenv("NO_COLOR");
+#else
+    return !std::getenv("NO_COLOR");
+#endif
 }
 
-// Structure to store statistics for each file type with safe arithmetic
-struct FileTypeStats
+// Progress lines on stderr: redrawn in place on a terminal, one per report otherwise
+bool progressOnTerminal()
 {
-    size_t count = 0;
-    size_t totalSize = 0;
+#ifdef __linux__
+    return isatty(STDERR_FILENO);
+#else
+    return false;
+#endif
+}
 
-    void update(const size_t size)
+void printProgress(const ScanProgress &report, bool terminal)
+{
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(0)
+         << report.files << " files (" << report.filesPerSecond << "/s), "
+         << report.dirs << " dirs (" << report.dirsPerSecond << "/s), "
+         << formatSize(report.bytes) << ", queue " << report.queued;
+    if (report.adaptive)
     {
-        if (count == std::numeric_limits<size_t>::max())
+        const ConcurrencyController::Decision &decision = report.concurrency;
+        line << ", " << decision.workers << "/" << report.maxWorkers << " workers";
+        if (report.maxDepth > 1)
         {
-            throw std::overflow_error("File count overflow");
+            line << " x " << decision.depth << "/" << report.maxDepth << " deep";
         }
-        count++;
-
-        if (totalSize > std::numeric_limits<size_t>::max() - size)
+        if (decision.latencyNs < 1e6)
+        {
+            line << ", " << decision.latencyNs / 1e3 << "us/op";
+        }
+        else
         {
-            throw std::overflow_error("Total size overflow");
+            line << std::setprecision(1) << ", " << decision.latencyNs / 1e6 << "ms/op";
         }
-        totalSize += size;
+        line << ": " << decision.action << " (" << decision.reason << ")";
     }
-};
+    if (!report.slowestPath.empty())
+    {
+        line << std::setprecision(1) << ", slowest: " << report.slowestPath << " (" << report.slowestSeconds << "s)";
+    }
+    if (terminal)
+    {
+        std::cerr << "\r\033[K" << BLUE << line.str() << RESET << std::flush;
+    }
+    else
+    {
+        std::cerr << line.str() << std::endl;
+    }
+}
 
-class FileAnalyzer
+// Log2 histogram of the sizes of every reported file, as a bar chart
+void printHistogram(const ScanTotals &totals)
 {
-private:
-    std::unordered_map<std::string, FileTypeStats> stats;
-    size_t totalFiles = 0;
-    size_t totalSize = 0;
-    size_t hiddenFiles = 0;
-    size_t hiddenSize = 0;
-    std::vector<fs::path> excludeDirs;
-    std::set<std::string> includeTypes;
-    bool showHidden = false;
-    SizeThreshold sizeThreshold;
+    SizeSketch all;
+    totals.forEachType([&all](const std::string &, const FileTypeStats &stat)
+                       { all.merge(stat.sketch); });
+    const std::vector<uint64_t> slots = all.powersOfTwo();
+    const uint64_t peak = *std::max_element(slots.begin(), slots.end());
+    if (peak == 0)
+    {
+        return;
+    }
 
-    // Determine the file type based on its extension with proper handling
-    static std::string getFileType(const fs::path &path)
+    std::cout << "\n"
+              << YELLOW << "Size distribution:" << RESET << "\n";
+    for (size_t k = 0; k < slots.size(); k++)
     {
-        if (path.empty())
+        if (slots[k] == 0)
         {
-            return "[invalid]";
+            continue;
         }
+        const std::string range = k == 0 ? "0 B" : "< " + formatSize(k < 64 ? uint64_t(1) << k : std::numeric_limits<uint64_t>::max());
+        const size_t bar = std::max<size_t>(1, static_cast<size_t>(slots[k] * 40 / peak));
+        std::cout << GREEN << std::setw(14) << std::right << range
+                  << std::setw(12) << slots[k] << " " << CYAN << std::string(bar, '#') << RESET << "\n";
+    }
+}
 
-        std::string filename = path.filename().string();
-        if (filename.empty())
+// Files and bytes per mount point, when the scan reached more than one
+void printMounts(const std::vector<MountUsage> &mounts)
+{
+    const size_t reached = std::count_if(mounts.begin(), mounts.end(), [](const MountUsage &mount)
+                                         { return mount.files > 0 || mount.size > 0; });
+    if (reached < 2)
+    {
+        return;
+    }
+    std::cout << "\n"
+              << YELLOW << "By mount point:" << RESET << "\n";
+    for (const auto &mount : mounts)
+    {
+        if (mount.files == 0 && mount.size == 0)
         {
-            return "[invalid]";
+            continue;
         }
+        std::cout << GREEN << std::setw(12) << std::right << formatSize(mount.size) << std::setw(10) << mount.files
+                  << " files  " << CYAN << mount.mountPoint << BLUE << " (" << (mount.type.empty() ? "unknown" : mount.type)
+                  << ", " << mount.jobs << (mount.jobs == 1 ? " worker" : " workers") << ")" << RESET << "\n";
+    }
+}
 
-        std::string ext = path.extension().string();
-        ext = safeToLower(ext);
-
-        // Handle dotfiles
-        if (filename[0] == '.')
+void printDuplicates(const DuplicateAggregator &duplicates)
+{
+    const auto &groups = duplicates.groups();
+    const auto &stats = duplicates.stats();
+    size_t redundant = 0;
+    uint64_t reclaimable = 0;
+    for (const auto &group : groups)
+    {
+        redundant += group.paths.size() - 1;
+        reclaimable += group.size * (group.paths.size() - 1);
+    }
+    std::cout << "\n"
+              << YELLOW << "Duplicate files: " << groups.size() << " groups, " << redundant
+              << " redundant copies, " << formatSize(reclaimable) << " reclaimable" << RESET << "\n";
+    std::cout << BLUE << "Of " << stats.candidates << " files, " << stats.sizeMatches
+              << " shared a size and " << stats.partialMatches << " matched on their first and last 4 KB; "
+              << formatSize(stats.bytesRead) << " read" << RESET << "\n";
+    for (const auto &group : groups)
+    {
+        std::cout << GREEN << formatSize(group.size) << " x " << group.paths.size() << RESET << "\n";
+        for (const auto &path : group.paths)
         {
-            if (filename == ext)
-            {
-                return "[dotfile]";
-            }
-            return !ext.empty() ? ext : "[dotfile]";
+            std::cout << CYAN << "  " << path << RESET << "\n";
         }
-
-        return ext.empty() ? "[no extension]" : ext;
     }
+}
 
-    // Format file size with proper unit handling
-    static std::string formatSize(size_t bytes)
+void printTopList(const std::string &title, const TopList &list)
+{
+    if (!list.enabled())
+    {
+        return;
+    }
+    std::cout << "\n"
+              << YELLOW << title << ":" << RESET << "\n";
+    for (const auto &entry : list.sorted())
     {
-        const char *units[] = {"B", "KB", "MB", "GB", "TB"};
-        int unit = 0;
-        double size = static_cast<double>(bytes);
+        std::cout << GREEN << std::setw(12) << std::right << formatSize(entry.size)
+                  << CYAN << "  " << entry.path << RESET << "\n";
+    }
+}
 
-        while (size >= 1024 && unit < 4)
-        {
-            size /= 1024;
-            unit++;
-        }
+// Width of a --group-by dimension's column in the pivot table
+int groupColumnWidth(GroupDimension dimension)
+{
+    switch (dimension)
+    {
+    case GroupDimension::Ext:
+        return 20;
+    case GroupDimension::Uid:
+    case GroupDimension::Gid:
+        return 12;
+    default:
+        return 8;
+    }
+}
 
-        std::ostringstream oss;
-        oss << std::fixed << std::setprecision(2) << size << " " << units[unit];
-        return oss.str();
+// Header of a --group-by dimension's CSV column
+const char *groupCsvColumn(GroupDimension dimension)
+{
+    switch (dimension)
+    {
+    case GroupDimension::Uid:
+        return "Uid";
+    case GroupDimension::Gid:
+        return "Gid";
+    case GroupDimension::Age:
+        return "ModifiedAge";
+    case GroupDimension::Atime:
+        return "AccessedAge";
+    case GroupDimension::Depth:
+        return "Depth";
+    default:
+        return "FileType";
     }
+}
 
-    // Improved path exclusion check
-    bool shouldExclude(const fs::path &path) const
+// The --group-by pivot: one row per combination of the dimensions, largest first
+void printGroups(const GroupByAggregator &groups, bool diskUsage)
+{
+    const std::vector<GroupDimension> &dimensions = groups.groupedBy();
+    if (dimensions.empty())
     {
-        try
+        return;
+    }
+    std::vector<std::pair<std::string, int>> columns;
+    std::string title;
+    for (const GroupDimension dimension : dimensions)
+    {
+        columns.push_back({groupDimensionInfo(dimension).name, groupColumnWidth(dimension)});
+        title += (title.empty() ? "" : ", ") + columns.back().first;
+    }
+    const size_t keyColumns = columns.size();
+    columns.insert(columns.end(), {{"Count", 15}, {"Total Size", 20}});
+    if (diskUsage)
+    {
+        columns.push_back({"Allocated", 12});
+    }
+    const auto printSeparator = [&columns]()
+    {
+        std::cout << CYAN;
+        for (const auto &column : columns)
         {
-            for (const auto &dir : excludeDirs)
-            {
-                if (fs::equivalent(path, dir) ||
-                    fs::equivalent(path.parent_path(), dir) ||
-                    path.string().find(dir.string() + fs::path::preferred_separator) == 0)
-                {
-                    return true;
-                }
-            }
+            std::cout << "+" << std::string(column.second, '-');
         }
-        catch (const fs::filesystem_error &)
+        std::cout << "+" << RESET << "\n";
+    };
+    const auto printRow = [&](const std::vector<std::string> &cells, const std::string &color)
+    {
+        for (size_t i = 0; i < columns.size(); i++)
         {
-            // If we can't check equivalence, fall back to string comparison
-            std::string pathStr = path.string();
-            for (const auto &dir : excludeDirs)
+            std::cout << CYAN << "|" << color << std::setw(columns[i].second);
+            if (i < keyColumns)
             {
-                if (pathStr.find(dir.string() + fs::path::preferred_separator) == 0)
-                {
-                    return true;
-                }
+                std::cout << std::left << " " + cells[i];
+            }
+            else
+            {
+                std::cout << std::right << cells[i];
             }
         }
-        return false;
-    }
+        std::cout << CYAN << "|" << RESET << "\n";
+    };
 
-    // Check if a file type should be included
-    bool shouldInclude(const std::string &fileType) const
+    std::cout << "\n"
+              << YELLOW << "Grouped by " << title << ":" << RESET << "\n";
+    printSeparator();
+    std::vector<std::string> header;
+    for (const auto &column : columns)
+    {
+        header.push_back(column.first);
+    }
+    printRow(header, YELLOW);
+    printSeparator();
+    for (const auto &group : groups.groups())
     {
-        if (includeTypes.empty())
+        std::vector<std::string> cells;
+        for (size_t i = 0; i < keyColumns; i++)
         {
-            return true;
+            cells.push_back(groups.label(group, i));
         }
-        return includeTypes.find(fileType) != includeTypes.end();
+        cells.push_back(std::to_string(group.totals.files));
+        cells.push_back(formatSize(group.totals.size));
+        if (diskUsage)
+        {
+            cells.push_back(formatSize(group.totals.allocated));
+        }
+        printRow(cells, GREEN);
     }
+    printSeparator();
+}
 
-    // Validate file size against thresholds
-    bool isWithinSizeThreshold(size_t size) const
+// Most frequent of the types lumped into [other types] once the memory budget ran out
+void printUntracked(const HeavyHitters &untracked)
+{
+    if (untracked.empty())
     {
-        return size >= sizeThreshold.minSize && size <= sizeThreshold.maxSize;
+        return;
     }
-
-    // Safe CSV field escaping
-    static std::string escapeCSV(const std::string &str)
+    std::cout << "\n"
+              << YELLOW << "Most common untracked types (approximate):" << RESET << "\n";
+    const auto counters = untracked.sorted();
+    for (size_t i = 0; i < counters.size() && i < 10; i++)
     {
-        if (str.find(',') != std::string::npos ||
-            str.find('"') != std::string::npos ||
-            str.find('\n') != std::string::npos)
+        const auto &counter = counters[i];
+        std::string count = std::to_string(counter.count);
+        if (counter.error > 0)
         {
-            std::string escaped = str;
-            std::replace(escaped.begin(), escaped.end(), '"', '"');
-            return "\"" + escaped + "\"";
+            count += " (+/- " + std::to_string(counter.error) + ")";
         }
-        return str;
+        std::cout << GREEN << std::setw(20) << std::right << count << std::setw(12) << formatSize(counter.size)
+                  << CYAN << "  " << counter.key << RESET << "\n";
     }
+}
 
-    // Calculate directory size
-    size_t calculateDirectorySize(const fs::path &dir) const
+// Half-width of a confidence interval as "+/- margin", in bytes or as a count
+std::string formatMargin(double margin, bool bytes)
+{
+    if (!std::isfinite(margin))
     {
-        size_t size = 0;
-        for (const auto &entry : fs::recursive_directory_iterator(dir, fs::directory_options::skip_permission_denied))
-        {
-            if (entry.is_regular_file())
-            {
-                size += entry.file_size();
-            }
-        }
-        return size;
+        return "+/- ?";
+    }
+    const size_t rounded = static_cast<size_t>(std::llround(margin));
+    return "+/- " + (bytes ? formatSize(rounded) : std::to_string(rounded));
+}
+
+// Refine line for a running --estimate, on stderr like the progress line
+void printEstimateProgress(const TreeEstimate &estimate, double z, bool terminal)
+{
+    std::ostringstream line;
+    line << "Estimate from " << estimate.probes << " probes (" << estimate.directoriesRead << " dirs read): "
+         << static_cast<size_t>(std::llround(estimate.mean(estimate.files))) << " files "
+         << formatMargin(estimate.margin(estimate.files, z), false) << ", "
+         << formatSize(static_cast<size_t>(std::llround(estimate.mean(estimate.size)))) << " "
+         << formatMargin(estimate.margin(estimate.size, z), true);
+    if (terminal)
+    {
+        std::cerr << "\r\033[K" << line.str() << std::flush;
     }
+    else
+    {
+        std::cerr << line.str() << std::endl;
+    }
+}
+
+volatile std::sig_atomic_t estimateStopRequested = 0;
 
-public:
-    FileAnalyzer(bool showHidden = false) : showHidden(showHidden) {}
+void requestEstimateStop(int)
+{
+    estimateStopRequested = 1;
+}
 
-    void addExcludeDir(const std::string &dir)
+// Print the table of results; after --estimate, counts and sizes come with the half-width of
+// their confidence interval at the given confidence
+void printResults(const CliAnalyzer &analyzer, double confidence = 0.95)
+{
+    const ScanTotals &totals = analyzer.results();
+    const bool diskUsage = analyzer.tracksDiskUsage();
+    const bool distributions = analyzer.tracksDistributions();
+    const TreeEstimate *estimate = analyzer.estimated();
+    const double z = estimate ? normalQuantile(confidence) : 0;
+    if (totals.totalFiles == 0)
     {
-        excludeDirs.push_back(fs::path(dir));
+        std::cout << RED << "No files found.\n"
+                  << RESET;
+        return;
     }
 
-    void addIncludeType(const std::string &type)
+    const auto sorted = analyzer.sortedStats();
+
+    // Print summary
+    std::cout << "\n"
+              << CYAN << "+" << std::string(60, '-') << "+" << RESET << "\n";
+    std::cout << CYAN << "| " << GREEN << std::left << std::setw(25) << "Total files: " + std::to_string(totals.totalFiles)
+              << CYAN << " | " << GREEN << std::left << std::setw(30) << "Total size: " + formatSize(totals.totalSize) << CYAN << " |" << RESET << "\n";
+    std::cout << CYAN << "+" << std::string(60, '-') << "+" << RESET << "\n";
+    if (estimate)
     {
-        includeTypes.insert(type.empty() ? "[no extension]" : type);
+        std::cout << BLUE << "Estimated from " << estimate->probes << " random probes (" << estimate->directoriesRead
+                  << " directories read, about " << std::llround(estimate->mean(estimate->directories))
+                  << " in the tree), " << confidence * 100 << "% confidence: files "
+                  << formatMargin(estimate->margin(estimate->files, z), false) << ", size "
+                  << formatMargin(estimate->margin(estimate->size, z), true) << RESET << "\n";
+    }
+    if (diskUsage)
+    {
+        std::cout << BLUE << "Apparent size: " << formatSize(totals.totalSize)
+                  << ", allocated on disk: " << formatSize(totals.allocatedSize) << RESET << "\n";
+        if (totals.linkedFiles > 0)
+        {
+            std::cout << BLUE << "Hard links counted once: " << totals.linkedFiles << " further links skipped ("
+                      << formatSize(totals.linkedSize) << ")" << RESET << "\n";
+        }
     }
+    std::cout << "\n";
 
-    void setSizeThreshold(const SizeThreshold &threshold)
+    // Columns after the file type; quantiles need the size sketches of --histogram
+    std::vector<std::pair<std::string, int>> columns = {
+        {"Count", estimate ? 24 : 15}, {"Total Size", estimate ? 26 : 20}, {"Average", 12}, {"Smallest", 12}, {"Largest", 12}};
+    if (diskUsage)
     {
-        if (!threshold.isValid())
+        columns.push_back({"Allocated", 12});
+    }
+    if (distributions)
+    {
+        columns.insert(columns.end(), {{"p50", 12}, {"p90", 12}, {"p99", 12}});
+    }
+    const auto printSeparator = [&columns]()
+    {
+        std::cout << CYAN << "+" << std::string(20, '-');
+        for (const auto &column : columns)
         {
-            throw std::runtime_error("Invalid size threshold: min size must be less than or equal to max size");
+            std::cout << "+" << std::string(column.second, '-');
         }
-        sizeThreshold = threshold;
+        std::cout << "+" << RESET << "\n";
+    };
+
+    // Print table header
+    printSeparator();
+    std::cout << CYAN << "|" << YELLOW << std::setw(20) << std::left << " File Type";
+    for (const auto &column : columns)
+    {
+        std::cout << CYAN << "|" << YELLOW << std::setw(column.second) << std::right << column.first;
     }
+    std::cout << CYAN << "|" << RESET << "\n";
+    printSeparator();
 
-    void analyze(const fs::path &path)
+    // Print table content; types without individual sizes (opaque directories) have no range
+    for (const auto &[fileType, stat] : sorted)
     {
-        std::error_code ec;
-        for (const auto &entry : fs::directory_iterator(path, fs::directory_options::skip_permission_denied, ec))
+        std::vector<std::string> cells = {std::to_string(stat.count), formatSize(stat.totalSize), formatSize(stat.averageSize())};
+        if (const TreeEstimate::TypeEstimate *typeEstimate = estimate ? estimate->find(fileType) : nullptr)
+        {
+            cells[0] += " " + formatMargin(estimate->margin(typeEstimate->count, z), false);
+            cells[1] += " " + formatMargin(estimate->margin(typeEstimate->size, z), true);
+        }
+        const bool sized = stat.hasSizes();
+        cells.push_back(sized ? formatSize(stat.minSize) : "-");
+        cells.push_back(sized ? formatSize(stat.maxSize) : "-");
+        if (diskUsage)
         {
-            if (ec)
+            cells.push_back(formatSize(stat.allocatedSize));
+        }
+        if (distributions)
+        {
+            for (const double q : {0.5, 0.9, 0.99})
             {
-                std::cerr << RED << "Warning: " << ec.message() << " at " << entry.path() << RESET << std::endl;
-                ec.clear();
-                continue;
+                cells.push_back(sized && stat.sketch.enabled() ? formatSize(stat.quantile(q)) : "-");
             }
+        }
+        std::cout << CYAN << "|" << GREEN << std::setw(20) << std::left << fileType;
+        for (size_t i = 0; i < columns.size(); i++)
+        {
+            std::cout << CYAN << "|" << GREEN << std::setw(columns[i].second) << std::right << cells[i];
+        }
+        std::cout << CYAN << "|" << RESET << "\n";
+    }
 
-            if (shouldExclude(entry.path()))
-            {
-                continue;
-            }
+    printSeparator();
 
-            if (entry.is_directory())
-            {
-                if (entry.path().filename() == ".git")
-                {
-                    size_t gitSize = calculateDirectorySize(entry.path());
-                    if (showHidden)
-                    {
-                        stats[".git"].update(gitSize);
-                        totalFiles++;
-                    }
-                    else
-                    {
-                        hiddenFiles++;
-                        hiddenSize += gitSize;
-                    }
-                    totalSize += gitSize;
-                    continue;
-                }
-                analyze(entry.path()); // Recursive call for subdirectories
-                continue;
-            }
+    if (!analyzer.includesHidden() && totals.hiddenFiles > 0)
+    {
+        std::cout << YELLOW << "\nHidden files: " << (estimate ? "~" : "") << totals.hiddenFiles
+                  << " (Size: " << formatSize(totals.hiddenSize) << ")" << RESET << "\n";
+    }
 
-            if (entry.is_regular_file())
-            {
-                try
-                {
-                    size_t size = fs::file_size(entry.path(), ec);
-                    if (ec)
-                    {
-                        std::cerr << RED << "Warning: Cannot get size of " << entry.path()
-                                  << " - " << ec.message() << RESET << std::endl;
-                        continue;
-                    }
+    printUntracked(totals.untracked);
+    printMounts(analyzer.mounts());
+    printGroups(analyzer.aggregators().get<GroupByAggregator>(), diskUsage);
+    if (distributions)
+    {
+        printHistogram(totals);
+    }
+    const auto &aggregators = analyzer.aggregators();
+    printTopList("Largest files", aggregators.get<TopFilesAggregator>().result());
+    printTopList("Largest directories", aggregators.get<TopDirsAggregator>().result());
+    if (aggregators.get<DuplicateAggregator>().isEnabled())
+    {
+        printDuplicates(aggregators.get<DuplicateAggregator>());
+    }
+}
 
-                    if (!isWithinSizeThreshold(size))
-                    {
-                        continue;
-                    }
+// Signed difference between two sizes, e.g. "+1.50 MB", or between two counts
+std::string formatChange(uint64_t before, uint64_t after, bool bytes)
+{
+    const uint64_t change = after > before ? after - before : before - after;
+    const std::string amount = bytes ? formatSize(change) : std::to_string(change);
+    return (after > before ? "+" : after < before ? "-" : "") + amount;
+}
 
-                    std::string fileType = getFileType(entry.path());
-                    if (!shouldInclude(fileType))
-                    {
-                        continue;
-                    }
+void printDirectoryChanges(const std::string &title, const std::vector<SnapshotDiff::DirectoryChange> &changes)
+{
+    if (changes.empty())
+    {
+        return;
+    }
+    std::cout << "\n"
+              << YELLOW << title << ":" << RESET << "\n";
+    for (const auto &change : changes)
+    {
+        std::cout << GREEN << std::setw(12) << std::right << formatChange(change.oldSize, change.newSize, true)
+                  << BLUE << std::setw(26) << formatSize(change.oldSize) + " -> " + formatSize(change.newSize)
+                  << CYAN << "  " << change.path << (change.added ? " (new)" : change.removed ? " (removed)" : "")
+                  << RESET << "\n";
+    }
+}
 
-                    if (entry.path().filename().string()[0] == '.' && !showHidden)
-                    {
-                        hiddenFiles++;
-                        hiddenSize += size;
-                    }
-                    else
-                    {
-                        stats[fileType].update(size);
-                        totalFiles++;
-                    }
+void printDiff(const SnapshotDiff &diff)
+{
+    if (diff.oldRoot != diff.newRoot)
+    {
+        printWarning("Snapshots are of different roots; directories are matched by path");
+    }
+    std::cout << BLUE << "Comparing " << diff.oldRoot << " (old) with " << diff.newRoot << " (new)" << RESET << "\n\n";
+    std::cout << GREEN << "Files: " << diff.oldFiles << " -> " << diff.newFiles << " ("
+              << formatChange(diff.oldFiles, diff.newFiles, false) << ")" << RESET << "\n";
+    std::cout << GREEN << "Size:  " << formatSize(diff.oldSize) << " -> " << formatSize(diff.newSize) << " ("
+              << formatChange(diff.oldSize, diff.newSize, true) << ")" << RESET << "\n";
+    std::cout << BLUE << "Directories: " << diff.directoriesAdded << " added (" << formatSize(diff.addedSize) << "), "
+              << diff.directoriesRemoved << " removed (" << formatSize(diff.removedSize) << "), "
+              << diff.directoriesChanged << " of " << diff.directoriesCompared << " in both changed" << RESET << "\n";
 
-                    totalSize += size;
-                }
-                catch (const std::exception &e)
-                {
-                    std::cerr << RED << "Error processing file " << entry.path()
-                              << ": " << e.what() << RESET << std::endl;
-                    continue;
-                }
+    if (!diff.types.empty())
+    {
+        const std::vector<std::pair<std::string, int>> columns = {
+            {"Old Count", 12}, {"New Count", 12}, {"Change", 10}, {"Old Size", 12}, {"New Size", 12}, {"Change", 13}};
+        const auto printSeparator = [&columns]()
+        {
+            std::cout << CYAN << "+" << std::string(20, '-');
+            for (const auto &column : columns)
+            {
+                std::cout << "+" << std::string(column.second, '-');
+            }
+            std::cout << "+" << RESET << "\n";
+        };
+        std::cout << "\n";
+        printSeparator();
+        std::cout << CYAN << "|" << YELLOW << std::setw(20) << std::left << " File Type";
+        for (const auto &column : columns)
+        {
+            std::cout << CYAN << "|" << YELLOW << std::setw(column.second) << std::right << column.first;
+        }
+        std::cout << CYAN << "|" << RESET << "\n";
+        printSeparator();
+        for (const auto &change : diff.types)
+        {
+            const std::string cells[] = {
+                std::to_string(change.oldCount), std::to_string(change.newCount), formatChange(change.oldCount, change.newCount, false),
+                formatSize(change.oldSize), formatSize(change.newSize), formatChange(change.oldSize, change.newSize, true)};
+            std::cout << CYAN << "|" << GREEN << std::setw(20) << std::left << change.type;
+            for (size_t i = 0; i < columns.size(); i++)
+            {
+                std::cout << CYAN << "|" << GREEN << std::setw(columns[i].second) << std::right << cells[i];
             }
+            std::cout << CYAN << "|" << RESET << "\n";
         }
+        printSeparator();
+    }
+    printDirectoryChanges("Directories that grew most", diff.grew);
+    printDirectoryChanges("Directories that shrank most", diff.shrank);
+    if (diff.types.empty() && diff.grew.empty() && diff.shrank.empty())
+    {
+        std::cout << "\n" << GREEN << "No changes." << RESET << "\n";
     }
+}
 
-    void printResults() const
+// Append a TSV field; tabs, newlines and backslashes are written as \t, \n and \\ so that
+// every row stays on one line
+void appendTsvField(std::string &row, std::string_view field)
+{
+    for (const char c : field)
     {
-        if (totalFiles == 0)
+        switch (c)
         {
-            std::cout << RED << "No files found.\n"
-                      << RESET;
-            return;
+        case '\t':
+            row += "\\t";
+            break;
+        case '\n':
+            row += "\\n";
+            break;
+        case '\\':
+            row += "\\\\";
+            break;
+        default:
+            row += c;
         }
+    }
+}
 
-        std::vector<std::pair<std::string, FileTypeStats>> sorted(stats.begin(), stats.end());
-        std::sort(sorted.begin(), sorted.end(),
-                  [](const auto &a, const auto &b)
-                  {
-                      return a.second.totalSize > b.second.totalSize;
-                  });
-
-        // Print summary
-        std::cout << "\n"
-                  << CYAN << "+" << std::string(60, '-') << "+" << RESET << "\n";
-        std::cout << CYAN << "| " << GREEN << std::left << std::setw(25) << "Total files: " + std::to_string(totalFiles)
-                  << CYAN << " | " << GREEN << std::left << std::setw(30) << "Total size: " + formatSize(totalSize) << CYAN << " |" << RESET << "\n";
-        std::cout << CYAN << "+" << std::string(60, '-') << "+" << RESET << "\n\n";
-
-        // Print table header
-        std::cout << CYAN << "+" << std::string(20, '-') << "+" << std::string(15, '-')
-                  << "+" << std::string(20, '-') << "+" << RESET << "\n";
-        std::cout << CYAN << "|" << YELLOW << std::setw(20) << std::left << " File Type"
-                  << CYAN << "|" << YELLOW << std::setw(15) << std::right << "Count"
-                  << CYAN << "|" << YELLOW << std::setw(20) << std::right << "Total Size"
-                  << CYAN << "|" << RESET << "\n";
-        std::cout << CYAN << "+" << std::string(20, '-') << "+" << std::string(15, '-')
-                  << "+" << std::string(20, '-') << "+" << RESET << "\n";
-
-        // Print table content
-        for (const auto &[fileType, stat] : sorted)
+// Rows of the CSV export and of --format tsv, fields separated by separator: the per-type
+// totals and hidden files, or the --group-by pivot instead. The pivot can be long, so
+// flush(rows) is called whenever rows passes AsyncWriter::BUFFER_BYTES; the rest is left
+// in rows
+template <typename Flush>
+void appendResultRows(std::string &rows, const CliAnalyzer &analyzer, char separator, Flush flush)
+{
+    const ScanTotals &totals = analyzer.results();
+    const bool diskUsage = analyzer.tracksDiskUsage();
+    const bool distributions = analyzer.tracksDistributions();
+    const auto field = [&rows, separator](std::string_view text)
+    {
+        if (separator == '\t')
         {
-            std::cout << CYAN << "|" << GREEN << std::setw(20) << std::left << fileType
-                      << CYAN << "|" << GREEN << std::setw(15) << std::right << stat.count
-                      << CYAN << "|" << GREEN << std::setw(20) << std::right << formatSize(stat.totalSize)
-                      << CYAN << "|" << RESET << "\n";
+            appendTsvField(rows, text);
         }
+        else
+        {
+            appendCsvField(rows, text);
+        }
+    };
+    const auto header = [&rows, separator](std::initializer_list<const char *> columns)
+    {
+        for (const char *column : columns)
+        {
+            rows += column;
+            rows += separator;
+        }
+    };
 
-        std::cout << CYAN << "+" << std::string(20, '-') << "+" << std::string(15, '-')
-                  << "+" << std::string(20, '-') << "+" << RESET << "\n";
-
-        if (!showHidden && hiddenFiles > 0)
+    const GroupByAggregator &groups = analyzer.aggregators().get<GroupByAggregator>();
+    if (!groups.groupedBy().empty())
+    {
+        for (const GroupDimension dimension : groups.groupedBy())
+        {
+            header({groupCsvColumn(dimension)});
+        }
+        header({"Count", "TotalSize", "AllocatedSize"});
+        rows.back() = '\n';
+        for (const auto &group : groups.groups())
         {
-            std::cout << YELLOW << "\nHidden files: " << hiddenFiles
-                      << " (Size: " << formatSize(hiddenSize) << ")" << RESET << "\n";
+            for (size_t i = 0; i < groups.groupedBy().size(); i++)
+            {
+                field(groups.label(group, i));
+                rows += separator;
+            }
+            appendCsvNumber(rows, group.totals.files);
+            rows += separator;
+            appendCsvNumber(rows, group.totals.size);
+            rows += separator;
+            appendCsvNumber(rows, group.totals.allocated);
+            rows += '\n';
+            if (rows.size() >= AsyncWriter::BUFFER_BYTES)
+            {
+                flush(rows);
+            }
         }
+        return;
     }
 
-    void exportCsv(const std::string &filename) const
+    header({"FileType", "Count", "TotalSize", "AverageSize", "MinSize", "MaxSize"});
+    if (diskUsage)
     {
-        std::ofstream file(filename);
-        if (!file)
+        header({"AllocatedSize"});
+    }
+    if (distributions)
+    {
+        header({"P50", "P90", "P99"});
+    }
+    rows.back() = '\n';
+    for (const auto &[fileType, stat] : analyzer.sortedStats())
+    {
+        field(fileType);
+        for (const size_t value : {stat.count, stat.totalSize, stat.averageSize()})
         {
-            throw std::runtime_error("Cannot create output file: " + filename);
+            rows += separator;
+            appendCsvNumber(rows, value);
         }
-
-        file << "FileType,Count,TotalSize\n";
-        for (const auto &[fileType, stat] : stats)
+        rows += separator;
+        if (stat.hasSizes())
         {
-            file << escapeCSV(fileType) << ","
-                 << stat.count << ","
-                 << stat.totalSize << "\n";
+            appendCsvNumber(rows, stat.minSize);
+            rows += separator;
+            appendCsvNumber(rows, stat.maxSize);
         }
-
-        if (!showHidden && hiddenFiles > 0)
+        else
+        {
+            rows += separator;
+        }
+        if (diskUsage)
         {
-            file << "Hidden files," << hiddenFiles << "," << hiddenSize << "\n";
+            rows += separator;
+            appendCsvNumber(rows, stat.allocatedSize);
         }
+        if (distributions)
+        {
+            for (const double q : {0.5, 0.9, 0.99})
+            {
+                rows += separator;
+                if (stat.hasSizes() && stat.sketch.enabled())
+                {
+                    appendCsvNumber(rows, stat.quantile(q));
+                }
+            }
+        }
+        rows += '\n';
+    }
 
-        std::cout << GREEN << "Results exported to " << filename << RESET << std::endl;
+    if (!analyzer.includesHidden() && totals.hiddenFiles > 0)
+    {
+        rows += "Hidden files";
+        rows += separator;
+        appendCsvNumber(rows, totals.hiddenFiles);
+        rows += separator;
+        appendCsvNumber(rows, totals.hiddenSize);
+        // Empty average, smallest, largest and the optional columns
+        rows.append(3 + (diskUsage ? 1 : 0) + (distributions ? 3 : 0), separator);
+        rows += '\n';
     }
-};
+}
 
-void printUsage(const char *programName)
+void exportCsv(const CliAnalyzer &analyzer, const std::string &filename)
 {
-    std::cout << YELLOW << "Usage: " << programName << " [options] directory\n"
-              << "Options:\n"
-              << "  -h, --help           Show this help message\n"
-              << "  -a, --all            Include hidden files\n"
-              << "  -e, --exclude        Directory to exclude (can be used multiple times)\n"
-              << "  -o, --output         Export results to CSV file\n"
-              << "  -t, --type           File type to include (can be used multiple times)\n"
-              << "  -s, --min-size       Minimum file size (e.g., 10K, 1M, 1.5G)\n"
-              << "  -S, --max-size       Maximum file size (e.g., 100M, 2G)\n"
-              << "Example:\n"
-              << "  " << programName << " -a -e node_modules -t .cpp -t .h -s 1K -S 1M -o results.csv /path/to/dir\n"
-              << RESET;
+    AsyncWriter file;
+    file.open(filename, compressionFor(filename));
+    std::string rows;
+    appendResultRows(rows, analyzer, ',', [&file](std::string &buffer)
+                     { file.submit(buffer); });
+    file.submit(rows);
+    file.close();
 }
 
-int main(int argc, char *argv[])
+// Append text as a JSON string literal
+void appendJsonString(std::string &out, std::string_view text)
 {
-    std::string targetDir;
-    std::string outputFile;
-    bool showHidden = false;
-    std::vector<std::string> excludeDirs;
-    std::vector<std::string> includeTypes;
-    SizeThreshold sizeThreshold;
-
-    try
+    out += '"';
+    for (const char c : text)
     {
-        for (int i = 1; i < argc; i++)
+        if (c == '"' || c == '\\')
         {
-            std::string arg = argv[i];
-            if (arg == "-h" || arg == "--help")
-            {
-                printUsage(argv[0]);
-                return 0;
-            }
-            else if (arg == "-a" || arg == "--all")
-            {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// Write the directory tree to filename: nested JSON objects (the shape treemap tools such as
+// d3-hierarchy read) if the name ends in .json, before any .gz or .zst, otherwise the binary
+// layout described in the README
+void exportTree(const DirectoryTree &tree, const std::string &filename)
+{
+    const OutputCompression compression = compressionFor(filename);
+    const std::string_view base = std::string_view(filename).substr(
+        0, filename.size() - (compression == OutputCompression::Gzip ? 3 : compression == OutputCompression::Zstd ? 4 : 0));
+    const bool json = base.size() > 5 && base.substr(base.size() - 5) == ".json";
+    AsyncWriter file;
+    file.open(filename, compression);
+    std::string out;
+    if (json && !tree.empty())
+    {
+        const auto openNode = [&](uint32_t node)
+        {
+            out += "{\"name\":";
+            appendJsonString(out, tree.name(node));
+            out += ",\"size\":";
+            appendCsvNumber(out, tree.subtreeBytes(node));
+            out += ",\"files\":";
+            appendCsvNumber(out, tree.subtreeFiles(node));
+            out += ",\"own_size\":";
+            appendCsvNumber(out, tree.bytes(node));
+            out += ",\"own_files\":";
+            appendCsvNumber(out, tree.files(node));
+            out += tree.childCount(node) > 0 ? ",\"children\":[" : "}";
+        };
+        // Depth-first without recursion: each entry is a node and how many children are written
+        std::vector<std::pair<uint32_t, uint32_t>> open;
+        openNode(0);
+        if (tree.childCount(0) > 0)
+        {
+            open.emplace_back(0, 0);
+        }
+        while (!open.empty())
+        {
+            const auto [node, written] = open.back();
+            if (written == tree.childCount(node))
+            {
+                out += "]}";
+                open.pop_back();
+                continue;
+            }
+            open.back().second++;
+            if (written > 0)
+            {
+                out += ',';
+            }
+            const uint32_t child = tree.firstChild(node) + written;
+            openNode(child);
+            if (tree.childCount(child) > 0)
+            {
+                open.emplace_back(child, 0);
+            }
+            if (out.size() >= AsyncWriter::BUFFER_BYTES)
+            {
+                file.submit(out);
+            }
+        }
+        out += '\n';
+    }
+    else if (!json)
+    {
+        out.append("DATREE\0\0", 8);
+        appendBinary(out, uint32_t(1)); // version
+        appendBinary(out, uint32_t(0));
+        appendBinary(out, uint64_t(tree.size()));
+        appendBinary(out, uint64_t(tree.namePool().size()));
+        const uint32_t count = static_cast<uint32_t>(tree.size());
+        const auto column = [&](auto value)
+        {
+            for (uint32_t node = 0; node < count; node++)
+            {
+                appendBinary(out, value(node));
+                if (out.size() >= AsyncWriter::BUFFER_BYTES)
+                {
+                    file.submit(out);
+                }
+            }
+        };
+        column([&](uint32_t node)
+               { return tree.parent(node); });
+        column([&](uint32_t node)
+               { return tree.firstChild(node); });
+        column([&](uint32_t node)
+               { return tree.childCount(node); });
+        column([&](uint32_t node)
+               { return tree.nameOffset(node); });
+        column([&](uint32_t node)
+               { return static_cast<uint32_t>(tree.name(node).size()); });
+        column([&](uint32_t node)
+               { return tree.files(node); });
+        column([&](uint32_t node)
+               { return tree.bytes(node); });
+        column([&](uint32_t node)
+               { return tree.subtreeFiles(node); });
+        column([&](uint32_t node)
+               { return tree.subtreeBytes(node); });
+        for (size_t offset = 0; offset < tree.namePool().size(); offset += AsyncWriter::BUFFER_BYTES)
+        {
+            out.append(tree.namePool(), offset, AsyncWriter::BUFFER_BYTES);
+            file.submit(out);
+        }
+    }
+    file.submit(out);
+    file.close();
+}
+
+// How the results of a scan or --load are printed on stdout
+enum class OutputFormat
+{
+    Table, // the colored tables and every optional section
+    Tsv,   // the rows of the CSV export, tab-separated
+    Json   // one JSON document with the totals, the types and the --group-by pivot
+};
+
+OutputFormat parseOutputFormat(const std::string &name)
+{
+    if (name == "table")
+    {
+        return OutputFormat::Table;
+    }
+    if (name == "tsv")
+    {
+        return OutputFormat::Tsv;
+    }
+    if (name == "json")
+    {
+        return OutputFormat::Json;
+    }
+    throw std::runtime_error("Error: Unknown output format: " + name + " (expected table, tsv or json)");
+}
+
+// Append a number, or null for a value that was not measured
+void appendJsonNumber(std::string &out, const char *key, uint64_t value, bool known = true)
+{
+    out += ", \"";
+    out += key;
+    out += "\": ";
+    if (known)
+    {
+        appendCsvNumber(out, value);
+    }
+    else
+    {
+        out += "null";
+    }
+}
+
+// The --format json document, one line per type and per group
+void appendResultJson(std::string &out, const CliAnalyzer &analyzer)
+{
+    const ScanTotals &totals = analyzer.results();
+    const bool diskUsage = analyzer.tracksDiskUsage();
+    const bool distributions = analyzer.tracksDistributions();
+    out += "{\"files\": ";
+    appendCsvNumber(out, totals.totalFiles);
+    appendJsonNumber(out, "size", totals.totalSize);
+    if (diskUsage)
+    {
+        appendJsonNumber(out, "allocated", totals.allocatedSize);
+    }
+    if (!analyzer.includesHidden())
+    {
+        appendJsonNumber(out, "hidden_files", totals.hiddenFiles);
+        appendJsonNumber(out, "hidden_size", totals.hiddenSize);
+    }
+    out += ",\n \"types\": [";
+    const char *separator = "\n  ";
+    for (const auto &[fileType, stat] : analyzer.sortedStats())
+    {
+        const bool sized = stat.hasSizes();
+        out += separator;
+        out += "{\"type\": ";
+        appendJsonString(out, fileType);
+        appendJsonNumber(out, "count", stat.count);
+        appendJsonNumber(out, "size", stat.totalSize);
+        appendJsonNumber(out, "average", stat.averageSize());
+        appendJsonNumber(out, "smallest", stat.minSize, sized);
+        appendJsonNumber(out, "largest", stat.maxSize, sized);
+        if (diskUsage)
+        {
+            appendJsonNumber(out, "allocated", stat.allocatedSize);
+        }
+        if (distributions)
+        {
+            const bool sketched = sized && stat.sketch.enabled();
+            appendJsonNumber(out, "p50", sketched ? stat.quantile(0.5) : 0, sketched);
+            appendJsonNumber(out, "p90", sketched ? stat.quantile(0.9) : 0, sketched);
+            appendJsonNumber(out, "p99", sketched ? stat.quantile(0.99) : 0, sketched);
+        }
+        out += '}';
+        separator = ",\n  ";
+    }
+    out += "]";
+
+    const GroupByAggregator &groups = analyzer.aggregators().get<GroupByAggregator>();
+    if (!groups.groupedBy().empty())
+    {
+        out += ",\n \"groups\": [";
+        separator = "\n  ";
+        for (const auto &group : groups.groups())
+        {
+            out += separator;
+            for (size_t i = 0; i < groups.groupedBy().size(); i++)
+            {
+                out += i == 0 ? "{" : ", ";
+                appendJsonString(out, groupDimensionInfo(groups.groupedBy()[i]).name);
+                out += ": ";
+                appendJsonString(out, groups.label(group, i));
+            }
+            appendJsonNumber(out, "files", group.totals.files);
+            appendJsonNumber(out, "size", group.totals.size);
+            appendJsonNumber(out, "allocated", group.totals.allocated);
+            out += '}';
+            separator = ",\n  ";
+        }
+        out += "]";
+    }
+    out += "}\n";
+}
+
+// Print the results in format; TSV and JSON are built in one buffer and written at once
+void printReport(const CliAnalyzer &analyzer, OutputFormat format, double confidence = 0.95)
+{
+    if (format == OutputFormat::Table)
+    {
+        printResults(analyzer, confidence);
+        return;
+    }
+    const GroupByAggregator &groups = analyzer.aggregators().get<GroupByAggregator>();
+    std::string out;
+    out.reserve(256 + 128 * (analyzer.results().stats.size() + groups.groups().size()));
+    if (format == OutputFormat::Json)
+    {
+        appendResultJson(out, analyzer);
+    }
+    else
+    {
+        const auto flush = [](std::string &rows)
+        {
+            std::fwrite(rows.data(), 1, rows.size(), stdout);
+            rows.clear();
+        };
+        appendResultRows(out, analyzer, '\t', flush);
+    }
+    std::fwrite(out.data(), 1, out.size(), stdout);
+}
+
+#ifdef __linux__
+volatile std::sig_atomic_t watchStopRequested = 0;
+
+void requestWatchStop(int)
+{
+    watchStopRequested = 1;
+}
+
+// Answer one request on the watch socket: "dir <path>" gives the totals beneath a directory,
+// anything else (or nothing within 100 ms) the whole tree with its per-type totals
+std::string watchResponse(const LiveTotals &live, const std::string &root, const std::string &request, size_t events)
+{
+    std::string out = "{";
+    if (request.compare(0, 4, "dir ") == 0)
+    {
+        const std::string path = request.substr(4);
+        uint64_t files = 0;
+        uint64_t bytes = 0;
+        out += "\"path\": ";
+        appendJsonString(out, path);
+        if (live.subtree(path, files, bytes))
+        {
+            out += ", \"files\": " + std::to_string(files) + ", \"bytes\": " + std::to_string(bytes) + "}\n";
+        }
+        else
+        {
+            out += ", \"error\": \"unknown directory\"}\n";
+        }
+        return out;
+    }
+
+    std::vector<std::pair<std::string, LiveTotals::TypeTotals>> types;
+    live.forEachType([&types](const std::string &fileType, const LiveTotals::TypeTotals &totals)
+                     { types.emplace_back(fileType, totals); });
+    std::sort(types.begin(), types.end(), [](const auto &a, const auto &b)
+              { return a.second.size != b.second.size ? a.second.size > b.second.size : a.first < b.first; });
+    out += "\"root\": ";
+    appendJsonString(out, root);
+    out += ", \"files\": " + std::to_string(live.files()) + ", \"bytes\": " + std::to_string(live.bytes()) +
+           ", \"directories\": " + std::to_string(live.directoryCount()) + ", \"events\": " + std::to_string(events) +
+           ", \"types\": [";
+    for (size_t i = 0; i < types.size(); i++)
+    {
+        out += i ? ", {\"type\": " : "{\"type\": ";
+        appendJsonString(out, types[i].first);
+        out += ", \"count\": " + std::to_string(types[i].second.count) + ", \"size\": " + std::to_string(types[i].second.size) + "}";
+    }
+    out += "]}\n";
+    return out;
+}
+
+// Whether path lies in an opaque directory below root; those are never watched
+bool insideOpaque(const CliAnalyzer &analyzer, const std::string &root, const std::string &path)
+{
+    for (const auto &part : fs::path(path).lexically_relative(root))
+    {
+        if (analyzer.isOpaqueName(part.string()))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Apply one inotify event to the live totals. New directories are scanned with the same
+// options as the initial scan; removed ones are dropped with everything beneath them
+void applyWatchEvent(CliAnalyzer &analyzer, const std::string &root, TreeWatcher &watcher, const TreeWatcher::Event &event)
+{
+    LiveTotals &live = analyzer.aggregators().get<LiveAggregator>().totals();
+    std::string path;
+    if (event.mask & IN_Q_OVERFLOW)
+    {
+        printWarning("Warning: inotify queue overflowed; rescanning " + root);
+        watcher.unwatchAll();
+        live.clear();
+        analyzer.analyze(root);
+        return;
+    }
+    buildChildPath(path, event.directory, event.name);
+    if (event.mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        if (event.mask & IN_ISDIR)
+        {
+            for (const auto &removed : live.removeSubtree(path))
+            {
+                watcher.unwatch(removed);
+            }
+        }
+        else
+        {
+            live.removeFile(event.directory, event.name);
+        }
+        return;
+    }
+
+    struct stat st;
+    std::string scratch;
+    if (::stat(path.c_str(), &st) != 0)
+    {
+        live.removeFile(event.directory, event.name);
+        return;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        if ((event.mask & (IN_CREATE | IN_MOVED_TO)) && !live.hasDirectory(path) &&
+            analyzer.descendsInto(event.directory, event.name, st, scratch))
+        {
+            analyzer.analyze(path);
+        }
+        return;
+    }
+    TypeKeyBuffer typeKey;
+    const std::string_view fileType = fileTypeKey(event.name, typeKey);
+    if (S_ISREG(st.st_mode) && analyzer.reportsFile(event.directory, event.name, fileType, st, scratch))
+    {
+        live.setFile(event.directory, event.name, fileType, static_cast<uint64_t>(st.st_size));
+    }
+    else
+    {
+        live.removeFile(event.directory, event.name);
+    }
+}
+
+// --watch: keep the results of the initial scan current from inotify events and serve them
+// on a Unix socket until SIGINT or SIGTERM
+void runWatch(CliAnalyzer &analyzer, const std::string &root, const std::string &socketPath)
+{
+    LiveTotals &live = analyzer.aggregators().get<LiveAggregator>().totals();
+    TreeWatcher watcher;
+    const auto watchAdded = [&]
+    {
+        for (const auto &path : live.takeAdded())
+        {
+            if (!insideOpaque(analyzer, root, path))
+            {
+                watcher.watch(path);
+            }
+        }
+    };
+    watchAdded();
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("Socket path too long: " + socketPath);
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    // A stale socket from an earlier run is replaced; anything else at the path is the user's
+    struct stat existing{};
+    if (::lstat(socketPath.c_str(), &existing) == 0)
+    {
+        if (!S_ISSOCK(existing.st_mode))
+        {
+            throw std::runtime_error("Cannot listen on " + socketPath + ": it exists and is not a socket");
+        }
+        ::unlink(socketPath.c_str());
+    }
+    const int server = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0 || ::bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(server, 16) != 0)
+    {
+        throw std::runtime_error("Cannot listen on " + socketPath + ": " + std::generic_category().message(errno));
+    }
+
+    struct sigaction stop{};
+    stop.sa_handler = requestWatchStop;
+    ::sigaction(SIGINT, &stop, nullptr);
+    ::sigaction(SIGTERM, &stop, nullptr);
+    std::cout << BLUE << "Watching " << watcher.size() << " directories; results on " << socketPath << RESET << std::endl;
+
+    size_t events = 0;
+    while (!watchStopRequested)
+    {
+        pollfd fds[2] = {{watcher.descriptor(), POLLIN, 0}, {server, POLLIN, 0}};
+        if (::poll(fds, 2, -1) < 0)
+        {
+            continue; // interrupted by a signal
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            for (const auto &event : watcher.read())
+            {
+                applyWatchEvent(analyzer, root, watcher, event);
+                events++;
+            }
+            watchAdded();
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            const int client = ::accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0)
+            {
+                continue;
+            }
+            std::string request;
+            pollfd readable{client, POLLIN, 0};
+            char buffer[4096];
+            ssize_t got;
+            if (::poll(&readable, 1, 100) > 0 && (got = ::recv(client, buffer, sizeof(buffer), 0)) > 0)
+            {
+                request.assign(buffer, static_cast<size_t>(got));
+                request.erase(std::min(request.find_first_of("\r\n"), request.size()));
+            }
+            const std::string response = watchResponse(live, root, request, events);
+            for (size_t sent = 0; sent < response.size();)
+            {
+                const ssize_t n = ::send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0)
+                {
+                    break;
+                }
+                sent += static_cast<size_t>(n);
+            }
+            ::close(client);
+        }
+    }
+    ::close(server);
+    if (::lstat(socketPath.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+    {
+        ::unlink(socketPath.c_str());
+    }
+}
+// Frames of the distributed scan protocol: a 32-bit payload length, a type byte, the payload.
+// A worker says hello ('H': options hash, host name) and then gets shards ('S': time budget
+// in ms, directory), answering each with the directories it left over ('D'). Once all work
+// is done the coordinator sends 'Q' and the worker replies with its results ('R'); 'E'
+// carries an error that ends the worker
+void sendFrame(int fd, char type, const std::string &payload)
+{
+    std::string frame;
+    appendBinary(frame, uint32_t(payload.size()));
+    frame += type;
+    frame += payload;
+    for (size_t sent = 0; sent < frame.size();)
+    {
+        const ssize_t n = ::send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            throw std::runtime_error("Connection lost: " + std::generic_category().message(errno));
+        }
+        sent += static_cast<size_t>(n);
+    }
+}
+
+bool receiveExactly(int fd, char *data, size_t size)
+{
+    for (size_t got = 0; got < size;)
+    {
+        const ssize_t n = ::recv(fd, data + got, size - got, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        got += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Largest frame either side accepts. The port is unauthenticated, so a length is not trusted
+// until its bytes arrive: the payload grows as it is received, 1 MB at a time
+constexpr uint32_t MAX_FRAME_BYTES = 256 * 1024 * 1024;
+
+// Read one frame; false if the peer closed the connection, timed out or sent a frame over
+// MAX_FRAME_BYTES
+bool receiveFrame(int fd, char &type, std::string &payload)
+{
+    char header[5];
+    if (!receiveExactly(fd, header, sizeof(header)))
+    {
+        return false;
+    }
+    uint32_t length;
+    std::memcpy(&length, header, sizeof(length));
+    type = header[4];
+    if (length > MAX_FRAME_BYTES)
+    {
+        return false;
+    }
+    payload.clear();
+    while (payload.size() < length)
+    {
+        const size_t got = payload.size();
+        payload.resize(got + std::min<size_t>(length - got, 1024 * 1024));
+        if (!receiveExactly(fd, payload.data() + got, payload.size() - got))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void appendWireString(std::string &out, std::string_view text)
+{
+    appendBinary(out, uint16_t(text.size()));
+    out.append(text.data(), text.size());
+}
+
+// Connect to host:port over TCP
+int connectTo(const std::string &address)
+{
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0)
+    {
+        throw std::runtime_error("Error: --worker expects <host>:<port>, got " + address);
+    }
+    const std::string host = address.substr(0, colon);
+    const std::string port = address.substr(colon + 1);
+    addrinfo hints{};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+    {
+        throw std::runtime_error("Cannot resolve " + address);
+    }
+    int fd = -1;
+    for (addrinfo *candidate = found; candidate && fd < 0; candidate = candidate->ai_next)
+    {
+        fd = ::socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC, candidate->ai_protocol);
+        if (fd >= 0 && ::connect(fd, candidate->ai_addr, candidate->ai_addrlen) != 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(found);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot connect to " + address);
+    }
+    return fd;
+}
+
+// --worker: scan the shards a coordinator hands out until it has no more, then send back
+// everything scanned. Results accumulate in the analyzer across shards
+void runWorker(CliAnalyzer &analyzer, const std::string &address)
+{
+    const int fd = connectTo(address);
+    char hostname[256] = {};
+    ::gethostname(hostname, sizeof(hostname) - 1);
+    std::string hello;
+    appendBinary(hello, analyzer.optionsHash());
+    appendWireString(hello, hostname);
+    sendFrame(fd, 'H', hello);
+
+    size_t shards = 0;
+    char type;
+    std::string payload;
+    while (receiveFrame(fd, type, payload))
+    {
+        BinaryCursor cursor(payload.data(), payload.data() + payload.size());
+        if (type == 'E')
+        {
+            ::close(fd);
+            throw std::runtime_error("Coordinator: " + payload);
+        }
+        if (type == 'Q')
+        {
+            std::string results;
+            appendTotals(results, analyzer.results());
+            appendTopList(results, analyzer.aggregators().get<TopFilesAggregator>().result());
+            sendFrame(fd, 'R', results);
+            ::close(fd);
+            std::cout << BLUE << "Scanned " << shards << " shards for " << address << RESET << std::endl;
+            return;
+        }
+        if (type != 'S')
+        {
+            break;
+        }
+        analyzer.setShardBudget(std::chrono::milliseconds(cursor.read<uint32_t>()));
+        analyzer.analyze(std::string(cursor.readString()));
+        shards++;
+        std::string leftover;
+        const auto deferred = analyzer.takeDeferred();
+        appendBinary(leftover, uint32_t(deferred.size()));
+        for (const auto &path : deferred)
+        {
+            appendWireString(leftover, path);
+        }
+        sendFrame(fd, 'D', leftover);
+    }
+    ::close(fd);
+    throw std::runtime_error("Lost the connection to the coordinator at " + address);
+}
+
+// --coordinate: split the scan of root into shards for the workers that connect on port and
+// merge their results into analyzer. The first shard is root itself; every worker scans its
+// shard for at most the shard budget and returns the subdirectories it did not reach, which
+// become new shards, so a huge subtree is spread over whichever workers are idle
+void runCoordinator(CliAnalyzer &analyzer, const std::string &root, const std::string &port,
+                    std::chrono::milliseconds budget)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *local = nullptr;
+    if (::getaddrinfo(nullptr, port.c_str(), &hints, &local) != 0)
+    {
+        throw std::runtime_error("Error: Invalid port: " + port);
+    }
+    const int server = ::socket(local->ai_family, local->ai_socktype | SOCK_CLOEXEC, local->ai_protocol);
+    const int yes = 1;
+    const int no = 0;
+    ::setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    ::setsockopt(server, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+    const bool listening = server >= 0 && ::bind(server, local->ai_addr, local->ai_addrlen) == 0 && ::listen(server, 64) == 0;
+    ::freeaddrinfo(local);
+    if (!listening)
+    {
+        throw std::runtime_error("Cannot listen on port " + port + ": " + std::generic_category().message(errno));
+    }
+    std::cout << BLUE << "Coordinating the scan of " << root << " on port " << port << "; waiting for workers" << RESET << std::endl;
+
+    struct Worker
+    {
+        int fd;
+        std::string name;
+        std::chrono::steady_clock::time_point accepted;
+        bool ready = false;    // said hello
+        bool busy = false;     // has a shard
+        bool quitting = false; // was sent 'Q'
+    };
+    // Connections that have not said hello by HELLO_TIMEOUT are dropped, and a frame that
+    // stalls halfway for FRAME_TIMEOUT ends its connection, so a stray client cannot hold up
+    // the scan
+    constexpr auto HELLO_TIMEOUT = std::chrono::seconds(10);
+    constexpr auto FRAME_TIMEOUT = std::chrono::seconds(2);
+    std::vector<Worker> workers;
+    std::deque<std::string> shards{root};
+    size_t shardsDone = 0;
+    size_t finished = 0;
+    TopList topFiles;
+    topFiles.setLimit(analyzer.aggregators().get<TopFilesAggregator>().result().limitCount());
+
+    const auto fail = [&](const std::string &message)
+    {
+        for (const auto &worker : workers)
+        {
+            ::close(worker.fd);
+        }
+        ::close(server);
+        throw std::runtime_error(message);
+    };
+
+    while (true)
+    {
+        // Hand out shards; once none are queued or being scanned, collect the results
+        const bool scanning = std::any_of(workers.begin(), workers.end(), [](const Worker &worker)
+                                          { return worker.busy; });
+        for (auto &worker : workers)
+        {
+            if (worker.fd < 0 || !worker.ready || worker.busy || worker.quitting)
+            {
+                continue;
+            }
+            if (!shards.empty())
+            {
+                std::string shard;
+                appendBinary(shard, uint32_t(budget.count()));
+                appendWireString(shard, shards.front());
+                sendFrame(worker.fd, 'S', shard);
+                shards.pop_front();
+                worker.busy = true;
+            }
+            else if (!scanning)
+            {
+                sendFrame(worker.fd, 'Q', std::string());
+                worker.quitting = true;
+            }
+        }
+        const auto now = std::chrono::steady_clock::now();
+        for (auto &worker : workers)
+        {
+            if (worker.fd >= 0 && !worker.ready && (finished > 0 || now - worker.accepted >= HELLO_TIMEOUT))
+            {
+                ::close(worker.fd);
+                worker.fd = -1;
+            }
+        }
+        if (finished > 0 && std::all_of(workers.begin(), workers.end(), [](const Worker &worker)
+                                        { return worker.fd < 0; }))
+        {
+            break;
+        }
+
+        std::vector<pollfd> fds{{server, POLLIN, 0}};
+        for (const auto &worker : workers)
+        {
+            fds.push_back({worker.fd, static_cast<short>(worker.fd >= 0 ? POLLIN : 0), 0});
+        }
+        const bool greeting = std::any_of(workers.begin(), workers.end(), [](const Worker &worker)
+                                          { return worker.fd >= 0 && !worker.ready; });
+        if (::poll(fds.data(), fds.size(), greeting ? 1000 : -1) < 0)
+        {
+            continue;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            const int fd = ::accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0)
+            {
+                const timeval timeout{static_cast<time_t>(FRAME_TIMEOUT.count()), 0};
+                ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                workers.push_back({fd, "worker", std::chrono::steady_clock::now()});
+            }
+        }
+        for (size_t i = 1; i < fds.size(); i++)
+        {
+            Worker &worker = workers[i - 1];
+            if (worker.fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+            char type;
+            std::string payload;
+            if (!receiveFrame(worker.fd, type, payload))
+            {
+                if (worker.busy || worker.quitting)
+                {
+                    fail("Error: " + worker.name + " disconnected before sending its results; the scan is incomplete");
+                }
+                ::close(worker.fd); // left before taking any work
+                worker.fd = -1;
+                continue;
+            }
+            try
+            {
+                BinaryCursor cursor(payload.data(), payload.data() + payload.size());
+                if (type == 'H')
+                {
+                    const uint64_t hash = cursor.read<uint64_t>();
+                    worker.name = std::string(cursor.readString());
+                    if (hash != analyzer.optionsHash())
+                    {
+                        sendFrame(worker.fd, 'E', "scan options differ from the coordinator's");
+                        ::close(worker.fd);
+                        worker.fd = -1;
+                        printWarning("Warning: Rejected " + worker.name + ": its scan options differ");
+                        continue;
+                    }
+                    worker.ready = true;
+                    std::cout << BLUE << "Worker " << worker.name << " joined" << RESET << std::endl;
+                }
+                else if (type == 'D' && worker.busy)
+                {
+                    const uint32_t count = cursor.read<uint32_t>();
+                    for (uint32_t j = 0; j < count; j++)
+                    {
+                        shards.emplace_back(cursor.readString());
+                    }
+                    worker.busy = false;
+                    shardsDone++;
+                }
+                else if (type == 'R' && worker.quitting)
+                {
+                    ScanTotals part;
+                    readTotals(cursor, part);
+                    analyzer.mergeResults(part);
+                    readTopList(cursor, topFiles);
+                    ::close(worker.fd);
+                    worker.fd = -1;
+                    finished++;
+                }
+                else
+                {
+                    throw std::runtime_error("unexpected message");
+                }
+            }
+            catch (const std::runtime_error &e)
+            {
+                fail("Error: Bad message from " + worker.name + ": " + e.what());
+            }
+        }
+    }
+    ::close(server);
+    analyzer.aggregators().get<TopFilesAggregator>().merge(topFiles);
+    std::cout << BLUE << "Scanned " << shardsDone << " shards on " << finished << " workers" << RESET << std::endl;
+}
+#endif
+
+void printUsage(const char *programName)
+{
+    std::cout << YELLOW << "Usage: " << programName << " [options] directory\n"
+              << "Options:\n"
+              << "  -h, --help           Show this help message\n"
+              << "  -a, --all            Include hidden files\n"
+              << "  -e, --exclude        Directory to exclude (can be used multiple times)\n"
+              << "  -o, --output         Export results to CSV file (.gz or .zst to compress)\n"
+              << "      --export-files   Stream one CSV row per file to a file during the scan\n"
+              << "      --export-dirs    Stream one CSV row per directory with its subtree size\n"
+              << "      --export-tree    Write the directory tree with subtree totals, as nested JSON (.json) or binary\n"
+              << "  -t, --type           File type to include (can be used multiple times)\n"
+              << "  -s, --min-size       Minimum file size (e.g., 10K, 1M, 1.5G)\n"
+              << "  -S, --max-size       Maximum file size (e.g., 100M, 2G)\n"
+              << "  -w, --where          Filter expression, e.g. \"size>1M && ext in {.log,.gz} && mtime<30d\"\n"
+              << "  -j, --jobs           Number of parallel scan workers (default: 1)\n"
+              << "  -x, --one-file-system  Skip directories on other filesystems\n"
+              << "      --mount-jobs     Workers allowed on one mount at once, as <mount>=<n> (can be used multiple times)\n"
+              << "      --adaptive       Adjust the active workers (up to -j) and io_uring depth to the filesystem's latency\n"
+              << "      --max-latency    Latency ceiling of --adaptive per readdir or stat, in milliseconds (default: 10)\n"
+              << "      --opaque         Directory name counted as one entry, like .git (can be used multiple times)\n"
+              << "      --opaque-mode    How opaque directories are sized: walk, approx or skip (default: walk)\n"
+              << "      --order          Metadata access order: readdir, inode or bfs (default: readdir)\n"
+              << "  -i, --index          Index file for incremental rescans (read and updated)\n"
+              << "      --save           Save a binary snapshot of the results\n"
+              << "      --load           Print the results of a saved snapshot instead of scanning\n"
+              << "      --diff           Compare two snapshots, <old> <new>: changed types and the directories that changed most\n"
+              << "  -b, --backend        Directory reader: std, getdents or uring (default: getdents on Linux)\n"
+              << "      --find-duplicates List files with identical contents (Linux)\n"
+              << "      --disk-usage     Count hard-linked files once and show allocated sizes (Linux)\n"
+              << "      --histogram      Show p50/p90/p99 per file type and a size histogram\n"
+              << "      --top-files      Show the N largest files\n"
+              << "      --top-dirs       Show the N largest directories (including their subdirectories)\n"
+              << "      --group-by       Also total files by uid, gid, age, atime, depth and/or ext, e.g. uid,age,ext\n"
+              << "      --progress       Report scan throughput and the slowest directory on stderr\n"
+              << "  -q, --quiet          Print nothing on stdout; warnings and errors still go to stderr\n"
+              << "      --format         Report format: table, tsv (the CSV export's rows) or json (default: table)\n"
+              << "      --stats-json     Write scan timings (readdir, stat, aggregation) to a JSON file\n"
+              << "      --watch          Keep the results current from inotify and serve them on a Unix socket (Linux)\n"
+              << "      --coordinate     Split the scan into shards for --worker processes connecting on this port (Linux)\n"
+              << "      --worker         Scan shards for the coordinator at <host>:<port>, with the same options (Linux)\n"
+              << "      --shard-seconds  Time a worker spends on a shard before handing back the rest (default: 2)\n"
+              << "      --memory-budget  Memory for type tables and index records, e.g. 256M; 0 for unlimited (default: 100M)\n"
+              << "      --estimate       Estimate the results from random probes, refining until interrupted or out of time\n"
+              << "      --estimate-seconds  Time budget of --estimate; 0 to run until interrupted (default: 60)\n"
+              << "      --confidence     Confidence level of the --estimate intervals (default: 0.95)\n"
+              << "Example:\n"
+              << "  " << programName << " -a -e node_modules -t .cpp -t .h -s 1K -S 1M -o results.csv /path/to/dir\n"
+              << RESET;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string targetDir;
+    std::string outputFile;
+    bool showHidden = false;
+    bool showProgress = false;
+    bool quiet = false;
+    OutputFormat format = OutputFormat::Table;
+    bool histogram = false;
+    bool diskUsage = false;
+    bool findDuplicates = false;
+    bool oneFileSystem = false;
+    std::vector<std::pair<std::string, size_t>> mountJobs;
+    bool adaptive = false;
+    double maxLatencyMs = 10;
+    std::string statsJsonFile;
+    std::string exportFilesFile;
+    std::string exportDirsFile;
+    std::string exportTreeFile;
+    std::vector<GroupDimension> groupBy;
+    std::string watchSocket;
+    std::string coordinatePort;
+    std::string workerAddress;
+    double shardSeconds = 2;
+    bool estimateMode = false;
+    double estimateSeconds = 60;
+    double confidence = 0.95;
+    size_t topFileCount = 0;
+    size_t topDirCount = 0;
+    std::vector<std::string> excludeDirs;
+    std::vector<std::string> includeTypes;
+    std::vector<std::string> filters;
+    SizeThreshold sizeThreshold;
+    size_t jobs = 1;
+    size_t memoryBudget = MAX_MEMORY_LIMIT;
+    ScanBackend backend = defaultBackend();
+    std::string indexFile;
+    std::string saveFile;
+    std::string loadFile;
+    std::vector<std::string> diffFiles;
+    std::vector<std::string> opaqueNames;
+    OpaqueMode opaqueMode = OpaqueMode::Walk;
+    ScanOrder scanOrder = ScanOrder::Readdir;
+
+    setColors(colorsOnTerminal());
+    setWarningHandler([](const std::string &message)
+                      { std::cerr << RED << message << RESET << std::endl; });
+
+    // Long options also accept their value as --option=value
+    std::vector<std::string> splitArguments;
+    for (int i = 0; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const size_t equals = arg.find('=');
+        if (i > 0 && arg.compare(0, 2, "--") == 0 && equals != std::string::npos)
+        {
+            splitArguments.push_back(arg.substr(0, equals));
+            splitArguments.push_back(arg.substr(equals + 1));
+        }
+        else
+        {
+            splitArguments.push_back(arg);
+        }
+    }
+    std::vector<char *> arguments;
+    for (auto &arg : splitArguments)
+    {
+        arguments.push_back(arg.data());
+    }
+    arguments.push_back(nullptr);
+    argc = static_cast<int>(splitArguments.size());
+    argv = arguments.data();
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "-h" || arg == "--help")
+            {
+                printUsage(argv[0]);
+                return 0;
+            }
+            else if (arg == "-a" || arg == "--all")
+            {
                 showHidden = true;
             }
-            else if (arg == "-e" || arg == "--exclude")
+            else if (arg == "-e" || arg == "--exclude")
+            {
+                if (++i < argc)
+                {
+                    excludeDirs.push_back(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: -e option requires a directory");
+                }
+            }
+            else if (arg == "-o" || arg == "--output")
+            {
+                if (++i < argc)
+                {
+                    outputFile = argv[i];
+                }
+                else
+                {
+                    throw std::runtime_error("Error: -o option requires a filename");
+                }
+            }
+            else if (arg == "-t" || arg == "--type")
+            {
+                if (++i < argc)
+                {
+                    includeTypes.push_back(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: -t option requires a file type");
+                }
+            }
+            else if (arg == "-s" || arg == "--min-size")
+            {
+                if (++i < argc)
+                {
+                    sizeThreshold.minSize = parseSize(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: -s option requires a size value");
+                }
+            }
+            else if (arg == "-S" || arg == "--max-size")
+            {
+                if (++i < argc)
+                {
+                    sizeThreshold.maxSize = parseSize(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: -S option requires a size value");
+                }
+            }
+            else if (arg == "-w" || arg == "--where")
+            {
+                if (++i < argc)
+                {
+                    filters.push_back(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: -w option requires an expression");
+                }
+            }
+            else if (arg == "-j" || arg == "--jobs")
+            {
+                if (++i < argc)
+                {
+                    jobs = parseCount(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: -j option requires a worker count");
+                }
+            }
+            else if (arg == "-x" || arg == "--one-file-system")
+            {
+                oneFileSystem = true;
+            }
+            else if (arg == "--adaptive")
+            {
+                adaptive = true;
+            }
+            else if (arg == "--max-latency")
+            {
+                if (++i < argc)
+                {
+                    char *end = nullptr;
+                    maxLatencyMs = std::strtod(argv[i], &end);
+                    if (*end != '\0' || !(maxLatencyMs > 0) || maxLatencyMs > 60000)
+                    {
+                        throw std::runtime_error("Error: Invalid latency ceiling: " + std::string(argv[i]));
+                    }
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --max-latency option requires a number of milliseconds");
+                }
+            }
+            else if (arg == "--mount-jobs")
+            {
+                const std::string value = ++i < argc ? argv[i] : "";
+                const size_t equals = value.rfind('=');
+                if (equals == std::string::npos || equals == 0)
+                {
+                    throw std::runtime_error("Error: --mount-jobs option requires <mount>=<count>");
+                }
+                mountJobs.emplace_back(value.substr(0, equals), parseCount(value.substr(equals + 1)));
+            }
+            else if (arg == "-i" || arg == "--index")
+            {
+                if (++i < argc)
+                {
+                    indexFile = argv[i];
+                }
+                else
+                {
+                    throw std::runtime_error("Error: -i option requires a filename");
+                }
+            }
+            else if (arg == "--opaque")
             {
                 if (++i < argc)
                 {
-                    excludeDirs.push_back(argv[i]);
+                    opaqueNames.push_back(argv[i]);
                 }
                 else
                 {
-                    throw std::runtime_error("Error: -e option requires a directory");
+                    throw std::runtime_error("Error: --opaque option requires a directory name");
                 }
             }
-            else if (arg == "-o" || arg == "--output")
+            else if (arg == "--opaque-mode")
             {
                 if (++i < argc)
                 {
-                    outputFile = argv[i];
+                    opaqueMode = parseOpaqueMode(argv[i]);
                 }
                 else
                 {
-                    throw std::runtime_error("Error: -o option requires a filename");
+                    throw std::runtime_error("Error: --opaque-mode option requires a mode");
                 }
             }
-            else if (arg == "-t" || arg == "--type")
+            else if (arg == "--order")
             {
                 if (++i < argc)
                 {
-                    includeTypes.push_back(argv[i]);
+                    scanOrder = parseScanOrder(argv[i]);
                 }
                 else
                 {
-                    throw std::runtime_error("Error: -t option requires a file type");
+                    throw std::runtime_error("Error: --order option requires readdir, inode or bfs");
                 }
             }
-            else if (arg == "-s" || arg == "--min-size")
+            else if (arg == "--save")
             {
                 if (++i < argc)
                 {
-                    sizeThreshold.minSize = parseSize(argv[i]);
+                    saveFile = argv[i];
                 }
                 else
                 {
-                    throw std::runtime_error("Error: -s option requires a size value");
+                    throw std::runtime_error("Error: --save option requires a filename");
                 }
             }
-            else if (arg == "-S" || arg == "--max-size")
+            else if (arg == "--load")
             {
                 if (++i < argc)
                 {
-                    sizeThreshold.maxSize = parseSize(argv[i]);
+                    loadFile = argv[i];
                 }
                 else
                 {
-                    throw std::runtime_error("Error: -S option requires a size value");
+                    throw std::runtime_error("Error: --load option requires a filename");
+                }
+            }
+            else if (arg == "--diff")
+            {
+                if (i + 2 < argc)
+                {
+                    diffFiles = {argv[i + 1], argv[i + 2]};
+                    i += 2;
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --diff option requires an old and a new snapshot");
+                }
+            }
+            else if (arg == "--find-duplicates")
+            {
+                findDuplicates = true;
+            }
+            else if (arg == "--disk-usage")
+            {
+                diskUsage = true;
+            }
+            else if (arg == "--histogram")
+            {
+                histogram = true;
+            }
+            else if (arg == "--top-files")
+            {
+                if (++i < argc)
+                {
+                    topFileCount = parseCount(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --top-files option requires a count");
+                }
+            }
+            else if (arg == "--top-dirs")
+            {
+                if (++i < argc)
+                {
+                    topDirCount = parseCount(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --top-dirs option requires a count");
+                }
+            }
+            else if (arg == "--group-by")
+            {
+                if (++i < argc)
+                {
+                    groupBy = parseGroupBy(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --group-by option requires a list of dimensions");
+                }
+            }
+            else if (arg == "--progress")
+            {
+                showProgress = true;
+            }
+            else if (arg == "-q" || arg == "--quiet")
+            {
+                quiet = true;
+            }
+            else if (arg == "--format")
+            {
+                if (++i < argc)
+                {
+                    format = parseOutputFormat(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --format option requires table, tsv or json");
+                }
+            }
+            else if (arg == "--stats-json")
+            {
+                if (++i < argc)
+                {
+                    statsJsonFile = argv[i];
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --stats-json option requires a filename");
+                }
+            }
+            else if (arg == "--export-files")
+            {
+                if (++i < argc)
+                {
+                    exportFilesFile = argv[i];
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --export-files option requires a filename");
+                }
+            }
+            else if (arg == "--export-dirs")
+            {
+                if (++i < argc)
+                {
+                    exportDirsFile = argv[i];
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --export-dirs option requires a filename");
+                }
+            }
+            else if (arg == "--export-tree")
+            {
+                if (++i < argc)
+                {
+                    exportTreeFile = argv[i];
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --export-tree option requires a filename");
+                }
+            }
+            else if (arg == "--watch")
+            {
+                if (++i < argc)
+                {
+                    watchSocket = argv[i];
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --watch option requires a socket path");
+                }
+            }
+            else if (arg == "--coordinate")
+            {
+                if (++i < argc)
+                {
+                    coordinatePort = argv[i];
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --coordinate option requires a port");
+                }
+            }
+            else if (arg == "--worker")
+            {
+                if (++i < argc)
+                {
+                    workerAddress = argv[i];
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --worker option requires <host>:<port>");
+                }
+            }
+            else if (arg == "--shard-seconds")
+            {
+                if (++i < argc)
+                {
+                    char *end = nullptr;
+                    shardSeconds = std::strtod(argv[i], &end);
+                    if (*end != '\0' || !(shardSeconds > 0) || shardSeconds > 3600)
+                    {
+                        throw std::runtime_error("Error: Invalid shard time: " + std::string(argv[i]));
+                    }
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --shard-seconds option requires a number of seconds");
+                }
+            }
+            else if (arg == "--estimate")
+            {
+                estimateMode = true;
+            }
+            else if (arg == "--estimate-seconds")
+            {
+                if (++i < argc)
+                {
+                    char *end = nullptr;
+                    estimateSeconds = std::strtod(argv[i], &end);
+                    if (*end != '\0' || !(estimateSeconds >= 0) || estimateSeconds > 1e6)
+                    {
+                        throw std::runtime_error("Error: Invalid estimate time: " + std::string(argv[i]));
+                    }
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --estimate-seconds option requires a number of seconds");
+                }
+            }
+            else if (arg == "--confidence")
+            {
+                if (++i < argc)
+                {
+                    char *end = nullptr;
+                    confidence = std::strtod(argv[i], &end);
+                    if (*end != '\0' || !(confidence > 0 && confidence < 1))
+                    {
+                        throw std::runtime_error("Error: Invalid confidence: " + std::string(argv[i]) + " (expected a value between 0 and 1)");
+                    }
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --confidence option requires a value between 0 and 1");
+                }
+            }
+            else if (arg == "--memory-budget")
+            {
+                if (++i < argc)
+                {
+                    memoryBudget = parseSize(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: --memory-budget option requires a size");
+                }
+            }
+            else if (arg == "-b" || arg == "--backend")
+            {
+                if (++i < argc)
+                {
+                    backend = parseBackend(argv[i]);
+                }
+                else
+                {
+                    throw std::runtime_error("Error: -b option requires a backend name");
                 }
             }
             else if (targetDir.empty())
@@ -516,16 +2169,149 @@ int main(int argc, char *argv[])
                 targetDir = arg;
             }
         }
-        if (targetDir.empty())
+        // Banners and "exported to" lines are for people; scripts get only the report, or nothing
+        const bool chatty = !quiet && format == OutputFormat::Table;
+        if (format != OutputFormat::Table &&
+            (!diffFiles.empty() || !watchSocket.empty() || !coordinatePort.empty() || !workerAddress.empty() ||
+             estimateMode || findDuplicates || topFileCount > 0 || topDirCount > 0))
+        {
+            throw std::runtime_error("Error: --format tsv and json print the per-type totals of a scan or --load; they cannot be combined with --diff, --watch, distributed scans, --estimate, --find-duplicates, --top-files or --top-dirs");
+        }
+        if (!diffFiles.empty())
+        {
+            printDiff(diffSnapshots(diffFiles[0], diffFiles[1], topDirCount > 0 ? topDirCount : 20));
+            return 0;
+        }
+        if (!loadFile.empty())
+        {
+            if (!groupBy.empty())
+            {
+                throw std::runtime_error("Error: --group-by needs a scan; snapshots only keep per-type totals");
+            }
+            CliAnalyzer analyzer;
+            const std::string root = analyzer.loadSnapshot(loadFile);
+            if (chatty)
+            {
+                std::cout << BLUE << "Snapshot of " << root << RESET << "\n";
+            }
+            if (!quiet)
+            {
+                printReport(analyzer, format);
+            }
+            if (!outputFile.empty())
+            {
+                exportCsv(analyzer, outputFile);
+                if (chatty)
+                {
+                    std::cout << GREEN << "Results exported to " << outputFile << RESET << "\n";
+                }
+            }
+            return 0;
+        }
+        if (targetDir.empty() && workerAddress.empty())
         {
             throw std::runtime_error("Error: No directory specified");
         }
-        if (!fs::exists(targetDir) || !fs::is_directory(targetDir))
+        if (!targetDir.empty() && !workerAddress.empty())
+        {
+            throw std::runtime_error("Error: --worker scans the directories its coordinator hands out, not " + targetDir);
+        }
+        std::error_code statError;
+        if (!targetDir.empty() && !fs::is_directory(targetDir, statError))
         {
             throw std::runtime_error("Error: Invalid directory: " + targetDir);
         }
-        FileAnalyzer analyzer(showHidden);
+        if (!coordinatePort.empty() || !workerAddress.empty())
+        {
+#ifndef __linux__
+            throw std::runtime_error("Error: --coordinate and --worker are only supported on Linux");
+#endif
+            if (!coordinatePort.empty() && !workerAddress.empty())
+            {
+                throw std::runtime_error("Error: --coordinate and --worker cannot be combined");
+            }
+            if (!indexFile.empty() || !saveFile.empty() || !watchSocket.empty() || findDuplicates || diskUsage ||
+                topDirCount > 0 || !groupBy.empty() || !exportFilesFile.empty() || !exportDirsFile.empty() || !exportTreeFile.empty())
+            {
+                throw std::runtime_error("Error: Distributed scans cannot be combined with --index, --save, --watch, --find-duplicates, --disk-usage, --top-dirs, --group-by or exports");
+            }
+        }
+        if (!watchSocket.empty())
+        {
+#ifndef __linux__
+            throw std::runtime_error("Error: --watch is only supported on Linux");
+#endif
+            if (!indexFile.empty() || !saveFile.empty() || findDuplicates || diskUsage || !groupBy.empty() ||
+                !exportFilesFile.empty() || !exportDirsFile.empty())
+            {
+                throw std::runtime_error("Error: --watch cannot be combined with --index, --save, --find-duplicates, --disk-usage, --group-by or exports");
+            }
+        }
+        if (estimateMode)
+        {
+            if (!indexFile.empty() || !saveFile.empty() || !watchSocket.empty() || !coordinatePort.empty() ||
+                !workerAddress.empty() || findDuplicates || diskUsage || histogram || topFileCount > 0 ||
+                topDirCount > 0 || !groupBy.empty() || !outputFile.empty() || !exportFilesFile.empty() || !exportDirsFile.empty() ||
+                !exportTreeFile.empty() || !statsJsonFile.empty())
+            {
+                throw std::runtime_error("Error: --estimate cannot be combined with --index, --save, --watch, distributed scans, --find-duplicates, --disk-usage, --histogram, --top-files, --top-dirs, --group-by, --stats-json or exports");
+            }
+        }
+        CliAnalyzer analyzer(showHidden);
         analyzer.setSizeThreshold(sizeThreshold);
+        analyzer.setJobs(jobs);
+        analyzer.setMemoryBudget(memoryBudget);
+        analyzer.setBackend(backend);
+        analyzer.setOpaqueMode(opaqueMode);
+        analyzer.setScanOrder(scanOrder);
+        analyzer.setOneFileSystem(oneFileSystem);
+        analyzer.setAdaptive(adaptive, std::chrono::nanoseconds(static_cast<int64_t>(maxLatencyMs * 1e6)));
+        for (const auto &[mount, count] : mountJobs)
+        {
+            analyzer.setMountJobs(mount, count);
+        }
+        const bool progressTerminal = progressOnTerminal();
+        if (showProgress)
+        {
+            analyzer.setProgressCallback([progressTerminal](const ScanProgress &report)
+                                         { printProgress(report, progressTerminal); },
+                                         std::chrono::milliseconds(progressTerminal ? 500 : 5000));
+        }
+        analyzer.setDistributions(histogram);
+        analyzer.setDiskUsage(diskUsage);
+        analyzer.aggregators().get<DuplicateAggregator>().setEnabled(findDuplicates);
+        analyzer.aggregators().get<LiveAggregator>().setEnabled(!watchSocket.empty());
+        analyzer.aggregators().get<TopFilesAggregator>().setLimit(topFileCount);
+        analyzer.aggregators().get<TopDirsAggregator>().setLimit(topDirCount);
+        if (!statsJsonFile.empty())
+        {
+            analyzer.setStatsJsonFile(statsJsonFile);
+        }
+        if (!exportFilesFile.empty())
+        {
+            analyzer.aggregators().get<ExportAggregator>().setFileOutput(exportFilesFile);
+        }
+        if (!exportDirsFile.empty())
+        {
+            analyzer.aggregators().get<ExportAggregator>().setDirectoryOutput(exportDirsFile);
+        }
+        for (const auto &name : opaqueNames)
+        {
+            analyzer.addOpaqueName(name);
+        }
+        if (!indexFile.empty())
+        {
+            analyzer.setIndexFile(indexFile);
+        }
+        if (!saveFile.empty())
+        {
+            analyzer.enableSnapshot();
+        }
+        if (!exportTreeFile.empty())
+        {
+            analyzer.enableDirectoryTree();
+        }
+        analyzer.aggregators().get<GroupByAggregator>().setDimensions(groupBy);
         for (const auto &dir : excludeDirs)
         {
             analyzer.addExcludeDir(dir);
@@ -534,13 +2320,121 @@ int main(int argc, char *argv[])
         {
             analyzer.addIncludeType(type.empty() ? "[no extension]" : type);
         }
-        std::cout << BLUE << "Analyzing directory: " << targetDir << RESET << std::endl;
-        analyzer.analyze(targetDir);
-        analyzer.printResults();
+        for (const auto &expression : filters)
+        {
+            analyzer.addFilter(expression);
+        }
+#ifdef __linux__
+        if (!workerAddress.empty())
+        {
+            runWorker(analyzer, workerAddress);
+            return 0;
+        }
+#endif
+        if (chatty)
+        {
+            std::cout << BLUE << "Analyzing directory: " << targetDir << RESET << std::endl;
+        }
+        if (!coordinatePort.empty())
+        {
+#ifdef __linux__
+            runCoordinator(analyzer, targetDir, coordinatePort,
+                           std::chrono::milliseconds(static_cast<int64_t>(shardSeconds * 1000)));
+#endif
+        }
+        else if (estimateMode)
+        {
+            // Refine on stderr every 0.5 s on a terminal, every 5 s otherwise; SIGINT stops
+            // the probes and prints the estimate reached so far
+            const double z = normalQuantile(confidence);
+            auto lastLine = std::chrono::steady_clock::now();
+            std::signal(SIGINT, requestEstimateStop);
+            analyzer.estimate(targetDir, std::chrono::milliseconds(static_cast<int64_t>(estimateSeconds * 1000)),
+                              std::chrono::milliseconds(500), [&](const TreeEstimate &estimate)
+                              {
+                                  const auto now = std::chrono::steady_clock::now();
+                                  if (progressTerminal || now - lastLine >= std::chrono::seconds(5))
+                                  {
+                                      printEstimateProgress(estimate, z, progressTerminal);
+                                      lastLine = now;
+                                  }
+                                  return !estimateStopRequested; });
+            std::signal(SIGINT, SIG_DFL);
+            if (progressTerminal)
+            {
+                std::cerr << "\r\033[K" << std::flush;
+            }
+        }
+        else
+        {
+#ifdef DA_COUNT_ALLOCATIONS
+            const size_t allocationsBefore = heapAllocations.load();
+            analyzer.analyze(targetDir);
+            const size_t allocations = heapAllocations.load() - allocationsBefore;
+            std::cerr << "Heap allocations during scan: " << allocations << " ("
+                      << std::fixed << std::setprecision(3)
+                      << static_cast<double>(allocations) / std::max<size_t>(analyzer.entriesExamined(), 1)
+                      << " per entry)" << std::endl;
+#else
+            analyzer.analyze(targetDir);
+#endif
+        }
+        if (showProgress && progressTerminal)
+        {
+            std::cerr << "\r\033[K" << std::flush;
+        }
+        if (!indexFile.empty() && chatty)
+        {
+            std::cout << BLUE << "Index: " << analyzer.reusedDirectories() << " directories reused, "
+                      << analyzer.rescannedDirectories() << " rescanned" << RESET << "\n";
+        }
+        analyzer.writeStatsJson();
+        if (!quiet)
+        {
+            printReport(analyzer, format, confidence);
+        }
         if (!outputFile.empty())
         {
-            analyzer.exportCsv(outputFile);
+            exportCsv(analyzer, outputFile);
+            if (chatty)
+            {
+                std::cout << GREEN << "Results exported to " << outputFile << RESET << "\n";
+            }
+        }
+        const ExportAggregator &exports = analyzer.aggregators().get<ExportAggregator>();
+        if (!exportFilesFile.empty() && chatty)
+        {
+            std::cout << GREEN << exports.filesExported() << " files exported to " << exportFilesFile << RESET << "\n";
+        }
+        if (!exportDirsFile.empty() && chatty)
+        {
+            std::cout << GREEN << exports.directoriesExported() << " directories exported to " << exportDirsFile << RESET << "\n";
+        }
+        if (!exportTreeFile.empty())
+        {
+            exportTree(analyzer.directoryTree(), exportTreeFile);
+            if (chatty)
+            {
+                std::cout << GREEN << analyzer.directoryTree().size() << " directories exported to " << exportTreeFile << RESET << "\n";
+            }
+        }
+        if (!saveFile.empty())
+        {
+            analyzer.saveSnapshot(saveFile);
+            if (chatty)
+            {
+                std::cout << GREEN << "Snapshot saved to " << saveFile << RESET << "\n";
+            }
+        }
+#ifdef __linux__
+        if (!watchSocket.empty())
+        {
+            analyzer.setProgressCallback(nullptr);
+            analyzer.aggregators().get<TopFilesAggregator>().setLimit(0);
+            analyzer.aggregators().get<TopDirsAggregator>().setLimit(0);
+            runWatch(analyzer, targetDir, watchSocket);
         }
+#endif
     }
     catch (const std::exception &e)
     {
@@ -549,4 +2443,4 @@ int main(int argc, char *argv[])
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}